@@ -0,0 +1,225 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/*
+ * Compares the array of structs and structure of arrays layouts of the
+ * OpenCL particle state (ParticleSystem::layout) by timing the kernels in
+ * cl_programs/particles.cl with every particle alive.
+ *
+ * Kernels are timed with the profiling timestamps of their events.
+ * Bandwidth is the bytes a kernel reads and writes per particle (see
+ * kernel_bytes()) over that time: the whole struct for AoS since the fields
+ * share cache lines, only the touched fields for SoA.
+ *
+ * Uses the default OpenCL device without GL sharing.
+ *
+ * Usage: bench/particles [particles] [iterations]
+ */
+
+#include "cl.hpp"
+#include "data.hpp"
+#include "logging.hpp"
+#include "particle_system.hpp"
+
+#include <glm/glm.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+static void report(const char * name, double aos_ms, double soa_ms) {
+	printf("%-20s %10.3f ms %10.3f ms %8.2fx\n", name, aos_ms, soa_ms, aos_ms / soa_ms);
+}
+
+static void report_bandwidth(const char * name, double aos_gbs, double soa_gbs) {
+	printf("%-20s %8.2f GB/s %8.2f GB/s\n", name, aos_gbs, soa_gbs);
+}
+
+struct result_t {
+	double spawn_ms; /* Spawning the whole pool */
+	double run_ms;   /* One update */
+	size_t state_bytes;
+};
+
+struct kernel_bytes_t {
+	size_t spawn; /* Per spawned particle */
+	size_t run;   /* Per live particle */
+};
+
+/*
+ * Bytes moved per particle, following cl_programs/particles.cl with every
+ * particle alive:
+ *  run_particles reads dead, emitter, ttl, org_ttl, position, velocity and
+ *  six more scalars, writes back ttl, position and velocity and writes one
+ *  particle_vertex_t.
+ *  spawn_particles pops a dead index and writes every field.
+ * The config and height map are a few bytes shared by all work items and are
+ * left out.
+ */
+static kernel_bytes_t kernel_bytes(ParticleSystem::layout_t layout, const result_t &result, int n) {
+	const size_t particle_bytes = result.state_bytes / n;
+	const size_t float3_bytes = sizeof(cl_float4); /* float3 is padded to float4 */
+	const size_t run_read = (layout == ParticleSystem::LAYOUT_AOS)
+		? particle_bytes
+		: 2 * float3_bytes + 10 * sizeof(cl_float);
+	const size_t run_write = 2 * float3_bytes + sizeof(cl_float) + sizeof(particle_vertex_t);
+
+	kernel_bytes_t bytes;
+	bytes.spawn = particle_bytes + sizeof(cl_int);
+	bytes.run = run_read + run_write;
+	return bytes;
+}
+
+static double gbs(size_t bytes_per_particle, int n, double ms) {
+	return static_cast<double>(bytes_per_particle) * n / (ms * 1e6);
+}
+
+/* Device time between start and end of the command, needs CL_QUEUE_PROFILING_ENABLE */
+static double kernel_ms(const cl::Event &event) {
+	const cl_ulong start = event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+	const cl_ulong end = event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+	return static_cast<double>(end - start) * 1e-6;
+}
+
+/* Nothing dies during the benchmark */
+static particle_config_t bench_config(int max_num_particles) {
+	particle_config_t c = particle_config_defaults();
+	c.spawn_position = glm::vec4(0.f, 0.f, 0.f, 1.f);
+	c.spawn_area = glm::vec4(100.f, 100.f, 100.f, 1.f);
+	c.motion_rand = glm::vec4(0.1f, 0.1f, 0.1f, 0.f);
+	c.bounds_min = glm::vec4(-1e9f, -1e9f, -1e9f, 0.f);
+	c.bounds_max = glm::vec4(1e9f, 1e9f, 1e9f, 0.f);
+	c.avg_ttl = 1e9f;
+	c.ttl_var = 0.f;
+	c.max_num_particles = max_num_particles;
+	return c;
+}
+
+static result_t bench_layout(ParticleSystem::layout_t layout, int n, int iterations) {
+	cl::Program program = CL::create_program("/cl_programs/particles.cl", ParticleSystem::program_options(layout));
+	cl::Kernel run_kernel = CL::load_kernel(program, "run_particles");
+	cl::Kernel spawn_kernel = CL::load_kernel(program, "spawn_particles");
+
+	const std::vector<char> initial = ParticleSystem::initial_state(layout, n);
+	const particle_config_t config = bench_config(n);
+	const cl_int spawn_offsets[2] = { 0, n };
+	const cl_int zero = 0;
+	const float no_height_map = 0.f;
+	cl_int2 height_map_size;
+	height_map_size.s[0] = height_map_size.s[1] = 0;
+
+	std::vector<cl_int> dead_indices(n);
+	for(int i=0; i<n; ++i) dead_indices[i] = n - 1 - i;
+
+	cl::Buffer particles = CL::create_buffer(CL_MEM_READ_WRITE, initial.size());
+	cl::Buffer vertices = CL::create_buffer(CL_MEM_WRITE_ONLY, sizeof(particle_vertex_t) * n);
+	cl::Buffer config_buffer = CL::create_buffer(CL_MEM_READ_ONLY, sizeof(particle_config_t));
+	cl::Buffer offsets_buffer = CL::create_buffer(CL_MEM_READ_ONLY, sizeof(spawn_offsets));
+	cl::Buffer dead_indices_buffer = CL::create_buffer(CL_MEM_READ_WRITE, sizeof(cl_int) * n);
+	cl::Buffer dead_count = CL::create_buffer(CL_MEM_READ_WRITE, sizeof(cl_int));
+	cl::Buffer vertex_count = CL::create_buffer(CL_MEM_READ_WRITE, sizeof(cl_int));
+	cl::Buffer height_map = CL::create_buffer(CL_MEM_READ_ONLY, sizeof(float));
+
+	cl::CommandQueue &queue = CL::queue();
+	CL::check_error(queue.enqueueWriteBuffer(config_buffer, CL_TRUE, 0, sizeof(particle_config_t), &config), "[Bench] Write config");
+	CL::check_error(queue.enqueueWriteBuffer(offsets_buffer, CL_TRUE, 0, sizeof(spawn_offsets), spawn_offsets), "[Bench] Write offsets");
+	CL::check_error(queue.enqueueWriteBuffer(height_map, CL_TRUE, 0, sizeof(float), &no_height_map), "[Bench] Write height map");
+
+	/* Same arguments as ParticleSystem */
+	const uint32_t seed = 1;
+	run_kernel.setArg(0, vertices);
+	run_kernel.setArg(1, particles);
+	run_kernel.setArg(2, config_buffer);
+	run_kernel.setArg(3, dead_indices_buffer);
+	run_kernel.setArg(4, dead_count);
+	run_kernel.setArg(5, vertex_count);
+	run_kernel.setArg(6, 0.01f);
+	run_kernel.setArg(7, seed);
+	run_kernel.setArg(9, height_map);
+	run_kernel.setArg(10, height_map_size);
+	run_kernel.setArg(11, 1.f);
+
+	spawn_kernel.setArg(0, particles);
+	spawn_kernel.setArg(1, config_buffer);
+	spawn_kernel.setArg(2, offsets_buffer);
+	spawn_kernel.setArg(3, (cl_int) 1);
+	spawn_kernel.setArg(4, dead_indices_buffer);
+	spawn_kernel.setArg(5, dead_count);
+	spawn_kernel.setArg(6, seed);
+	spawn_kernel.setArg(8, height_map);
+	spawn_kernel.setArg(9, height_map_size);
+	spawn_kernel.setArg(10, 1.f);
+
+	result_t result;
+	result.state_bytes = initial.size();
+	result.spawn_ms = 0.0;
+
+	cl::Event event;
+	for(int i=0; i<iterations; ++i) {
+		CL::check_error(queue.enqueueWriteBuffer(particles, CL_TRUE, 0, initial.size(), &initial[0]), "[Bench] Write particles");
+		CL::check_error(queue.enqueueWriteBuffer(dead_indices_buffer, CL_TRUE, 0, sizeof(cl_int) * n, &dead_indices[0]), "[Bench] Write dead indices");
+		CL::check_error(queue.enqueueWriteBuffer(dead_count, CL_TRUE, 0, sizeof(cl_int), &n), "[Bench] Write dead count");
+		spawn_kernel.setArg(7, (cl_uint) i);
+
+		CL::check_error(queue.enqueueNDRangeKernel(spawn_kernel, cl::NullRange, cl::NDRange(n), cl::NullRange, nullptr, &event), "[Bench] Spawn");
+		event.wait();
+		result.spawn_ms += kernel_ms(event);
+	}
+	result.spawn_ms /= iterations;
+
+	std::vector<cl::Event> run_events(iterations);
+	for(int i=0; i<iterations; ++i) {
+		run_kernel.setArg(8, (cl_uint) i);
+		queue.enqueueWriteBuffer(vertex_count, CL_FALSE, 0, sizeof(cl_int), &zero);
+		CL::check_error(queue.enqueueNDRangeKernel(run_kernel, cl::NullRange, cl::NDRange(n), cl::NullRange, nullptr, &run_events[i]), "[Bench] Run");
+	}
+	CL::finish();
+
+	result.run_ms = 0.0;
+	for(int i=0; i<iterations; ++i) {
+		result.run_ms += kernel_ms(run_events[i]);
+	}
+	result.run_ms /= iterations;
+
+	cl_int alive = 0;
+	queue.enqueueReadBuffer(vertex_count, CL_TRUE, 0, sizeof(cl_int), &alive);
+	if(alive != n) {
+		fprintf(stderr, "Expected %d live particles after run, got %d\n", n, alive);
+	}
+
+	return result;
+}
+
+int main(int argc, const char* argv[]) {
+	const int n = (argc > 1) ? atoi(argv[1]) : 200000;
+	const int iterations = (argc > 2) ? atoi(argv[2]) : 100;
+
+	Logging::init();
+	Logging::add_destination(Logging::WARNING, stderr);
+	Data::add_search_path(srcdir);
+
+	if(!CL::init_compute(CL_QUEUE_PROFILING_ENABLE)) {
+		fprintf(stderr, "OpenCL not available\n");
+		return 1;
+	}
+
+	const result_t aos = bench_layout(ParticleSystem::LAYOUT_AOS, n, iterations);
+	const result_t soa = bench_layout(ParticleSystem::LAYOUT_SOA, n, iterations);
+
+	const kernel_bytes_t aos_bytes = kernel_bytes(ParticleSystem::LAYOUT_AOS, aos, n);
+	const kernel_bytes_t soa_bytes = kernel_bytes(ParticleSystem::LAYOUT_SOA, soa, n);
+
+	printf("%d particles, %d iterations\n", n, iterations);
+	printf("%-20s %13s %13s %9s\n", "", "AoS", "SoA", "speedup");
+	report("spawn", aos.spawn_ms, soa.spawn_ms);
+	report("run", aos.run_ms, soa.run_ms);
+	report_bandwidth("spawn bandwidth", gbs(aos_bytes.spawn, n, aos.spawn_ms), gbs(soa_bytes.spawn, n, soa.spawn_ms));
+	report_bandwidth("run bandwidth", gbs(aos_bytes.run, n, aos.run_ms), gbs(soa_bytes.run, n, soa.run_ms));
+	printf("%-20s %13d %13d\n", "bytes per particle", (int)(aos.state_bytes / n), (int)(soa.state_bytes / n));
+	printf("%-20s %13d %13d\n", "spawn bytes", (int)aos_bytes.spawn, (int)soa_bytes.spawn);
+	printf("%-20s %13d %13d\n", "run bytes", (int)aos_bytes.run, (int)soa_bytes.run);
+
+	Logging::cleanup();
+
+	return 0;
+}
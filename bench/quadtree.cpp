@@ -0,0 +1,206 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/*
+ * Compares QuadTree (one heap node per cell) with LinearQuadTree (flat
+ * Morton ordered array) for the operations used by the terrain:
+ * building, point lookups, full traversal (std::function and templated)
+ * and culled traversal.
+ *
+ * Usage: bench/quadtree [level] [iterations]
+ */
+
+#include "quadtree.hpp"
+#include "linear_quadtree.hpp"
+#include "aabb2d.hpp"
+
+#include <glm/glm.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+typedef LinearQuadTree<int> Linear;
+typedef std::chrono::high_resolution_clock bench_clock;
+
+static double ms_since(const bench_clock::time_point &start) {
+	return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+}
+
+static void report(const char * name, double pointer_ms, double linear_ms) {
+	printf("%-20s %10.3f ms %10.3f ms %8.2fx\n", name, pointer_ms, linear_ms, pointer_ms / linear_ms);
+}
+
+int main(int argc, const char* argv[]) {
+	const int level = (argc > 1) ? atoi(argv[1]) : 8;
+	const int iterations = (argc > 2) ? atoi(argv[2]) : 50;
+	const int side = 1 << level;
+	const float fside = static_cast<float>(side);
+	const AABB_2D bounds(glm::vec2(0.f), glm::vec2(fside));
+
+	/* Same pseudo random lookup points for both trees */
+	std::vector<glm::vec2> points;
+	srand(1);
+	for(int i=0; i<100000; ++i) {
+		points.push_back(glm::vec2(
+			static_cast<float>(rand() % side) + 0.5f,
+			static_cast<float>(rand() % side) + 0.5f
+		));
+	}
+
+	/* Culling window, a quarter of the area */
+	const glm::vec2 view_min(fside * 0.25f), view_max(fside * 0.75f);
+
+	printf("Level %d (%d leaves), %d iterations\n", level, side * side, iterations);
+	printf("%-20s %13s %13s %9s\n", "", "QuadTree", "LinearQuadTree", "speedup");
+
+	bench_clock::time_point start;
+	double pointer_ms, linear_ms;
+	volatile int sink = 0;
+
+	/* Build */
+	start = bench_clock::now();
+	QuadTree * pointer = new QuadTree(bounds, level);
+	for(int y=0; y<side; ++y) {
+		for(int x=0; x<side; ++x) {
+			pointer->child(glm::vec2(static_cast<float>(x) + 0.5f, static_cast<float>(y) + 0.5f))->data = (void*)(intptr_t)(y * side + x);
+		}
+	}
+	pointer_ms = ms_since(start);
+
+	start = bench_clock::now();
+	Linear * linear = new Linear(bounds, level);
+	for(int y=0; y<side; ++y) {
+		for(int x=0; x<side; ++x) {
+			linear->child(glm::vec2(static_cast<float>(x) + 0.5f, static_cast<float>(y) + 0.5f))->data = y * side + x;
+		}
+	}
+	linear_ms = ms_since(start);
+	report("build", pointer_ms, linear_ms);
+
+	/* Point lookups */
+	start = bench_clock::now();
+	for(const glm::vec2 &p : points) sink += (int)(intptr_t) pointer->child(p)->data;
+	pointer_ms = ms_since(start);
+
+	start = bench_clock::now();
+	for(const glm::vec2 &p : points) sink += linear->child(p)->data;
+	linear_ms = ms_since(start);
+	report("child()", pointer_ms, linear_ms);
+
+	/* Full traversal */
+	start = bench_clock::now();
+	for(int i=0; i<iterations; ++i) {
+		int accum = 0;
+		pointer->traverse([&accum](QuadTree * node) -> bool {
+			if(node->level() == 0) accum += (int)(intptr_t) node->data;
+			return true;
+		});
+		sink += accum;
+	}
+	pointer_ms = ms_since(start);
+
+	start = bench_clock::now();
+	for(int i=0; i<iterations; ++i) {
+		int accum = 0;
+		linear->traverse([&accum](Linear::node_t * node) -> bool {
+			if(node->level == 0) accum += node->data;
+			return true;
+		});
+		sink += accum;
+	}
+	linear_ms = ms_since(start);
+	report("traverse", pointer_ms, linear_ms);
+
+	/* Templated traversal, recursive and iterative */
+	start = bench_clock::now();
+	for(int i=0; i<iterations; ++i) {
+		int accum = 0;
+		pointer->visit([&accum](QuadTree * node) -> bool {
+			if(node->level() == 0) accum += (int)(intptr_t) node->data;
+			return true;
+		});
+		sink += accum;
+	}
+	pointer_ms = ms_since(start);
+
+	start = bench_clock::now();
+	for(int i=0; i<iterations; ++i) {
+		int accum = 0;
+		linear->visit([&accum](Linear::node_t * node) -> bool {
+			if(node->level == 0) accum += node->data;
+			return true;
+		});
+		sink += accum;
+	}
+	linear_ms = ms_since(start);
+	report("visit", pointer_ms, linear_ms);
+
+	start = bench_clock::now();
+	for(int i=0; i<iterations; ++i) {
+		int accum = 0;
+		pointer->visit_iterative([&accum](QuadTree * node) -> bool {
+			if(node->level() == 0) accum += (int)(intptr_t) node->data;
+			return true;
+		});
+		sink += accum;
+	}
+	pointer_ms = ms_since(start);
+
+	start = bench_clock::now();
+	for(int i=0; i<iterations; ++i) {
+		int accum = 0;
+		linear->visit_iterative([&accum](Linear::node_t * node) -> bool {
+			if(node->level == 0) accum += node->data;
+			return true;
+		});
+		sink += accum;
+	}
+	linear_ms = ms_since(start);
+	report("visit_iterative", pointer_ms, linear_ms);
+
+	/* Culled traversal, like Terrain::render_cull */
+	start = bench_clock::now();
+	for(int i=0; i<iterations; ++i) {
+		int accum = 0;
+		pointer->traverse([&](QuadTree * node) -> bool {
+			const AABB_2D &aabb = node->aabb;
+			if(aabb.max.x < view_min.x || aabb.min.x > view_max.x || aabb.max.y < view_min.y || aabb.min.y > view_max.y) return false;
+			if(node->level() == 0) accum += (int)(intptr_t) node->data;
+			return true;
+		});
+		sink += accum;
+	}
+	pointer_ms = ms_since(start);
+
+	start = bench_clock::now();
+	for(int i=0; i<iterations; ++i) {
+		int accum = 0;
+		linear->traverse([&](Linear::node_t * node) -> bool {
+			if(node->max.x < view_min.x || node->min.x > view_max.x || node->max.y < view_min.y || node->min.y > view_max.y) return false;
+			if(node->level == 0) accum += node->data;
+			return true;
+		});
+		sink += accum;
+	}
+	linear_ms = ms_since(start);
+	report("culled traverse", pointer_ms, linear_ms);
+
+	/* Linear scan of all leaves, only possible with the flat layout */
+	start = bench_clock::now();
+	for(int i=0; i<iterations; ++i) {
+		int accum = 0;
+		const std::vector<Linear::node_t> & nodes = linear->nodes();
+		for(size_t n = Linear::offset(level); n < nodes.size(); ++n) accum += nodes[n].data;
+		sink += accum;
+	}
+	linear_ms = ms_since(start);
+	printf("%-20s %13s %10.3f ms\n", "leaf scan", "-", linear_ms);
+
+	delete pointer;
+	delete linear;
+
+	return 0;
+}
@@ -1,78 +1,163 @@
 #include "particles_structs.cl"
 #include "particles_random.cl"
 
+/*
+ * Terrain height at p (xz), bilinear between the height map samples, which
+ * are scale apart. -INFINITY outside the map or when size is zero (no height
+ * map), so nothing collides there. Must match ParticleCPU::terrain_height.
+ */
+float terrain_height(__global const float * height_map, const int2 size, const float scale, const float2 p) {
+	float2 f = p / scale;
+	int2 i = convert_int2_sat(floor(f));
+	if(any(i < (int2)(0)) || any(i >= size - 1)) return -INFINITY;
+
+	f -= convert_float2(i);
+	__global const float * row = &height_map[i.y * size.x + i.x];
+	return mix(mix(row[0], row[1], f.x), mix(row[size.x], row[size.x + 1], f.x), f.y);
+}
+
+/*
+ * Live particles are written contiguously to vertices, num_vertices counts
+ * them and must be zero before the kernel runs. The order of the vertices
+ * is not preserved between frames.
+ * Each particle uses the config of the emitter that spawned it, configs has
+ * one entry per emitter of the system.
+ * Particles that die (or hit the terrain) are pushed to the dead index stack.
+ */
 __kernel void run_particles (
 														 __global vertex_t * vertices, 
-														 __global particle_t * particles, 
-														 __constant config_t * config, 
-														 __global const float * rnd,
+														 PARTICLES_ARG, 
+														 __constant config_t * configs, 
+														 __global int * dead_indices,
+														 __global int * dead_count,
+														 __global int * num_vertices,
 														 float dt,
-														 uint time
+														 uint seed,
+														 uint frame,
+														 __global const float * height_map,
+														 int2 height_map_size,
+														 float height_map_scale
 														 )
 {
 	uint id = get_global_id(0);
-	if(particles[id].dead == 0) {
-		particles[id].ttl -= dt;
-		if(particles[id].ttl > 0
-				&& all(isgreater(vertices[id].position.xyz,config->bounds_min))
-				&& all(isless(vertices[id].position.xyz, config->bounds_max))) {
-			float life_progression = 1.0 - (particles[id].ttl/particles[id].org_ttl);
+	PARTICLES_INIT(configs[0].max_num_particles);
+	rng_t rng = random_init(id, frame, seed, RANDOM_STREAM_RUN);
 
-			particles[id].velocity += config->gravity * particles[id].gravity_influence * dt;
-			particles[id].velocity -= (particles[id].velocity - config->wind_velocity) * particles[id].wind_influence * dt;
+	if(PARTICLE(id, dead) == 0) {
+		__constant config_t * config = &configs[PARTICLE(id, emitter)];
+		PARTICLE(id, ttl) -= dt;
+		if(PARTICLE(id, ttl) > 0
+				&& all(isgreater(PARTICLE(id, position).xyz,config->bounds_min))
+				&& all(isless(PARTICLE(id, position).xyz, config->bounds_max))
+				&& PARTICLE(id, position).y > terrain_height(height_map, height_map_size, height_map_scale, PARTICLE(id, position).xz)) {
+			float life_progression = 1.0 - (PARTICLE(id, ttl)/PARTICLE(id, org_ttl));
 
-			vertices[id].position.xyz += (particles[id].velocity + random3(config->motion_rand, true)) * dt;
-			vertices[id].position.w += particles[id].rotation_speed * dt;
+			PARTICLE(id, velocity) += config->gravity * PARTICLE(id, gravity_influence) * dt;
+			PARTICLE(id, velocity) -= (PARTICLE(id, velocity) - config->wind_velocity) * PARTICLE(id, wind_influence) * dt;
 
-			vertices[id].color = mix(config->birth_color, config->death_color, life_progression);
-			vertices[id].scale = mix(particles[id].initial_scale, particles[id].final_scale, life_progression);
+			PARTICLE(id, position).xyz += (PARTICLE(id, velocity) + random3(config->motion_rand, true)) * dt;
+			PARTICLE(id, position).w += PARTICLE(id, rotation_speed) * dt;
 
-		} else {
-			//Dead!
-			vertices[id].color.w = 0.0;
-			particles[id].dead = 1;
+			__global vertex_t * vertex = &vertices[atomic_inc(num_vertices)];
+			vertex->position = PARTICLE(id, position);
+			vertex->color = mix(config->birth_color, config->death_color, life_progression);
+			vertex->scale = mix(PARTICLE(id, initial_scale), PARTICLE(id, final_scale), life_progression);
+			vertex->texture_index = PARTICLE(id, texture_index);
+			return;
 		}
-	}
 
+		//Dead!
+		PARTICLE(id, dead) = 1;
+		dead_indices[atomic_inc(dead_count)] = id;
+	}
 }
 
+/*
+ * Handles all spawn requests of a frame in one dispatch. Request k spawns
+ * spawn_offsets[k+1] - spawn_offsets[k] particles with spawn_configs[k]
+ * (spawn_offsets has num_spawns + 1 elements, prefix summed counts).
+ *
+ * Run with one work item per particle to spawn, each pops a dead particle
+ * from the dead index stack. Work items beyond the number of dead particles
+ * do nothing.
+ */
 __kernel void spawn_particles (
-														 __global vertex_t * vertices, 
-														 __global particle_t * particles, 
-														 __constant config_t * config, 
-														 __global const float * rnd,
-														 __global int * to_spawn, //Number of particles left to spawn, use atomic operations!
-														 uint time
+														 PARTICLES_ARG, 
+														 __global const config_t * spawn_configs,
+														 __global const int * spawn_offsets,
+														 int num_spawns,
+														 __global const int * dead_indices,
+														 __global int * dead_count,
+														 uint seed,
+														 uint frame,
+														 __global const float * height_map,
+														 int2 height_map_size,
+														 float height_map_scale
 														 )
 {
-	uint id = get_global_id(0);
+	int index = get_global_id(0);
 
-	if (particles[id].dead == 1 && to_spawn[0] > 0 && atomic_dec(&to_spawn[0]) > 0 ) {
-		vertices[id].position.xyz = config->spawn_position + random3(config->spawn_area.xyz, false);
+	/* Last request starting at or before this work item */
+	int first = 0, last = num_spawns - 1;
+	while(first < last) {
+		int mid = (first + last + 1) / 2;
+		if(spawn_offsets[mid] <= index) {
+			first = mid;
+		} else {
+			last = mid - 1;
+		}
+	}
+	__global const config_t * config = &spawn_configs[first];
+	PARTICLES_INIT(config->max_num_particles);
+
+	/*
+	 * A failed pop only happens when the stack is empty and is undone right
+	 * away, so a successful pop never sees a count lowered by a failed one.
+	 */
+	int slot = atomic_dec(dead_count) - 1;
+	if(slot < 0) {
+		atomic_inc(dead_count);
+		return;
+	}
+
+	uint id = dead_indices[slot];
+	rng_t rng = random_init(id, frame, seed, RANDOM_STREAM_SPAWN);
+
+	PARTICLE(id, position).xyz = config->spawn_position + random3(config->spawn_area.xyz, false);
 
-		//Save colors to allow changing config during runtime
-		particles[id].birth_color = config->birth_color;
-		particles[id].death_color = config->death_color;
+	//Save colors to allow changing config during runtime
+	PARTICLE(id, birth_color) = config->birth_color;
+	PARTICLE(id, death_color) = config->death_color;
 
-		float a = random1(2*M_PI, false);
-		float a2 = random1(2*M_PI, false);
-		float len = random1(config->spawn_area.w,false);
-		vertices[id].position.x += len * cos(a);
-		vertices[id].position.y += len * sin(a);
-		vertices[id].position.z += len * sin(a) * cos(a2);
+	float a = random1(2*M_PI, false);
+	float a2 = random1(2*M_PI, false);
+	float len = random1(config->spawn_area.w,false);
+	PARTICLE(id, position).x += len * cos(a);
+	PARTICLE(id, position).y += len * sin(a);
+	PARTICLE(id, position).z += len * sin(a) * cos(a2);
 
-		vertices[id].position.w = 0.f;
-		vertices[id].texture_index = config->start_texture + (int)floor(random1((float)(config->num_textures-0.1), false));
+	PARTICLE(id, position).w = 0.f;
+	PARTICLE(id, emitter) = config->emitter;
+	PARTICLE(id, texture_index) = config->start_texture + (int)floor(random1((float)(config->num_textures-0.1), false));
 
-		particles[id].wind_influence = config->avg_wind_influence + random1(config->wind_influence_var, true);
-		particles[id].gravity_influence = config->avg_gravity_influence + random1(config->gravity_influence_var, true);
+	PARTICLE(id, wind_influence) = config->avg_wind_influence + random1(config->wind_influence_var, true);
+	PARTICLE(id, gravity_influence) = config->avg_gravity_influence + random1(config->gravity_influence_var, true);
 
-		particles[id].velocity = normalize(config->avg_spawn_velocity + random3(config->spawn_velocity_var, true));
-		particles[id].org_ttl = particles[id].ttl = config->avg_ttl + random1(config->ttl_var, true);
-		particles[id].rotation_speed = config->avg_rotation_speed + random1(config->rotation_speed_var, true);
-		particles[id].initial_scale = config->avg_scale + random1(config->scale_var, true);
-		particles[id].final_scale = particles[id].initial_scale + config->avg_scale_change + random1(config->scale_change_var, true);
-		particles[id].dead = 0;
+	PARTICLE(id, velocity) = normalize(config->avg_spawn_velocity + random3(config->spawn_velocity_var, true));
+	PARTICLE(id, org_ttl) = PARTICLE(id, ttl) = config->avg_ttl + random1(config->ttl_var, true);
+	PARTICLE(id, rotation_speed) = config->avg_rotation_speed + random1(config->rotation_speed_var, true);
+	PARTICLE(id, initial_scale) = config->avg_scale + random1(config->scale_var, true);
+	PARTICLE(id, final_scale) = PARTICLE(id, initial_scale) + config->avg_scale_change + random1(config->scale_change_var, true);
+
+	//Move particles spawned below ground up, if there is no room above it run_particles kills it at once
+	float ground = terrain_height(height_map, height_map_size, height_map_scale, PARTICLE(id, position).xz);
+	if(PARTICLE(id, position).y <= ground) {
+		float top = config->spawn_position.y + config->spawn_area.y;
+		if(ground < top) {
+			PARTICLE(id, position).y = ground + random1(top - ground, false);
+		} else {
+			PARTICLE(id, ttl) = 0.f;
+		}
 	}
+	PARTICLE(id, dead) = 0;
 }
-
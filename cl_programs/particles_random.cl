@@ -1,34 +1,60 @@
-float random(uint *time, const uint id, __global const float * const rnd, const int max_num_particles) {
-	float r = rnd[(int)((*time)+id) % max_num_particles];
-	//Change time to not get same value next call:
-	*time += (uint)floor(rnd[*time%max_num_particles]*1000.0);
-	return r;
+/*
+ * Philox4x32-10 counter based random numbers (Salmon et al., "Parallel random
+ * numbers: as easy as 1, 2, 3"). Stateless, each call hashes a counter with a key,
+ * so every particle gets its own stream from (id, frame) with no table in memory.
+ * Must match util_philox4x32 in src/utils.cpp.
+ */
+
+#define RANDOM_STREAM_SPAWN 0
+#define RANDOM_STREAM_RUN 1
+
+typedef struct rng_t {
+	uint4 counter; //particle id, frame, call, stream
+	uint2 key;     //per system seed
+} rng_t;
+
+uint4 philox4x32(uint4 counter, uint2 key) {
+	for(int round = 0; round < 10; ++round) {
+		uint hi0 = mul_hi(0xD2511F53u, counter.x);
+		uint lo0 = 0xD2511F53u * counter.x;
+		uint hi1 = mul_hi(0xCD9E8D57u, counter.z);
+		uint lo1 = 0xCD9E8D57u * counter.z;
+		counter = (uint4)(hi1 ^ counter.y ^ key.x, lo1, hi0 ^ counter.w ^ key.y, lo0);
+		key += (uint2)(0x9E3779B9u, 0xBB67AE85u);
+	}
+	return counter;
 }
 
-//Set dual to true to get a number in range -m..m (otherwise 0..m)
-float _random1(const float m, const bool dual, uint *time, const uint id, __global const float * const rnd, const int max_num_particles) {
-	return random(time, id, rnd, max_num_particles)*m*(1+dual) - m*dual;
+rng_t random_init(const uint id, const uint frame, const uint seed, const uint stream) {
+	rng_t rng;
+	rng.counter = (uint4)(id, frame, 0, stream);
+	rng.key = (uint2)(seed, 0x2545F491u);
+	return rng;
 }
 
-float4 _random4(const float4 m, const bool dual, uint *time, const uint id, __global const float * const rnd, const int max_num_particles) {
-	return (float4) (
-								 _random1(m.x, dual, time, id, rnd, max_num_particles),
-								 _random1(m.y, dual, time, id, rnd, max_num_particles),
-								 _random1(m.z, dual, time, id, rnd, max_num_particles),
-								 _random1(m.w, dual, time, id, rnd, max_num_particles)
-								 );
+//Four numbers in 0..1
+float4 random_next(rng_t * rng) {
+	uint4 r = philox4x32(rng->counter, rng->key);
+	rng->counter.z++;
+	return convert_float4(r >> 8) * (1.0f / 16777216.0f);
 }
 
-float3 _random3(const float3 m, const bool dual, uint *time, const int id, __global const float * const rnd, const int max_num_particles) {
-	return (float3) (
-								 _random1(m.x, dual, time, id, rnd, max_num_particles),
-								 _random1(m.y, dual, time, id, rnd, max_num_particles),
-								 _random1(m.z, dual, time, id, rnd, max_num_particles)
-								 );
+//Set dual to true to get a number in range -m..m (otherwise 0..m)
+float _random1(const float m, const bool dual, rng_t * rng) {
+	float r = random_next(rng).x;
+	return dual ? (2.0f*r - 1.0f)*m : r*m;
 }
 
-#define random1(m, dual) _random1((m), (dual), &time, id, rnd, config->max_num_particles)
-#define random3(m, dual) _random3((m), (dual), &time, id, rnd, config->max_num_particles)
-#define random4(m, dual) _random4((m), (dual), &time, id, rnd, config->max_num_particles)
+float3 _random3(const float3 m, const bool dual, rng_t * rng) {
+	float3 r = random_next(rng).xyz;
+	return dual ? (2.0f*r - 1.0f)*m : r*m;
+}
 
+float4 _random4(const float4 m, const bool dual, rng_t * rng) {
+	float4 r = random_next(rng);
+	return dual ? (2.0f*r - 1.0f)*m : r*m;
+}
 
+#define random1(m, dual) _random1((m), (dual), &rng)
+#define random3(m, dual) _random3((m), (dual), &rng)
+#define random4(m, dual) _random4((m), (dual), &rng)
@@ -3,6 +3,7 @@
 #endif
 
 typedef struct particle_t {
+	float4 position; //w is rotation
 	float3 velocity;
 	
 	float ttl;
@@ -17,8 +18,76 @@ typedef struct particle_t {
 
 	float4 birth_color;
 	float4 death_color;
+
+	int texture_index;
+	int emitter; //index in the config array given to run_particles
 } particle_t __attribute__ ((aligned (16))) ;
 
+/*
+ * Simulation state access. Kernels take PARTICLES_ARG, call PARTICLES_INIT
+ * and access fields with PARTICLE(id, field).
+ *
+ * With PARTICLES_SOA defined (-DPARTICLES_SOA) each field is instead an array
+ * of max_num_particles elements, stored one after the other in a single buffer
+ * in the order below, so a kernel only reads the fields it uses.
+ * Must match PARTICLE_SOA_BYTES and PARTICLE_SOA_DEAD_OFFSET in src/particle_system.cpp.
+ */
+#ifdef PARTICLES_SOA
+
+typedef struct particles_t {
+	__global float4 * position;
+	__global float3 * velocity;
+	__global float4 * birth_color;
+	__global float4 * death_color;
+
+	__global float * ttl;
+	__global float * org_ttl;
+	__global float * rotation_speed;
+	__global float * initial_scale;
+	__global float * final_scale;
+	__global float * wind_influence;
+	__global float * gravity_influence;
+
+	__global int * dead;
+	__global int * texture_index;
+	__global int * emitter;
+} particles_t;
+
+particles_t particles_soa(__global float4 * data, const int n) {
+	particles_t p;
+	p.position = data;
+	p.velocity = (__global float3 *)(data + n);
+	p.birth_color = data + 2*n;
+	p.death_color = data + 3*n;
+
+	__global float * f = (__global float *)(data + 4*n);
+	p.ttl = f;
+	p.org_ttl = f + n;
+	p.rotation_speed = f + 2*n;
+	p.initial_scale = f + 3*n;
+	p.final_scale = f + 4*n;
+	p.wind_influence = f + 5*n;
+	p.gravity_influence = f + 6*n;
+
+	__global int * i = (__global int *)(f + 7*n);
+	p.dead = i;
+	p.texture_index = i + n;
+	p.emitter = i + 2*n;
+	return p;
+}
+
+#define PARTICLES_ARG __global float4 * particle_data
+#define PARTICLES_INIT(n) particles_t particles = particles_soa(particle_data, (n))
+#define PARTICLE(id, field) (particles.field[id])
+
+#else
+
+#define PARTICLES_ARG __global particle_t * particles
+#define PARTICLES_INIT(n)
+#define PARTICLE(id, field) (particles[id].field)
+
+#endif
+
 typedef struct vertex_t {
 	float4 position;
 	float4 color;
@@ -63,5 +132,6 @@ typedef struct config_t {
 	int start_texture;
 	int num_textures;
 	int max_num_particles;
+	int emitter;
 
 } config_t __attribute__ ((aligned (16))) ;
@@ -3,12 +3,11 @@
 
 #define USE_SHADOWMAPS 0
 
+/* Mesh::VERTEX_FORMAT_PACKED, see Shader::packed_vertex_t */
 layout (location = 0) in vec4 in_position;
 layout (location = 1) in vec2 in_texcoord;
-layout (location = 2) in vec4 in_normal;
-layout (location = 3) in vec4 in_tangent;
-layout (location = 4) in vec4 in_bitangent;
-layout (location = 5) in vec4 in_color;
+layout (location = 2) in vec2 in_normal;  /* octahedral */
+layout (location = 3) in vec3 in_tangent; /* octahedral xy, bitangent sign in z */
 
 out vec3 position;
 out vec3 normal;
@@ -20,14 +19,25 @@ out vec2 texcoord;
 out vec4 shadowmap_coord[maxNumberOfLights];
 #endif
 
+vec3 octahedral_decode(vec2 e) {
+	vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if(v.z < 0.0) {
+		v.xy = (1.0 - abs(e.yx)) * vec2(e.x >= 0.0 ? 1.0 : -1.0, e.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return normalize(v);
+}
+
 void main() {
 	vec4 w_pos = modelMatrix * in_position;
 	position = w_pos.xyz;
 	gl_Position = projectionViewMatrix *  w_pos;
 	texcoord = in_texcoord;
-	normal = (normalMatrix * in_normal).xyz;
-	tangent = (normalMatrix * in_tangent).xyz;
-	bitangent = (normalMatrix * in_bitangent).xyz;
+	vec3 n = octahedral_decode(in_normal);
+	vec3 t = octahedral_decode(in_tangent.xy);
+	vec3 b = cross(n, t) * (in_tangent.z < 0.0 ? -1.0 : 1.0);
+	normal = (normalMatrix * vec4(n, 1.0)).xyz;
+	tangent = (normalMatrix * vec4(t, 1.0)).xyz;
+	bitangent = (normalMatrix * vec4(b, 1.0)).xyz;
 #if USE_SHADOWMAPS
 	for(int i=0; i < Lgt.num_lights; ++i) {
 		shadowmap_coord[i] = Lgt.lights[i].matrix * w_pos;
@@ -0,0 +1 @@
+#include "terrain.frag"
@@ -0,0 +1,61 @@
+#version 330
+#include "uniforms.glsl"
+
+/* See TerrainCDLOD, must match CDLOD_MAX_LEVELS */
+#define CDLOD_MAX_LEVELS 11
+
+layout (location = 0) in vec2 in_grid; /* position in the patch, [0, 1] */
+layout (location = 1) in vec4 in_node; /* per instance: min x, min z, size, level */
+
+uniform vec2 cdlod_morph[CDLOD_MAX_LEVELS]; /* morph start and end distance for each level */
+uniform vec3 cdlod_camera; /* in terrain space */
+uniform float cdlod_grid_size;
+uniform vec2 cdlod_map_size;
+uniform float cdlod_horizontal_scale;
+uniform float cdlod_uv_scale;
+
+out vec3 position;
+out vec3 normal;
+out vec3 tangent;
+out vec3 bitangent;
+out vec2 texcoord;
+
+/* Height map in texture5, p in terrain space */
+float height(vec2 p) {
+	vec2 uv = (p / cdlod_horizontal_scale + 0.5) / cdlod_map_size;
+	return textureLod(texture5, uv, 0.0).r;
+}
+
+void main() {
+	vec2 p = in_node.xy + in_grid * in_node.z;
+
+	vec2 morph_range = cdlod_morph[int(in_node.w)];
+	float dist = distance(cdlod_camera, vec3(p.x, height(p), p.y));
+	float morph = clamp((dist - morph_range.x) / (morph_range.y - morph_range.x), 0.0, 1.0);
+
+	/* Move the odd vertices onto the grid of the next coarser level */
+	vec2 odd = fract(in_grid * cdlod_grid_size * 0.5) * 2.0 / cdlod_grid_size;
+	p -= odd * in_node.z * morph;
+
+	/* Patches on the edge reach outside the map */
+	p = min(p, (cdlod_map_size - 1.0) * cdlod_horizontal_scale);
+
+	float step = cdlod_horizontal_scale;
+	float hx = height(p + vec2(step, 0.0)) - height(p - vec2(step, 0.0));
+	float hz = height(p + vec2(0.0, step)) - height(p - vec2(0.0, step));
+	vec3 n = normalize(vec3(-hx, 2.0 * step, -hz));
+	vec3 t = normalize(vec3(2.0 * step, hx, 0.0));
+	vec3 b = cross(n, t);
+
+	vec4 w_pos = modelMatrix * vec4(p.x, height(p), p.y, 1.0);
+	position = w_pos.xyz;
+	gl_Position = projectionViewMatrix * w_pos;
+
+	/* Same as CALC_UV in terrain.cpp */
+	vec2 sample_pos = p / step;
+	texcoord = vec2(sample_pos.x / cdlod_map_size.x, 1.0 - sample_pos.y / cdlod_map_size.y) * cdlod_uv_scale;
+
+	normal = (normalMatrix * vec4(n, 1.0)).xyz;
+	tangent = (normalMatrix * vec4(t, 1.0)).xyz;
+	bitangent = (normalMatrix * vec4(b, 1.0)).xyz;
+}
@@ -4,6 +4,7 @@
 
 #include <iostream>
 #include "shader.hpp"
+#include "gl_state.hpp"
 
 #include "GLDebugDrawer.hpp"
 
@@ -18,7 +19,8 @@ GLDebugDrawer::GLDebugDrawer() : m_debugMode(0), numVerts(0)
 
 GLDebugDrawer::~GLDebugDrawer()
 {
-	glDeleteVertexArrays(1, &vao);
+	GLState::delete_vertex_arrays(1, &vao);
+	GLState::delete_buffers(1, &vbo);
 }
 
 
@@ -26,16 +28,20 @@ void GLDebugDrawer::initDrawLine()
 {
 	// create and bind vao
 	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
+	GLState::bind_vertex_array(vao);
 	
 	// create and bind vbo
 	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	GLState::bind_buffer(GL_ARRAY_BUFFER, vbo);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_DYNAMIC_DRAW);
 		
 	glEnableVertexAttribArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(0, VERT_SIZE, GL_FLOAT, GL_FALSE, ITEM_STRIDE, 0);
+	glVertexAttribPointer(1, CLR_SIZE, GL_FLOAT, GL_FALSE, ITEM_STRIDE, (void*)VERT_STRIDE);
+
+	GLState::bind_buffer(GL_ARRAY_BUFFER, 0);
+	GLState::bind_vertex_array(0);
 }
 
 
@@ -108,19 +114,12 @@ void GLDebugDrawer::commit()
 	shader_->bind();
 	Shader::upload_model_matrix(glm::mat4());
 	
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	GLState::bind_buffer(GL_ARRAY_BUFFER, vbo);
 	glBufferSubData(GL_ARRAY_BUFFER, 0, ITEM_STRIDE*numVerts, verts);
 	
-	Shader::push_vertex_attribs(2);
-	
-	glVertexAttribPointer(0, VERT_SIZE, GL_FLOAT, GL_FALSE, ITEM_STRIDE, 0);
-	glVertexAttribPointer(1, CLR_SIZE, GL_FLOAT, GL_FALSE, ITEM_STRIDE, (void*)VERT_STRIDE);
-	
-	glBindVertexArray(vao);
+	GLState::bind_vertex_array(vao);
 	glDrawArrays(GL_LINES, 0, numVerts);
-	glBindVertexArray(0);
+	GLState::bind_vertex_array(0);
 	
 	numVerts = 0;
-	
-	Shader::pop_vertex_attribs();
 }
\ No newline at end of file
@@ -6,6 +6,14 @@
 
 #include <iostream>
 
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+	#define PERLIN_SIMD 1
+	#include <immintrin.h>
+	#define PERLIN_TARGET(isa) __attribute__((target(isa)))
+#else
+	#define PERLIN_SIMD 0
+#endif
+
 
 const char PerlinNoise::m_grad3[32][3] = {
 	// 2*12 edges
@@ -64,6 +72,15 @@ PerlinNoise::PerlinNoise(const char * seed) : m_seed(seed)
 		m_ps[i] = m_ps[i+256] = m_ps[j];
 		m_ps[j] = m_ps[j+256] = k;
 	}
+
+	for (int i=0; i<512; ++i)
+		m_perm[i] = m_ps[i];
+
+	for (int i=0; i<32; ++i)
+	{
+		m_grad2[0][i] = m_grad3[i][0];
+		m_grad2[1][i] = m_grad3[i][1];
+	}
 }
 
 
@@ -191,8 +208,9 @@ double PerlinNoise::ridgedMultifractalNoise(double x, double y, double H, double
 		weight = 1.0;
 	
 	// compute spectral weights
-	// TODO: exponent_array can/should be cached
-	double * exponent_array = new double[(int) octaves+1];
+	// use ridged_params and ridgedMultifractalNoise_row when evaluating many samples
+	double exponent_array[PERLIN_MAX_OCTAVES + 1];
+	octaves = std::min(octaves, (double) PERLIN_MAX_OCTAVES);
 	for (int i=0; i<=octaves; ++i)
 	{
 		// compute weight for each frequency
@@ -218,8 +236,364 @@ double PerlinNoise::ridgedMultifractalNoise(double x, double y, double H, double
 		signal *= weight;
 		result += signal * exponent_array[i];
 	}
-	
-	delete[] exponent_array;
 
 	return result;
 }
+
+
+/*
+ * Batch evaluation
+ *
+ * The kernels below are the float versions of noise(x, y) and
+ * ridgedMultifractalNoise. A row has a constant y, so all y dependent terms
+ * (row_t) are computed once and only x is vectorized.
+ */
+
+PerlinNoise::row_t PerlinNoise::row(float y) const
+{
+	const float fl = std::floor(y);
+	const int iy = static_cast<int>(fl) & 255;
+	row_t r;
+	r.p0 = m_ps[iy];
+	r.p1 = m_ps[iy+1];
+	r.yf = y - fl;
+	r.fy = r.yf*r.yf*(3.f-2.f*r.yf);
+	return r;
+}
+
+namespace {
+	struct tables_t {
+		const int * perm;
+		const float * gx;
+		const float * gy;
+	};
+
+	struct row_consts_t {
+		int p0, p1;
+		float yf, fy;
+	};
+
+	inline float noise_scalar(const tables_t &t, const row_consts_t &r, float x)
+	{
+		const float fl = std::floor(x);
+		const int ix = static_cast<int>(fl) & 255;
+		const float xf = x - fl;
+
+		const int gi00 = t.perm[ix   + r.p0] & 31;
+		const int gi10 = t.perm[ix+1 + r.p0] & 31;
+		const int gi01 = t.perm[ix   + r.p1] & 31;
+		const int gi11 = t.perm[ix+1 + r.p1] & 31;
+
+		const float n00 = t.gx[gi00]*xf       + t.gy[gi00]*r.yf;
+		const float n10 = t.gx[gi10]*(xf-1.f) + t.gy[gi10]*r.yf;
+		const float n01 = t.gx[gi01]*xf       + t.gy[gi01]*(r.yf-1.f);
+		const float n11 = t.gx[gi11]*(xf-1.f) + t.gy[gi11]*(r.yf-1.f);
+
+		const float fx = xf*xf*(3.f-2.f*xf);
+		const float nx0 = n00 + fx*(n10-n00);
+		const float nx1 = n01 + fx*(n11-n01);
+		return nx0 + r.fy*(nx1-nx0);
+	}
+
+	inline float signal_scalar(float n, float offset)
+	{
+		const float s = offset - std::abs(n);
+		return s*s;
+	}
+
+	/*
+	 * Ridged multifractal noise for the samples [begin, end) of a row,
+	 * rows[i] holds the row constants for octave i.
+	 */
+	void ridged_scalar(const tables_t &t, const row_consts_t * rows, const PerlinNoise::ridged_params_t &p, float x0, float dx, int begin, int end, float * out)
+	{
+		for (int i=begin; i<end; ++i)
+		{
+			float x = x0 + static_cast<float>(i)*dx;
+			float signal = signal_scalar(noise_scalar(t, rows[0], x), p.offset);
+			float result = signal;
+			for (int o=1; o<p.octaves; ++o)
+			{
+				x *= p.lacunarity;
+				const float weight = std::max(0.f, std::min(1.f, signal * p.gain));
+				signal = signal_scalar(noise_scalar(t, rows[o], x), p.offset) * weight;
+				result += signal * p.weights[o];
+			}
+			out[i] = result;
+		}
+	}
+
+	void noise_row_scalar(const tables_t &t, const row_consts_t &r, float x0, float dx, int begin, int end, float * out)
+	{
+		for (int i=begin; i<end; ++i)
+			out[i] = noise_scalar(t, r, x0 + static_cast<float>(i)*dx);
+	}
+
+#if PERLIN_SIMD
+	/* SSE4.1, 4 samples at a time. There is no gather so the table lookups are scalar */
+
+	PERLIN_TARGET("sse4.1") inline __m128 noise_sse(const tables_t &t, const row_consts_t &r, __m128 x)
+	{
+		const __m128 fl = _mm_floor_ps(x);
+		const __m128 xf = _mm_sub_ps(x, fl);
+		const __m128i ix = _mm_and_si128(_mm_cvttps_epi32(fl), _mm_set1_epi32(255));
+
+		int __attribute__((aligned(16))) idx[4];
+		_mm_store_si128((__m128i*) idx, ix);
+
+		float __attribute__((aligned(16))) g[8][4];
+		for (int l=0; l<4; ++l)
+		{
+			const int gi00 = t.perm[idx[l]   + r.p0] & 31;
+			const int gi10 = t.perm[idx[l]+1 + r.p0] & 31;
+			const int gi01 = t.perm[idx[l]   + r.p1] & 31;
+			const int gi11 = t.perm[idx[l]+1 + r.p1] & 31;
+			g[0][l] = t.gx[gi00]; g[1][l] = t.gy[gi00];
+			g[2][l] = t.gx[gi10]; g[3][l] = t.gy[gi10];
+			g[4][l] = t.gx[gi01]; g[5][l] = t.gy[gi01];
+			g[6][l] = t.gx[gi11]; g[7][l] = t.gy[gi11];
+		}
+
+		const __m128 one = _mm_set1_ps(1.f);
+		const __m128 xf1 = _mm_sub_ps(xf, one);
+		const __m128 yf = _mm_set1_ps(r.yf);
+		const __m128 yf1 = _mm_set1_ps(r.yf - 1.f);
+
+		const __m128 n00 = _mm_add_ps(_mm_mul_ps(_mm_load_ps(g[0]), xf),  _mm_mul_ps(_mm_load_ps(g[1]), yf));
+		const __m128 n10 = _mm_add_ps(_mm_mul_ps(_mm_load_ps(g[2]), xf1), _mm_mul_ps(_mm_load_ps(g[3]), yf));
+		const __m128 n01 = _mm_add_ps(_mm_mul_ps(_mm_load_ps(g[4]), xf),  _mm_mul_ps(_mm_load_ps(g[5]), yf1));
+		const __m128 n11 = _mm_add_ps(_mm_mul_ps(_mm_load_ps(g[6]), xf1), _mm_mul_ps(_mm_load_ps(g[7]), yf1));
+
+		const __m128 fx = _mm_mul_ps(_mm_mul_ps(xf, xf), _mm_sub_ps(_mm_set1_ps(3.f), _mm_add_ps(xf, xf)));
+		const __m128 nx0 = _mm_add_ps(n00, _mm_mul_ps(fx, _mm_sub_ps(n10, n00)));
+		const __m128 nx1 = _mm_add_ps(n01, _mm_mul_ps(fx, _mm_sub_ps(n11, n01)));
+		return _mm_add_ps(nx0, _mm_mul_ps(_mm_set1_ps(r.fy), _mm_sub_ps(nx1, nx0)));
+	}
+
+	PERLIN_TARGET("sse4.1") inline __m128 signal_sse(__m128 n, __m128 offset)
+	{
+		const __m128 abs_n = _mm_andnot_ps(_mm_set1_ps(-0.f), n);
+		const __m128 s = _mm_sub_ps(offset, abs_n);
+		return _mm_mul_ps(s, s);
+	}
+
+	PERLIN_TARGET("sse4.1") int noise_row_sse(const tables_t &t, const row_consts_t &r, float x0, float dx, int n, float * out)
+	{
+		const __m128 lane = _mm_set_ps(3.f, 2.f, 1.f, 0.f);
+		const __m128 vdx = _mm_set1_ps(dx);
+		int i = 0;
+		for (; i+4 <= n; i+=4)
+		{
+			const __m128 x = _mm_add_ps(_mm_set1_ps(x0), _mm_mul_ps(_mm_add_ps(_mm_set1_ps(static_cast<float>(i)), lane), vdx));
+			_mm_storeu_ps(out + i, noise_sse(t, r, x));
+		}
+		return i;
+	}
+
+	PERLIN_TARGET("sse4.1") int ridged_sse(const tables_t &t, const row_consts_t * rows, const PerlinNoise::ridged_params_t &p, float x0, float dx, int n, float * out)
+	{
+		const __m128 lane = _mm_set_ps(3.f, 2.f, 1.f, 0.f);
+		const __m128 vdx = _mm_set1_ps(dx);
+		const __m128 lacunarity = _mm_set1_ps(p.lacunarity);
+		const __m128 offset = _mm_set1_ps(p.offset);
+		const __m128 gain = _mm_set1_ps(p.gain);
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.f);
+		int i = 0;
+		for (; i+4 <= n; i+=4)
+		{
+			__m128 x = _mm_add_ps(_mm_set1_ps(x0), _mm_mul_ps(_mm_add_ps(_mm_set1_ps(static_cast<float>(i)), lane), vdx));
+			__m128 signal = signal_sse(noise_sse(t, rows[0], x), offset);
+			__m128 result = signal;
+			for (int o=1; o<p.octaves; ++o)
+			{
+				x = _mm_mul_ps(x, lacunarity);
+				const __m128 weight = _mm_max_ps(zero, _mm_min_ps(one, _mm_mul_ps(signal, gain)));
+				signal = _mm_mul_ps(signal_sse(noise_sse(t, rows[o], x), offset), weight);
+				result = _mm_add_ps(result, _mm_mul_ps(signal, _mm_set1_ps(p.weights[o])));
+			}
+			_mm_storeu_ps(out + i, result);
+		}
+		return i;
+	}
+
+	/* AVX2, 8 samples at a time with gathered table lookups */
+
+	PERLIN_TARGET("avx2") inline __m256 noise_avx2(const tables_t &t, const row_consts_t &r, __m256 x)
+	{
+		const __m256 fl = _mm256_floor_ps(x);
+		const __m256 xf = _mm256_sub_ps(x, fl);
+		const __m256i ix = _mm256_and_si256(_mm256_cvttps_epi32(fl), _mm256_set1_epi32(255));
+		const __m256i ix1 = _mm256_add_epi32(ix, _mm256_set1_epi32(1));
+		const __m256i p0 = _mm256_set1_epi32(r.p0);
+		const __m256i p1 = _mm256_set1_epi32(r.p1);
+		const __m256i mask = _mm256_set1_epi32(31);
+
+		const __m256i gi00 = _mm256_and_si256(_mm256_i32gather_epi32(t.perm, _mm256_add_epi32(ix,  p0), 4), mask);
+		const __m256i gi10 = _mm256_and_si256(_mm256_i32gather_epi32(t.perm, _mm256_add_epi32(ix1, p0), 4), mask);
+		const __m256i gi01 = _mm256_and_si256(_mm256_i32gather_epi32(t.perm, _mm256_add_epi32(ix,  p1), 4), mask);
+		const __m256i gi11 = _mm256_and_si256(_mm256_i32gather_epi32(t.perm, _mm256_add_epi32(ix1, p1), 4), mask);
+
+		const __m256 xf1 = _mm256_sub_ps(xf, _mm256_set1_ps(1.f));
+		const __m256 yf = _mm256_set1_ps(r.yf);
+		const __m256 yf1 = _mm256_set1_ps(r.yf - 1.f);
+
+		const __m256 n00 = _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(t.gx, gi00, 4), xf),  _mm256_mul_ps(_mm256_i32gather_ps(t.gy, gi00, 4), yf));
+		const __m256 n10 = _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(t.gx, gi10, 4), xf1), _mm256_mul_ps(_mm256_i32gather_ps(t.gy, gi10, 4), yf));
+		const __m256 n01 = _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(t.gx, gi01, 4), xf),  _mm256_mul_ps(_mm256_i32gather_ps(t.gy, gi01, 4), yf1));
+		const __m256 n11 = _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(t.gx, gi11, 4), xf1), _mm256_mul_ps(_mm256_i32gather_ps(t.gy, gi11, 4), yf1));
+
+		const __m256 fx = _mm256_mul_ps(_mm256_mul_ps(xf, xf), _mm256_sub_ps(_mm256_set1_ps(3.f), _mm256_add_ps(xf, xf)));
+		const __m256 nx0 = _mm256_add_ps(n00, _mm256_mul_ps(fx, _mm256_sub_ps(n10, n00)));
+		const __m256 nx1 = _mm256_add_ps(n01, _mm256_mul_ps(fx, _mm256_sub_ps(n11, n01)));
+		return _mm256_add_ps(nx0, _mm256_mul_ps(_mm256_set1_ps(r.fy), _mm256_sub_ps(nx1, nx0)));
+	}
+
+	PERLIN_TARGET("avx2") inline __m256 signal_avx2(__m256 n, __m256 offset)
+	{
+		const __m256 abs_n = _mm256_andnot_ps(_mm256_set1_ps(-0.f), n);
+		const __m256 s = _mm256_sub_ps(offset, abs_n);
+		return _mm256_mul_ps(s, s);
+	}
+
+	PERLIN_TARGET("avx2") int noise_row_avx2(const tables_t &t, const row_consts_t &r, float x0, float dx, int n, float * out)
+	{
+		const __m256 lane = _mm256_set_ps(7.f, 6.f, 5.f, 4.f, 3.f, 2.f, 1.f, 0.f);
+		const __m256 vdx = _mm256_set1_ps(dx);
+		int i = 0;
+		for (; i+8 <= n; i+=8)
+		{
+			const __m256 x = _mm256_add_ps(_mm256_set1_ps(x0), _mm256_mul_ps(_mm256_add_ps(_mm256_set1_ps(static_cast<float>(i)), lane), vdx));
+			_mm256_storeu_ps(out + i, noise_avx2(t, r, x));
+		}
+		return i;
+	}
+
+	PERLIN_TARGET("avx2") int ridged_avx2(const tables_t &t, const row_consts_t * rows, const PerlinNoise::ridged_params_t &p, float x0, float dx, int n, float * out)
+	{
+		const __m256 lane = _mm256_set_ps(7.f, 6.f, 5.f, 4.f, 3.f, 2.f, 1.f, 0.f);
+		const __m256 vdx = _mm256_set1_ps(dx);
+		const __m256 lacunarity = _mm256_set1_ps(p.lacunarity);
+		const __m256 offset = _mm256_set1_ps(p.offset);
+		const __m256 gain = _mm256_set1_ps(p.gain);
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 one = _mm256_set1_ps(1.f);
+		int i = 0;
+		for (; i+8 <= n; i+=8)
+		{
+			__m256 x = _mm256_add_ps(_mm256_set1_ps(x0), _mm256_mul_ps(_mm256_add_ps(_mm256_set1_ps(static_cast<float>(i)), lane), vdx));
+			__m256 signal = signal_avx2(noise_avx2(t, rows[0], x), offset);
+			__m256 result = signal;
+			for (int o=1; o<p.octaves; ++o)
+			{
+				x = _mm256_mul_ps(x, lacunarity);
+				const __m256 weight = _mm256_max_ps(zero, _mm256_min_ps(one, _mm256_mul_ps(signal, gain)));
+				signal = _mm256_mul_ps(signal_avx2(noise_avx2(t, rows[o], x), offset), weight);
+				result = _mm256_add_ps(result, _mm256_mul_ps(signal, _mm256_set1_ps(p.weights[o])));
+			}
+			_mm256_storeu_ps(out + i, result);
+		}
+		return i;
+	}
+#endif
+
+	PerlinNoise::simd_t detect_simd()
+	{
+#if PERLIN_SIMD
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) return PerlinNoise::SIMD_AVX2;
+		if (__builtin_cpu_supports("sse4.1")) return PerlinNoise::SIMD_SSE41;
+#endif
+		return PerlinNoise::SIMD_NONE;
+	}
+
+	PerlinNoise::simd_t & simd_level()
+	{
+		static PerlinNoise::simd_t level = PerlinNoise::simd_support();
+		return level;
+	}
+}
+
+
+PerlinNoise::simd_t PerlinNoise::simd_support()
+{
+	static const simd_t support = detect_simd();
+	return support;
+}
+
+
+PerlinNoise::simd_t PerlinNoise::simd()
+{
+	return simd_level();
+}
+
+
+void PerlinNoise::set_simd(simd_t level)
+{
+	simd_level() = std::min(level, simd_support());
+}
+
+
+void PerlinNoise::noise2_row(float x0, float dx, float y, int n, float * out) const
+{
+	const tables_t t = { m_perm, m_grad2[0], m_grad2[1] };
+	const row_t yr = row(y);
+	const row_consts_t r = { yr.p0, yr.p1, yr.yf, yr.fy };
+
+	int done = 0;
+	switch (simd_level())
+	{
+#if PERLIN_SIMD
+	case SIMD_AVX2:  done = noise_row_avx2(t, r, x0, dx, n, out); break;
+	case SIMD_SSE41: done = noise_row_sse(t, r, x0, dx, n, out); break;
+#endif
+	default: break;
+	}
+
+	noise_row_scalar(t, r, x0, dx, done, n, out);
+}
+
+
+PerlinNoise::ridged_params_t PerlinNoise::ridged_params(double H, double lacunarity, double octaves, double offset, double gain)
+{
+	ridged_params_t p;
+	p.octaves = static_cast<int>(std::ceil(std::min(octaves, (double) PERLIN_MAX_OCTAVES)));
+	p.lacunarity = static_cast<float>(lacunarity);
+	p.offset = static_cast<float>(offset);
+	p.gain = static_cast<float>(gain);
+
+	double frequency = 1.0;
+	for (int i=0; i<=PERLIN_MAX_OCTAVES; ++i)
+	{
+		p.weights[i] = static_cast<float>(pow(frequency, -H));
+		frequency *= lacunarity;
+	}
+	return p;
+}
+
+
+void PerlinNoise::ridgedMultifractalNoise_row(const ridged_params_t &params, float x0, float dx, float y, int n, float * out) const
+{
+	const tables_t t = { m_perm, m_grad2[0], m_grad2[1] };
+
+	row_consts_t rows[PERLIN_MAX_OCTAVES];
+	for (int o=0; o<params.octaves; ++o)
+	{
+		const row_t yr = row(y);
+		const row_consts_t r = { yr.p0, yr.p1, yr.yf, yr.fy };
+		rows[o] = r;
+		y *= params.lacunarity;
+	}
+
+	int done = 0;
+	switch (simd_level())
+	{
+#if PERLIN_SIMD
+	case SIMD_AVX2:  done = ridged_avx2(t, rows, params, x0, dx, n, out); break;
+	case SIMD_SSE41: done = ridged_sse(t, rows, params, x0, dx, n, out); break;
+#endif
+	default: break;
+	}
+
+	ridged_scalar(t, rows, params, x0, dx, done, n, out);
+}
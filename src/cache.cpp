@@ -0,0 +1,170 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "cache.hpp"
+#include "logging.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#ifdef WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace Cache {
+
+	static std::string cache_dir;
+	static bool cache_dir_checked = false;
+
+	static bool make_dir(const std::string &dir) {
+#ifdef WIN32
+		return CreateDirectory(dir.c_str(), nullptr) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+		return mkdir(dir.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+	}
+
+	static std::string find_cache_dir() {
+#ifdef WIN32
+		const char * base = getenv("LOCALAPPDATA");
+		if(base == nullptr) return "";
+		std::string dir = std::string(base) + __PATH_SEPARATOR_ + PACKAGE_NAME;
+#else
+		std::string dir;
+		const char * xdg = getenv("XDG_CACHE_HOME");
+		if(xdg != nullptr && xdg[0] != 0) {
+			dir = xdg;
+		} else {
+			const char * home = getenv("HOME");
+			if(home == nullptr) return "";
+			dir = std::string(home) + "/.cache";
+			make_dir(dir);
+		}
+		dir += std::string("/") + PACKAGE_NAME;
+#endif
+
+		if(!make_dir(dir)) {
+			Logging::warning("[Cache] Can't create cache directory `%s': %s\n", dir.c_str(), strerror(errno));
+			return "";
+		}
+		Logging::verbose("[Cache] Using cache directory `%s'\n", dir.c_str());
+		return dir + __PATH_SEPARATOR_;
+	}
+
+	std::string path(const std::string &name) {
+		if(!cache_dir_checked) {
+			cache_dir = find_cache_dir();
+			cache_dir_checked = true;
+		}
+		if(cache_dir.empty()) return "";
+		return cache_dir + name;
+	}
+
+	mapping_t * map(const std::string &name) {
+		const std::string filename = path(name);
+		if(filename.empty()) return nullptr;
+
+#ifdef WIN32
+		HANDLE file = CreateFile(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if(file == INVALID_HANDLE_VALUE) return nullptr;
+
+		LARGE_INTEGER size;
+		if(!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+			CloseHandle(file);
+			return nullptr;
+		}
+
+		HANDLE file_mapping = CreateFileMapping(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		CloseHandle(file);
+		if(file_mapping == nullptr) return nullptr;
+
+		const void * data = MapViewOfFile(file_mapping, FILE_MAP_READ, 0, 0, 0);
+		if(data == nullptr) {
+			CloseHandle(file_mapping);
+			return nullptr;
+		}
+
+		mapping_t * mapping = new mapping_t();
+		mapping->data = data;
+		mapping->size = static_cast<size_t>(size.QuadPart);
+		mapping->handle = file_mapping;
+		return mapping;
+#else
+		const int fd = open(filename.c_str(), O_RDONLY);
+		if(fd == -1) return nullptr;
+
+		struct stat st;
+		if(fstat(fd, &st) != 0 || st.st_size == 0) {
+			close(fd);
+			return nullptr;
+		}
+
+		void * data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if(data == MAP_FAILED) {
+			Logging::warning("[Cache] Failed to map `%s': %s\n", filename.c_str(), strerror(errno));
+			return nullptr;
+		}
+
+		mapping_t * mapping = new mapping_t();
+		mapping->data = data;
+		mapping->size = static_cast<size_t>(st.st_size);
+		mapping->handle = nullptr;
+		return mapping;
+#endif
+	}
+
+	void unmap(mapping_t * mapping) {
+		if(mapping == nullptr) return;
+#ifdef WIN32
+		UnmapViewOfFile(mapping->data);
+		CloseHandle((HANDLE) mapping->handle);
+#else
+		munmap(const_cast<void*>(mapping->data), mapping->size);
+#endif
+		delete mapping;
+	}
+
+	FILE * begin_write(const std::string &name) {
+		const std::string filename = path(name);
+		if(filename.empty()) return nullptr;
+
+		FILE * file = fopen((filename + ".tmp").c_str(), "wb");
+		if(file == nullptr) {
+			Logging::warning("[Cache] Can't write `%s': %s\n", filename.c_str(), strerror(errno));
+		}
+		return file;
+	}
+
+	bool end_write(const std::string &name, FILE * file) {
+		const std::string filename = path(name);
+		const std::string tmp = filename + ".tmp";
+
+		const bool failed = ferror(file) != 0;
+		if(fclose(file) != 0 || failed) {
+			Logging::warning("[Cache] Failed to write `%s'\n", filename.c_str());
+			remove(tmp.c_str());
+			return false;
+		}
+
+#ifdef WIN32
+		/* rename does not replace existing files on windows */
+		remove(filename.c_str());
+#endif
+		if(rename(tmp.c_str(), filename.c_str()) != 0) {
+			Logging::warning("[Cache] Failed to replace `%s': %s\n", filename.c_str(), strerror(errno));
+			remove(tmp.c_str());
+			return false;
+		}
+
+		return true;
+	}
+}
@@ -0,0 +1,54 @@
+#ifndef CACHE_HPP
+#define CACHE_HPP
+
+#include <cstdio>
+#include <string>
+
+/*
+ * On-disk cache for generated data that is expensive to recreate.
+ *
+ * Entries live in $XDG_CACHE_HOME/<package> (~/.cache/<package> as fallback,
+ * %LOCALAPPDATA%\<package> on windows). Nothing in the cache is required,
+ * every user must be able to regenerate its data when an entry is missing or
+ * stale, so all functions fail softly.
+ */
+namespace Cache {
+
+	/**
+	 * Full path for a cache entry.
+	 * The cache directory is created if needed.
+	 * @return "" if no cache directory is available.
+	 */
+	std::string path(const std::string &name);
+
+	/**
+	 * Read-only memory mapping of a cache entry.
+	 */
+	struct mapping_t {
+		const void * data;
+		size_t size;
+		void * handle; //Platform specific
+	};
+
+	/**
+	 * Map a cache entry into memory.
+	 * @return nullptr if the entry does not exist.
+	 */
+	mapping_t * map(const std::string &name);
+	void unmap(mapping_t * mapping);
+
+	/**
+	 * Start writing a cache entry. The data is written to a temporary file
+	 * which replaces the entry in end_write, so readers never see a partial entry.
+	 * @return nullptr if the entry can't be written.
+	 */
+	FILE * begin_write(const std::string &name);
+
+	/**
+	 * Close the file from begin_write and publish the entry.
+	 * @return false if any write failed, the entry is then discarded.
+	 */
+	bool end_write(const std::string &name, FILE * file);
+};
+
+#endif
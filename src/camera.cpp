@@ -3,6 +3,7 @@
 #endif
 
 #include "camera.hpp"
+#include "debug_mesh.hpp"
 #include "utils.hpp"
 #include "shader.hpp"
 #include "aabb.hpp"
@@ -112,37 +113,23 @@ void Camera::frustrum_corners(glm::vec3 * points, float near, float far, float f
 	points[7] = far_center +  x * lx + -y * ly;
 }
 
-void Camera::render_frustrum(GLuint buffer) const{
+void Camera::render_frustrum(DebugMesh &mesh) const{
 	static const unsigned int indices[] = {
 		0, 1, 2, 3, 0, 4, 5, 6, 7, 4, 5, 1, 2, 6, 7, 3
 	};
 	glm::vec3 corners[8];
 	frustrum_corners(corners);
 
-	struct corner_data_t {
-		glm::vec3 corner;
-		glm::vec4 color;
-	};
-
-	corner_data_t vertices[8];
+	DebugMesh::vertex_t vertices[8];
 	for(int i=0; i< 8; ++i) {
-		vertices[i].corner = corners[i];
+		vertices[i].pos = corners[i];
 		vertices[i].color = glm::vec4(0.f, 0.f, 0.f, 1.f);
 	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, buffer);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-
-	glBufferData(GL_ARRAY_BUFFER, sizeof(corner_data_t) * 8, vertices, GL_DYNAMIC_DRAW);
-
-	Shader::push_vertex_attribs(2);
-
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(corner_data_t), (const GLvoid*) offsetof(corner_data_t, corner));
-	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(corner_data_t), (const GLvoid*) offsetof(corner_data_t, color));
-
-	glDrawElements(GL_LINE_STRIP, 16, GL_UNSIGNED_INT, indices);
-
-	Shader::pop_vertex_attribs();
+	mesh.set_vertices(vertices, 8);
+	mesh.set_indices(indices, 16);
+	mesh.set_draw_mode(GL_LINE_STRIP);
+	mesh.render();
 }
 
 AABB Camera::aabb( float near, float far, float fov) const {
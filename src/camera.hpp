@@ -39,9 +39,9 @@ public:
 
 	/*
 	 * Debug function for rendering the view frustrum
-	 * Expects /shaders/simple to be bound
+	 * Replaces the vertices and indices of mesh and renders it
 	 */
-	void render_frustrum(GLuint buffer) const;
+	void render_frustrum(DebugMesh &mesh) const;
 
 private:
 	float fov_;
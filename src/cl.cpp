@@ -3,9 +3,11 @@
 #endif
 
 #include "cl.hpp"
+#include "cache.hpp"
 #include "data.hpp"
 #include "logging.hpp"
 #include "texture.hpp"
+#include "utils.hpp"
 
 #ifdef HAVE_GL_GLX_H
 #include <GL/glx.h>
@@ -26,13 +28,13 @@ static cl::Platform platform_;
 static cl::Context context_;
 static cl::CommandQueue queue_;
 static cl::Device context_device_;
+static bool available_ = false;
 
-void init(){
-	cl_int err;
-
+static bool select_platform() {
 	std::vector<cl::Platform> platforms;
-	if(cl::Platform::get(&platforms) == CL_INVALID_VALUE) {
-		Logging::fatal("[OpenCL] No platforms available\n");
+	if(cl::Platform::get(&platforms) != CL_SUCCESS || platforms.empty()) {
+		Logging::warning("[OpenCL] No platforms available\n");
+		return false;
 	}
 
 	platform_ = platforms[0]; //Just select the first platform
@@ -46,6 +48,33 @@ void init(){
 	Logging::verbose("[OpenCL]\n"
 	                 "  - Platform: %s %s\n"
 	                 "  - Extensions: %s\n", name.c_str(), version.c_str() ,extensions.c_str());
+	return true;
+}
+
+static bool create_queue(cl_command_queue_properties queue_properties) {
+	std::string name, version;
+	context_device_.getInfo(CL_DEVICE_VENDOR, &name);
+	context_device_.getInfo(CL_DEVICE_VERSION, &version);
+	Logging::verbose("[OpenCL] Context Device (%p): %s %s\n",(context_device_)(),  name.c_str(), version.c_str());
+
+	cl_int err;
+	queue_ = cl::CommandQueue(context_, context_device_, queue_properties, &err);
+
+	if(err != CL_SUCCESS) {
+		Logging::warning("[OpenCL] Failed to create a command queue: %s\n", errorString(err));
+		return false;
+	}
+
+	available_ = true;
+	return true;
+}
+
+bool init(){
+	cl_int err;
+
+	if(!select_platform()) return false;
+
+	std::string name, version, extensions;
 
 #if defined (__APPLE__) || defined(MACOSX)
 	CGLContextObj kCGLContext = CGLGetCurrentContext();
@@ -59,7 +88,8 @@ void init(){
 	HGLRC current_context = wglGetCurrentContext();
 	HDC current_dc = wglGetCurrentDC();
 	if(current_dc == NULL || current_context == NULL) {
-		Logging::fatal("[OpenCL] No OpenGL context active\n");
+		Logging::warning("[OpenCL] No OpenGL context active\n");
+		return false;
 	}
 
 	cl_context_properties properties[] = {
@@ -70,7 +100,8 @@ void init(){
 	};
 #else
 	if(glXGetCurrentContext() == NULL) {
-		Logging::fatal("[OpenCL] glXGetCurrentContex() return NULL. Make sure to create OpenGL context before create the CL-context\n");
+		Logging::warning("[OpenCL] glXGetCurrentContex() return NULL. Make sure to create OpenGL context before create the CL-context\n");
+		return false;
 	}
 	cl_context_properties properties[] =
 	{
@@ -89,6 +120,10 @@ void init(){
 	                                                    size_t *param_value_size_ret)=NULL;
 
 	clGetGLContextInfoKHR = (clGetGLContextInfoKHR_fn) clGetExtensionFunctionAddress("clGetGLContextInfoKHR");
+	if(clGetGLContextInfoKHR == NULL) {
+		Logging::warning("[OpenCL] clGetGLContextInfoKHR not available, interop not possible\n");
+		return false;
+	}
 
 	cl_device_id devices[32];
 	size_t deviceSize = 0;
@@ -98,8 +133,9 @@ void init(){
 	                            devices,
 	                            &deviceSize);
 
-	if(deviceSize == 0) {
-		Logging::fatal("[OpenCL] Interop not possible\n");
+	if(err != CL_SUCCESS || deviceSize == 0) {
+		Logging::warning("[OpenCL] Interop not possible\n");
+		return false;
 	}
 
 	cl_bool image_support, available;
@@ -148,25 +184,49 @@ void init(){
 	context_ = cl::Context(devices_, properties, cl_error_callback, nullptr, &err);
 
 	if(err != CL_SUCCESS) {
-		Logging::fatal("[OpenCL] Failed to create context: %s\n", errorString(err));
+		Logging::warning("[OpenCL] Failed to create context: %s\n", errorString(err));
+		return false;
 	}
 
 	err = clGetGLContextInfoKHR(properties, CL_CURRENT_DEVICE_FOR_GL_CONTEXT_KHR, sizeof(device_id), &device_id, NULL);
 	if(err != CL_SUCCESS) {
-		Logging::fatal("[OpenCL] Failed to get current device for context: %s\n", errorString(err));
+		Logging::warning("[OpenCL] Failed to get current device for context: %s\n", errorString(err));
+		return false;
 	}
 
 	context_device_ = cl::Device(device_id);
 
-	context_device_.getInfo(CL_DEVICE_VENDOR, &name);
-	context_device_.getInfo(CL_DEVICE_VERSION, &version);
-	Logging::verbose("[OpenCL] Context Device (%p): %s %s\n",(context_device_)(),  name.c_str(), version.c_str());
+	return create_queue(0);
+}
+
+bool init_compute(cl_command_queue_properties queue_properties) {
+	if(!select_platform()) return false;
+
+	if(platform_.getDevices(CL_DEVICE_TYPE_DEFAULT, &devices_) != CL_SUCCESS || devices_.empty()) {
+		Logging::warning("[OpenCL] No devices available\n");
+		return false;
+	}
+
+	cl_context_properties properties[] = {
+		CL_CONTEXT_PLATFORM, (cl_context_properties)(platform_)(),
+		0
+	};
 
-	queue_ = cl::CommandQueue(context_, context_device_, 0, &err);
+	cl_int err;
+	context_ = cl::Context(devices_, properties, cl_error_callback, nullptr, &err);
 
 	if(err != CL_SUCCESS) {
-		Logging::fatal("[OpenCL] Failed to create a command queue: %s\n", errorString(err));
+		Logging::warning("[OpenCL] Failed to create context: %s\n", errorString(err));
+		return false;
 	}
+
+	context_device_ = devices_[0];
+
+	return create_queue(queue_properties);
+}
+
+bool available() {
+	return available_;
 }
 
 void cleanup(){
@@ -231,26 +291,117 @@ static std::string parse_file(
 	return parsed_content.str();
 }
 
-cl::Program create_program(const std::string &source_file){
-	auto it = cache.find(source_file);
+/*
+ * Compiled programs are cached on disk, keyed by everything that can change
+ * the binary: the preprocessed source, build options, platform, device and
+ * driver. The binary is only valid for context_device_.
+ */
+static std::string binary_cache_name(const std::string &src, const std::string &options) {
+	std::string platform_name, platform_version, device_name, driver_version;
+	platform_.getInfo(CL_PLATFORM_NAME, &platform_name);
+	platform_.getInfo(CL_PLATFORM_VERSION, &platform_version);
+	context_device_.getInfo(CL_DEVICE_NAME, &device_name);
+	context_device_.getInfo(CL_DRIVER_VERSION, &driver_version);
+
+	uint64_t key = util_hash(src);
+	key = util_hash(options, key);
+	key = util_hash(platform_name, key);
+	key = util_hash(platform_version, key);
+	key = util_hash(device_name, key);
+	key = util_hash(driver_version, key);
+
+	char name[64];
+	snprintf(name, sizeof(name), "cl-%016llx.bin", static_cast<unsigned long long>(key));
+	return std::string(name);
+}
+
+/*
+ * Create and build a program from a cached binary.
+ * @return false if there is no usable binary, the program must then be built from source.
+ */
+static bool load_binary(const std::string &name, const std::string &options, cl::Program &program) {
+	Cache::mapping_t * mapping = Cache::map(name);
+	if(mapping == nullptr) return false;
+
+	const std::vector<cl::Device> device(1, context_device_);
+	cl::Program::Binaries binaries(1, std::make_pair(mapping->data, mapping->size));
+	std::vector<cl_int> status(1, CL_SUCCESS);
+	cl_int err;
+
+	program = cl::Program(context_, device, binaries, &status, &err);
+	if(err == CL_SUCCESS && status[0] == CL_SUCCESS) {
+		err = program.build(device, options.c_str());
+	} else if(err == CL_SUCCESS) {
+		err = status[0];
+	}
+
+	Cache::unmap(mapping);
+
+	if(err != CL_SUCCESS) {
+		Logging::verbose("[OpenCL] Cached binary %s rejected (%s), building from source\n", name.c_str(), errorString(err));
+		return false;
+	}
+
+	return true;
+}
+
+static void write_binary(const std::string &name, const cl::Program &program) {
+	std::vector<cl::Device> devices;
+	if(program.getInfo(CL_PROGRAM_DEVICES, &devices) != CL_SUCCESS) return;
+
+	std::vector<size_t> sizes(devices.size());
+	if(clGetProgramInfo(program(), CL_PROGRAM_BINARY_SIZES, sizeof(size_t) * sizes.size(), sizes.data(), nullptr) != CL_SUCCESS) return;
+
+	std::vector<std::vector<unsigned char> > data(devices.size());
+	std::vector<unsigned char*> pointers(devices.size());
+	for(size_t i=0; i<devices.size(); ++i) {
+		data[i].resize(sizes[i]);
+		pointers[i] = data[i].data();
+	}
+	if(clGetProgramInfo(program(), CL_PROGRAM_BINARIES, sizeof(unsigned char*) * pointers.size(), pointers.data(), nullptr) != CL_SUCCESS) return;
+
+	for(size_t i=0; i<devices.size(); ++i) {
+		if(devices[i]() != context_device_() || data[i].empty()) continue;
+
+		FILE * file = Cache::begin_write(name);
+		if(file == nullptr) return;
+		fwrite(data[i].data(), 1, data[i].size(), file);
+		if(Cache::end_write(name, file)) {
+			Logging::verbose("[OpenCL] Wrote cached binary %s (%lu bytes)\n", name.c_str(), static_cast<unsigned long>(data[i].size()));
+		}
+		return;
+	}
+}
+
+cl::Program create_program(const std::string &source_file, const std::string &options){
+	const std::string key = source_file + " " + options;
+	auto it = cache.find(key);
 	if(it != cache.end()) {
 		return it->second;
 	}
 
-	Logging::verbose("Building CL program %s\n", source_file.c_str());
-
 	std::string src = parse_file(source_file, std::set<std::string>(), "");
 
+	const std::string binary_name = binary_cache_name(src, options);
+	cl::Program program;
+	if(load_binary(binary_name, options, program)) {
+		Logging::verbose("Loaded CL program %s %s from %s\n", source_file.c_str(), options.c_str(), binary_name.c_str());
+		cache[key] = program;
+		return program;
+	}
+
+	Logging::verbose("Building CL program %s %s\n", source_file.c_str(), options.c_str());
+
 	cl_int err;
 	cl::Program::Sources source(1, std::make_pair(src.c_str(), src.size()));
 
-	cl::Program program = cl::Program(context_, source, &err);
+	program = cl::Program(context_, source, &err);
 
 	if(err != CL_SUCCESS) {
 		Logging::fatal("[OpenCL] Program creation error: %s\n", errorString(err));
 	}
 
-	err = program.build(devices_);
+	err = program.build(devices_, options.c_str());
 
 
 	std::string build_log;
@@ -264,7 +415,9 @@ cl::Program create_program(const std::string &source_file){
 		Logging::fatal("[OpenCL] Failed to build program: %s\n", errorString(err));
 	}
 
-	cache[source_file] = program;
+	write_binary(binary_name, program);
+
+	cache[key] = program;
 
 	return program;
 }
@@ -9,10 +9,28 @@
 #include <GL/glew.h>
 
 namespace CL {
-	void init();
+	/*
+	 * Create a context shared with the current GL context.
+	 * Returns false (with a warning) if OpenCL or GL sharing is not available.
+	 */
+	bool init();
+
+	/*
+	 * Create a context on the default device without GL sharing, for tools
+	 * and benchmarks. GL buffers can not be used. Pass
+	 * CL_QUEUE_PROFILING_ENABLE to read kernel timestamps from events.
+	 */
+	bool init_compute(cl_command_queue_properties queue_properties = 0);
+
+	bool available();
 	void cleanup();
 
-	cl::Program create_program(const std::string &file_name);
+	/*
+	 * Programs are cached by file name and build options. Compiled binaries
+	 * are also kept in the on-disk Cache and reused on the next start when the
+	 * source, options, device and driver are unchanged.
+	 */
+	cl::Program create_program(const std::string &file_name, const std::string &options = "");
 	cl::Kernel load_kernel(const cl::Program &program, const char* kernel_name);
 
 	cl::Buffer create_buffer(cl_mem_flags flags, size_t size);
@@ -320,7 +320,7 @@ const ConfigEntry * ConfigEntry::find(const std::string &path, bool fail_on_not_
 }
 
 const ConfigEntry * Config::find(const std::string &path, bool fail_on_not_found) const {
-	return root->find(path, true);
+	return root->find(path, fail_on_not_found);
 }
 const ConfigEntry * Config::operator[](const std::string &path) const {
 	return find(path, true);
@@ -3,6 +3,7 @@
 #endif
 
 #include "debug_mesh.hpp"
+#include "gl_state.hpp"
 #include "shader.hpp"
 
 DebugMesh::DebugMesh(GLenum draw_mode) 
@@ -31,7 +32,7 @@ void DebugMesh::set_vertices(const std::vector<vertex_t> &vertices) {
 }
 
 void DebugMesh::set_vertices(const vertex_t * vertices, size_t count) {
-	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	GLState::bind_buffer(GL_ARRAY_BUFFER, buffer);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_t) * count, static_cast<const GLvoid*>( vertices ),GL_STATIC_DRAW);
 }
 
@@ -49,12 +50,26 @@ void DebugMesh::set_draw_mode(GLenum new_draw_mode) {
 }
 
 DebugMesh::~DebugMesh() {
-	glDeleteBuffers(1, &buffer);
+	GLState::delete_vertex_arrays(1, &vao);
+	GLState::delete_buffers(1, &buffer);
 }
 
 void DebugMesh::init() {
 	shader = Shader::create_shader("/shaders/simple");
+
+	/* Indices are drawn from client memory, so the vertex array has no index buffer */
+	glGenVertexArrays(1, &vao);
+	GLState::bind_vertex_array(vao);
 	glGenBuffers(1, &buffer);
+	GLState::bind_buffer(GL_ARRAY_BUFFER, buffer);
+
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex_t), (const GLvoid*) offsetof(vertex_t, pos));
+	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(vertex_t), (const GLvoid*) offsetof(vertex_t, color));
+
+	GLState::bind_vertex_array(0);
+	GLState::bind_buffer(GL_ARRAY_BUFFER, 0);
 }
 
 void DebugMesh::render(const glm::mat4& m) const {
@@ -62,19 +77,12 @@ void DebugMesh::render(const glm::mat4& m) const {
 
 	Shader::upload_model_matrix(m * matrix());
 
-	glBindBuffer(GL_ARRAY_BUFFER, buffer);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-
-	Shader::push_vertex_attribs(2);
-	glPushAttrib(GL_ENABLE_BIT);
-	glDisable(GL_CULL_FACE);
-
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex_t), (const GLvoid*) offsetof(vertex_t, pos));
-	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(vertex_t), (const GLvoid*) offsetof(vertex_t, color));
+	const GLState::saved_t saved = GLState::save();
+	GLState::disable(GL_CULL_FACE);
 
+	GLState::bind_vertex_array(vao);
 	glDrawElements(draw_mode, static_cast<GLsizei>(indices.size()), GL_UNSIGNED_INT, indices.data());
+	GLState::bind_vertex_array(0);
 
-	glPopAttrib();
-
-	Shader::pop_vertex_attribs();
+	GLState::restore(saved);
 }
@@ -30,7 +30,7 @@ class DebugMesh : public MovableObject {
 		virtual void render(const glm::mat4& m = glm::mat4()) const;
 	protected:
 		Shader * shader;
-		GLuint buffer;
+		GLuint vao, buffer;
 		GLenum draw_mode;
 		std::vector<unsigned int> indices;
 	private:
@@ -5,6 +5,7 @@
 #include "editor/editor.hpp"
 #include "camera.hpp"
 #include "engine.hpp"
+#include "gl_state.hpp"
 #include "globals.hpp"
 #include "render_object.hpp"
 #include "rendertarget.hpp"
@@ -324,6 +325,7 @@ extern "C" G_MODULE_EXPORT void drawingarea_key_event_cb(GtkWidget* widget, GdkE
 extern "C" G_MODULE_EXPORT gboolean drawingarea_draw_cb(GtkWidget* widget, gpointer data){
 	if ( !initialized ) return FALSE;
 	if (!gtk_widget_begin_gl (widget)) return FALSE;
+	GLState::invalidate(); /* GTK shares the context */
 
 	Editor::frames++;
 
@@ -347,10 +349,11 @@ extern "C" G_MODULE_EXPORT gboolean drawingarea_draw_cb(GtkWidget* widget, gpoin
 	const glm::ivec2 center = (resolution - frame->texture_size()) / 2;
 	Shader::upload_state(resolution);
 	Shader::upload_projection_view_matrices(projection, glm::mat4());
-	glViewport(0, 0, resolution.x, resolution.y);
+	GLState::viewport(0, 0, resolution.x, resolution.y);
 	frame->draw(shaders[SHADER_PASSTHRU], center);
 
 	gtk_widget_end_gl(widget, TRUE);
+	Shader::end_frame();
 	return TRUE;
 }
 
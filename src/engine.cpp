@@ -3,6 +3,7 @@
 #endif
 
 #include "engine.hpp"
+#include "gl_state.hpp"
 #include "globals.hpp"
 #include "logging.hpp"
 #include "shader.hpp"
@@ -12,19 +13,24 @@
 namespace Engine {
 
 	void setup_opengl(){
-		glEnable(GL_CULL_FACE);
-		glEnable(GL_DEPTH_TEST);
-		glEnable(GL_TEXTURE_2D);
-		glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
-		glEnable(GL_BLEND);
+		GLState::invalidate();
+		GLState::enable(GL_CULL_FACE);
+		GLState::enable(GL_DEPTH_TEST);
+		GLState::enable(GL_TEXTURE_2D);
+		GLState::enable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+		GLState::enable(GL_BLEND);
 		glCullFace(GL_BACK);
 		glDepthFunc(GL_LEQUAL);
 		glBlendFunc(GL_SRC_ALPHA,GL_ONE_MINUS_SRC_ALPHA);
 	}
 
 	void preload(const std::vector<std::string>& names, std::function<void(const std::string&, int, int)> progress){
+		const int total = static_cast<int>(names.size());
 		int index = 1;
 
+		/* Shaders are compiled together at the end */
+		std::vector<std::string> shaders;
+
 		for ( auto resource : names ){
 			const size_t delimiter = resource.find(':');
 			if ( delimiter == std::string::npos ){
@@ -35,15 +41,19 @@ namespace Engine {
 			const std::string prefix = resource.substr(0, delimiter);
 			const std::string filename = resource.substr(delimiter+1);
 
-			progress(filename, index++, static_cast<int>(names.size()));
-
 			if ( prefix == "texture" ){
+				if ( progress ) progress(filename, index++, total);
 				Texture2D::preload(filename);
 			} else if ( prefix == "shader" ){
-				Shader::create_shader(filename);
+				shaders.push_back(filename);
 			} else {
+				if ( progress ) progress(filename, index++, total);
 				Logging::warning("Resource `%s' has an unknown prefix, preloading ignored.\n", resource.c_str());
 			}
 		}
+
+		Shader::preload(shaders, [&index, total, &progress](const std::string& filename){
+			if ( progress ) progress(filename, index++, total);
+		});
 	}
 }
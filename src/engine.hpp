@@ -34,7 +34,9 @@ namespace Engine {
 	 * Preload resources.
 	 *
 	 * @param names List of resources with "type:" prefix, e.g. "texture:foo.jpg".
-	 * @param progress Optional callback run before loading a resource.
+	 * @param progress Optional callback run before loading a texture and
+	 *                 after each shader is ready, shaders are compiled together
+	 *                 after all textures.
 	 */
 	void preload(const std::vector<std::string>& names, std::function<void(const std::string&, int, int)> progress = nullptr);
 
@@ -5,6 +5,7 @@ class Camera;
 class Controller;
 class Color;
 class Data;
+class DebugMesh;
 struct Light;
 struct Line2D;
 class Material;
@@ -0,0 +1,87 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "frustum.hpp"
+
+#include <glm/glm.hpp>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+	#define FRUSTUM_SSE 1
+	#include <xmmintrin.h>
+#else
+	#define FRUSTUM_SSE 0
+#endif
+
+Frustum::Frustum(const glm::mat4 &m) {
+	/* Gribb & Hartmann, glm matrices are column major so m[c][r] */
+	for(int i=0; i<3; ++i) {
+		const glm::vec4 row(m[0][i], m[1][i], m[2][i], m[3][i]);
+		const glm::vec4 w(m[0][3], m[1][3], m[2][3], m[3][3]);
+		planes[2*i]     = w + row;
+		planes[2*i + 1] = w - row;
+	}
+
+	for(glm::vec4 &p : planes) {
+		p /= glm::length(glm::vec3(p));
+	}
+}
+
+void Frustum::box4_t::set(int index, const AABB &aabb) {
+	min_x[index] = aabb.min.x;
+	min_y[index] = aabb.min.y;
+	min_z[index] = aabb.min.z;
+	max_x[index] = aabb.max.x;
+	max_y[index] = aabb.max.y;
+	max_z[index] = aabb.max.z;
+}
+
+bool Frustum::intersects(const AABB &aabb) const {
+	for(const glm::vec4 &p : planes) {
+		/* The corner furthest along the plane normal */
+		const glm::vec3 corner(
+			p.x > 0.f ? aabb.max.x : aabb.min.x,
+			p.y > 0.f ? aabb.max.y : aabb.min.y,
+			p.z > 0.f ? aabb.max.z : aabb.min.z
+		);
+		if(glm::dot(glm::vec3(p), corner) + p.w < 0.f) return false;
+	}
+	return true;
+}
+
+unsigned int Frustum::intersects4(const box4_t &boxes) const {
+#if FRUSTUM_SSE
+	const __m128 min_x = _mm_loadu_ps(boxes.min_x);
+	const __m128 min_y = _mm_loadu_ps(boxes.min_y);
+	const __m128 min_z = _mm_loadu_ps(boxes.min_z);
+	const __m128 max_x = _mm_loadu_ps(boxes.max_x);
+	const __m128 max_y = _mm_loadu_ps(boxes.max_y);
+	const __m128 max_z = _mm_loadu_ps(boxes.max_z);
+	const __m128 zero = _mm_setzero_ps();
+
+	__m128 outside = zero;
+	for(const glm::vec4 &p : planes) {
+		/* The sign of the normal is the same for all boxes, so pick the corner per plane */
+		const __m128 x = p.x > 0.f ? max_x : min_x;
+		const __m128 y = p.y > 0.f ? max_y : min_y;
+		const __m128 z = p.z > 0.f ? max_z : min_z;
+
+		/* Same operation order as intersects, so both give the same result */
+		__m128 dist = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(p.x)), _mm_mul_ps(y, _mm_set1_ps(p.y)));
+		dist = _mm_add_ps(dist, _mm_mul_ps(z, _mm_set1_ps(p.z)));
+		dist = _mm_add_ps(dist, _mm_set1_ps(p.w));
+		outside = _mm_or_ps(outside, _mm_cmplt_ps(dist, zero));
+	}
+	return ~static_cast<unsigned int>(_mm_movemask_ps(outside)) & 0xF;
+#else
+	unsigned int mask = 0;
+	for(int i=0; i<4; ++i) {
+		const AABB aabb(
+			glm::vec3(boxes.min_x[i], boxes.min_y[i], boxes.min_z[i]),
+			glm::vec3(boxes.max_x[i], boxes.max_y[i], boxes.max_z[i])
+		);
+		if(intersects(aabb)) mask |= 1u << i;
+	}
+	return mask;
+#endif
+}
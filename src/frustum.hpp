@@ -0,0 +1,58 @@
+#ifndef FRUSTUM_HPP
+#define FRUSTUM_HPP
+
+#include <glm/glm.hpp>
+
+#include "aabb.hpp"
+
+/*
+ * View frustum as six planes, for culling boxes.
+ */
+struct Frustum {
+	enum {
+		PLANE_LEFT = 0,
+		PLANE_RIGHT,
+		PLANE_BOTTOM,
+		PLANE_TOP,
+		PLANE_NEAR,
+		PLANE_FAR,
+		NUM_PLANES
+	};
+
+	/*
+	 * Extract the planes from a (projection * view * model) matrix.
+	 * The planes will be in the space the matrix transforms from, so pass
+	 * the model matrix too to cull in object space.
+	 */
+	Frustum(const glm::mat4 &matrix);
+
+	/*
+	 * Planes as (normal, d), normal pointing into the frustum.
+	 * A point p is inside a plane if dot(normal, p) + d >= 0
+	 */
+	glm::vec4 planes[NUM_PLANES];
+
+	/*
+	 * Four boxes in structure of arrays layout, for intersects4
+	 */
+	struct box4_t {
+		float min_x[4], min_y[4], min_z[4];
+		float max_x[4], max_y[4], max_z[4];
+
+		void set(int index, const AABB &aabb);
+	};
+
+	/*
+	 * Returns false if the box is completely outside the frustum.
+	 * Boxes close to the corners may give false positives.
+	 */
+	bool intersects(const AABB &aabb) const;
+
+	/*
+	 * Same as intersects for four boxes at once (using SSE when available).
+	 * Returns a mask where bit i is set if box i intersects.
+	 */
+	unsigned int intersects4(const box4_t &boxes) const;
+};
+
+#endif
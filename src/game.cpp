@@ -83,6 +83,7 @@ Game::Game(const std::string &level, float near, float far, float fov)
 
 	particles = new ParticleSystem(config["/particles/count"]->as_int(), scene_aabb, particle_textures);
 	particles->read_config(config["/particles"]);
+	particles->set_terrain(terrain);
 
 	particle_spawn_far = glm::min(config["/particles/spawn_far"]->as_float(), far);
 	particle_keep_far = glm::min(config["/particles/keep_far"]->as_float(), far);
@@ -147,6 +148,8 @@ void Game::restart() {
 	particles->set_bounds(AABB());
 	particles->update_config();
 
+	/* Once for each vertex buffer */
+	particles->update(0.1f);
 	particles->update(0.1f);
 
 	setup();
@@ -0,0 +1,294 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gl_state.hpp"
+
+#include <cstring>
+
+#define MAX_TEXTURE_UNITS 32
+
+namespace GLState {
+
+	static const GLuint unknown = ~0u;
+
+	enum texture_target_t {
+		TARGET_2D = 0,
+		TARGET_2D_ARRAY,
+		TARGET_CUBE_MAP,
+		TARGET_3D,
+		NUM_TEXTURE_TARGETS
+	};
+
+	enum cap_t {
+		CAP_DEPTH_TEST = 0,
+		CAP_CULL_FACE,
+		CAP_BLEND,
+		NUM_CAPS
+	};
+
+	static const GLenum caps[NUM_CAPS] = { GL_DEPTH_TEST, GL_CULL_FACE, GL_BLEND };
+
+	static GLuint program_;
+	static GLuint vertex_array_;
+	static GLuint array_buffer_;
+	static GLuint uniform_buffer_;
+	static GLuint active_texture_;
+	static GLuint texture_[MAX_TEXTURE_UNITS][NUM_TEXTURE_TARGETS];
+	static GLuint framebuffer_;
+	static int cap_[NUM_CAPS]; /* -1 if unknown */
+	static int depth_mask_;    /* -1 if unknown */
+	static GLint viewport_[4];
+	static bool viewport_known_;
+
+	static counters_t counters_[NUM_COUNTERS];
+
+	/* Count a call, returns true if it can be skipped */
+	static bool redundant(counter_t counter, bool same) {
+		counters_[counter].calls++;
+		if ( same ) counters_[counter].redundant++;
+		return same;
+	}
+
+	static int texture_target(GLenum target) {
+		switch ( target ){
+		case GL_TEXTURE_2D: return TARGET_2D;
+		case GL_TEXTURE_2D_ARRAY: return TARGET_2D_ARRAY;
+		case GL_TEXTURE_CUBE_MAP: return TARGET_CUBE_MAP;
+		case GL_TEXTURE_3D: return TARGET_3D;
+		default: return -1;
+		}
+	}
+
+	static int cap_index(GLenum cap) {
+		for ( int i = 0; i < NUM_CAPS; ++i ){
+			if ( caps[i] == cap ) return i;
+		}
+		return -1;
+	}
+
+	static GLuint * buffer_binding(GLenum target) {
+		switch ( target ){
+		case GL_ARRAY_BUFFER: return &array_buffer_;
+		case GL_UNIFORM_BUFFER: return &uniform_buffer_;
+		default: return nullptr;
+		}
+	}
+
+	void use_program(GLuint program) {
+		if ( redundant(COUNTER_PROGRAM, program == program_) ) return;
+		glUseProgram(program);
+		program_ = program;
+	}
+
+	void bind_vertex_array(GLuint vao) {
+		if ( redundant(COUNTER_VERTEX_ARRAY, vao == vertex_array_) ) return;
+		glBindVertexArray(vao);
+		vertex_array_ = vao;
+	}
+
+	void bind_buffer(GLenum target, GLuint buffer) {
+		GLuint * binding = buffer_binding(target);
+		if ( redundant(COUNTER_BUFFER, binding && *binding == buffer) ) return;
+		glBindBuffer(target, buffer);
+		if ( binding ) *binding = buffer;
+	}
+
+	void bind_buffer_range(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+		glBindBufferRange(target, index, buffer, offset, size);
+		GLuint * binding = buffer_binding(target);
+		if ( binding ) *binding = buffer;
+	}
+
+	void active_texture(GLenum unit) {
+		if ( redundant(COUNTER_ACTIVE_TEXTURE, unit == active_texture_) ) return;
+		glActiveTexture(unit);
+		active_texture_ = unit;
+	}
+
+	void bind_texture(GLenum target, GLuint texture) {
+		const int t = texture_target(target);
+		const GLuint unit = active_texture_ - GL_TEXTURE0;
+		GLuint * binding = (t >= 0 && active_texture_ != unknown && unit < MAX_TEXTURE_UNITS) ? &texture_[unit][t] : nullptr;
+
+		if ( redundant(COUNTER_TEXTURE, binding && *binding == texture) ) return;
+		glBindTexture(target, texture);
+		if ( binding ) *binding = texture;
+	}
+
+	void bind_texture(GLenum unit, GLenum target, GLuint texture) {
+		active_texture(unit);
+		bind_texture(target, texture);
+	}
+
+	void bind_framebuffer(GLuint framebuffer) {
+		if ( redundant(COUNTER_FRAMEBUFFER, framebuffer == framebuffer_) ) return;
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		framebuffer_ = framebuffer;
+	}
+
+	static void set_cap(GLenum cap, bool value) {
+		const int i = cap_index(cap);
+		if ( redundant(COUNTER_CAPABILITY, i >= 0 && cap_[i] == static_cast<int>(value)) ) return;
+
+		if ( value ){
+			glEnable(cap);
+		} else {
+			glDisable(cap);
+		}
+		if ( i >= 0 ) cap_[i] = value;
+	}
+
+	void enable(GLenum cap) {
+		set_cap(cap, true);
+	}
+
+	void disable(GLenum cap) {
+		set_cap(cap, false);
+	}
+
+	void depth_mask(GLboolean flag) {
+		if ( redundant(COUNTER_DEPTH_MASK, depth_mask_ == static_cast<int>(flag)) ) return;
+		glDepthMask(flag);
+		depth_mask_ = flag;
+	}
+
+	void viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+		const GLint v[4] = { x, y, width, height };
+		if ( redundant(COUNTER_VIEWPORT, viewport_known_ && memcmp(v, viewport_, sizeof(v)) == 0) ) return;
+		glViewport(x, y, width, height);
+		memcpy(viewport_, v, sizeof(v));
+		viewport_known_ = true;
+	}
+
+	void delete_buffers(GLsizei n, const GLuint * buffers) {
+		for ( GLsizei i = 0; i < n; ++i ){
+			if ( array_buffer_ == buffers[i] ) array_buffer_ = unknown;
+			if ( uniform_buffer_ == buffers[i] ) uniform_buffer_ = unknown;
+		}
+		glDeleteBuffers(n, buffers);
+	}
+
+	void delete_textures(GLsizei n, const GLuint * textures) {
+		for ( GLsizei i = 0; i < n; ++i ){
+			for ( auto &unit : texture_ ){
+				for ( GLuint &binding : unit ){
+					if ( binding == textures[i] ) binding = unknown;
+				}
+			}
+		}
+		glDeleteTextures(n, textures);
+	}
+
+	void delete_framebuffers(GLsizei n, const GLuint * framebuffers) {
+		for ( GLsizei i = 0; i < n; ++i ){
+			if ( framebuffer_ == framebuffers[i] ) framebuffer_ = unknown;
+		}
+		glDeleteFramebuffers(n, framebuffers);
+	}
+
+	void delete_vertex_arrays(GLsizei n, const GLuint * vaos) {
+		for ( GLsizei i = 0; i < n; ++i ){
+			if ( vertex_array_ == vaos[i] ) vertex_array_ = unknown;
+		}
+		glDeleteVertexArrays(n, vaos);
+	}
+
+	saved_t save() {
+		/* Unknown state is read back, it is needed to restore */
+		for ( int i = 0; i < NUM_CAPS; ++i ){
+			if ( cap_[i] < 0 ) cap_[i] = glIsEnabled(caps[i]);
+		}
+		if ( depth_mask_ < 0 ){
+			GLboolean flag;
+			glGetBooleanv(GL_DEPTH_WRITEMASK, &flag);
+			depth_mask_ = flag;
+		}
+		const saved_viewport_t saved_viewport = save_viewport();
+
+		saved_t saved;
+		saved.depth_test = static_cast<GLboolean>(cap_[CAP_DEPTH_TEST]);
+		saved.cull_face = static_cast<GLboolean>(cap_[CAP_CULL_FACE]);
+		saved.blend = static_cast<GLboolean>(cap_[CAP_BLEND]);
+		saved.depth_mask = static_cast<GLboolean>(depth_mask_);
+		memcpy(saved.viewport, saved_viewport.viewport, sizeof(saved.viewport));
+		return saved;
+	}
+
+	void restore(const saved_t &saved) {
+		set_cap(GL_DEPTH_TEST, saved.depth_test);
+		set_cap(GL_CULL_FACE, saved.cull_face);
+		set_cap(GL_BLEND, saved.blend);
+		depth_mask(saved.depth_mask);
+		viewport(saved.viewport[0], saved.viewport[1], saved.viewport[2], saved.viewport[3]);
+	}
+
+	saved_viewport_t save_viewport() {
+		if ( !viewport_known_ ){
+			glGetIntegerv(GL_VIEWPORT, viewport_);
+			viewport_known_ = true;
+		}
+
+		saved_viewport_t saved;
+		memcpy(saved.viewport, viewport_, sizeof(viewport_));
+		return saved;
+	}
+
+	void restore_viewport(const saved_viewport_t &saved) {
+		viewport(saved.viewport[0], saved.viewport[1], saved.viewport[2], saved.viewport[3]);
+	}
+
+	void invalidate() {
+		program_ = unknown;
+		vertex_array_ = unknown;
+		array_buffer_ = unknown;
+		uniform_buffer_ = unknown;
+		active_texture_ = unknown;
+		for ( auto &unit : texture_ ){
+			for ( GLuint &binding : unit ){
+				binding = unknown;
+			}
+		}
+		framebuffer_ = unknown;
+		for ( int &cap : cap_ ){
+			cap = -1;
+		}
+		depth_mask_ = -1;
+		viewport_known_ = false;
+	}
+
+	const counters_t& counters(counter_t counter) {
+		return counters_[counter];
+	}
+
+	void reset_counters() {
+		memset(counters_, 0, sizeof(counters_));
+	}
+
+	void usage_report(FILE* dst) {
+		static const char* name[NUM_COUNTERS] = {
+			"program",
+			"vertex array",
+			"buffer",
+			"active texture",
+			"texture",
+			"framebuffer",
+			"enable/disable",
+			"depth mask",
+			"viewport",
+		};
+
+		fprintf(dst, "GL state changes\n"
+		             "================\n");
+
+		unsigned long calls = 0, skipped = 0;
+		for ( int i = 0; i < NUM_COUNTERS; ++i ){
+			const counters_t &c = counters_[i];
+			fprintf(dst, "%-16s %10lu calls %10lu redundant (%5.1f%%)\n", name[i], c.calls, c.redundant, c.calls ? 100.0 * static_cast<double>(c.redundant) / static_cast<double>(c.calls) : 0.0);
+			calls += c.calls;
+			skipped += c.redundant;
+		}
+
+		fprintf(dst, "%-16s %10lu calls %10lu redundant (%5.1f%%)\n", "total", calls, skipped, calls ? 100.0 * static_cast<double>(skipped) / static_cast<double>(calls) : 0.0);
+	}
+}
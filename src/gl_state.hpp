@@ -0,0 +1,112 @@
+#ifndef GL_STATE_HPP
+#define GL_STATE_HPP
+
+#include <GL/glew.h>
+#include <cstdio>
+
+/*
+ * Shadow copy of the GL state that is changed often while rendering, so
+ * redundant binds and enables are skipped without reaching the driver.
+ *
+ * Only works if all changes to the tracked state go through these functions.
+ * Tracked state:
+ *   - current program
+ *   - current vertex array
+ *   - GL_ARRAY_BUFFER and GL_UNIFORM_BUFFER bindings (other targets, like
+ *     GL_ELEMENT_ARRAY_BUFFER which is part of the VAO, are passed through)
+ *   - active texture unit and the texture bound to each target of each unit
+ *   - GL_FRAMEBUFFER binding
+ *   - enable caps, depth mask and viewport
+ *
+ * After invalidate() (called by Engine::setup_opengl) the state is unknown
+ * and the first call for each piece of state always reaches GL.
+ */
+namespace GLState {
+
+	enum counter_t {
+		COUNTER_PROGRAM = 0,
+		COUNTER_VERTEX_ARRAY,
+		COUNTER_BUFFER,
+		COUNTER_ACTIVE_TEXTURE,
+		COUNTER_TEXTURE,
+		COUNTER_FRAMEBUFFER,
+		COUNTER_CAPABILITY,
+		COUNTER_DEPTH_MASK,
+		COUNTER_VIEWPORT,
+		NUM_COUNTERS
+	};
+
+	struct counters_t {
+		unsigned long calls;     /* Calls to GLState */
+		unsigned long redundant; /* Calls that did not reach GL */
+	};
+
+	void use_program(GLuint program);
+
+	void bind_vertex_array(GLuint vao);
+
+	void bind_buffer(GLenum target, GLuint buffer);
+
+	/* Also binds the generic binding point of target, like glBindBufferRange */
+	void bind_buffer_range(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
+	void active_texture(GLenum unit);
+
+	/* Bind to the active unit */
+	void bind_texture(GLenum target, GLuint texture);
+
+	/* Same as active_texture followed by bind_texture */
+	void bind_texture(GLenum unit, GLenum target, GLuint texture);
+
+	void bind_framebuffer(GLuint framebuffer);
+
+	void enable(GLenum cap);
+	void disable(GLenum cap);
+
+	void depth_mask(GLboolean flag);
+
+	void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+	/*
+	 * Delete objects and forget them if they are bound, GL unbinds deleted
+	 * objects and the names may be reused.
+	 */
+	void delete_buffers(GLsizei n, const GLuint * buffers);
+	void delete_textures(GLsizei n, const GLuint * textures);
+	void delete_framebuffers(GLsizei n, const GLuint * framebuffers);
+	void delete_vertex_arrays(GLsizei n, const GLuint * vaos);
+
+	/*
+	 * Replacement for glPushAttrib(GL_ENABLE_BIT|GL_DEPTH_BUFFER_BIT|GL_VIEWPORT_BIT)
+	 * for the tracked state, which is deprecated and not in core profiles.
+	 */
+	struct saved_t {
+		GLboolean depth_test, cull_face, blend;
+		GLboolean depth_mask;
+		GLint viewport[4];
+	};
+
+	saved_t save();
+	void restore(const saved_t &saved);
+
+	/* Only the viewport, for callers that must not touch the rest */
+	struct saved_viewport_t {
+		GLint viewport[4];
+	};
+
+	saved_viewport_t save_viewport();
+	void restore_viewport(const saved_viewport_t &saved);
+
+	/* Forget all tracked state, call if GL state was changed behind our back */
+	void invalidate();
+
+	const counters_t& counters(counter_t counter);
+	void reset_counters();
+
+	/**
+	 * Write the number of calls and redundant calls of each kind to dst.
+	 */
+	void usage_report(FILE* dst = stderr);
+};
+
+#endif
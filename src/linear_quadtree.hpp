@@ -0,0 +1,284 @@
+#ifndef LINEAR_QUADTREE_HPP
+#define LINEAR_QUADTREE_HPP
+
+#include <functional>
+#include <vector>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#include "aabb2d.hpp"
+#include "logging.hpp"
+
+/* Deepest tree allowed, a full tree at this level is ~1.4M nodes */
+#define LINEAR_QUADTREE_MAX_LEVEL 10
+
+/*
+ * Quad tree with all nodes stored in one contiguous array.
+ *
+ * The tree is always complete: depth d (root is depth 0) starts at
+ * index (4^d - 1) / 3 and its 4^d nodes are stored in Morton (Z) order,
+ * so the children of the node with code m at depth d are 4m + [0..3]
+ * at depth d+1. Nodes that has not been requested with child() are
+ * marked as unused and skipped by traverse().
+ *
+ * Child quadrants are numbered the same way as in QuadTree:
+ * 0 | 1
+ * -----
+ * 2 | 3
+ *
+ * Use this instead of QuadTree when the tree is walked a lot more often
+ * than it is modified.
+ */
+template <class T>
+class LinearQuadTree {
+	public:
+		struct node_t {
+			T data;
+			glm::vec2 min, max;
+			int level; //Level 0 is leaf, all above are non-terminal nodes
+			bool used;
+
+			AABB_2D aabb() const { return AABB_2D(min, max); }
+			glm::vec2 middle() const { return (min + max) * 0.5f; }
+		};
+
+		LinearQuadTree(const AABB_2D &position, int level = 0)
+			: min_(position.min)
+			, size_(position.size())
+			, level_(level)
+		{
+			if(level_ > LINEAR_QUADTREE_MAX_LEVEL) {
+				Logging::fatal("[LinearQuadTree] Level %d is larger than max level %d\n", level_, LINEAR_QUADTREE_MAX_LEVEL);
+			}
+			layout();
+			nodes_[0].used = true;
+		}
+
+		/*
+		 * Traverse the tree in the same order as QuadTree::traverse, executing
+		 * given function at each used node.
+		 * Return true from function to continue down the branch
+		 */
+		void traverse(const std::function<bool(node_t*)> & func) {
+			visit(func);
+		}
+
+		/*
+		 * Same as traverse, but the visitor type is known at compile time so
+		 * the call can be inlined. Use this in per frame code.
+		 * visitor(node_t*) returns true to continue down the branch.
+		 */
+		template <class Visitor>
+		void visit(Visitor && visitor) {
+			visit(0, visitor);
+		}
+
+		/*
+		 * Same as visit, but iterative with an explicit stack instead of recursion.
+		 * Nodes are visited in the same order.
+		 */
+		template <class Visitor>
+		void visit_iterative(Visitor && visitor) {
+			/* Each level down adds at most 3 pending siblings */
+			size_t stack[3 * LINEAR_QUADTREE_MAX_LEVEL + 1];
+			int top = 0;
+			stack[top++] = 0;
+			while(top > 0) {
+				const size_t index = stack[--top];
+				node_t * node = &nodes_[index];
+				if(visitor(node) && node->level > 0) {
+					const size_t first = child_index(index, node->level, 0);
+					for(size_t i=first + 4; i-- > first; ) {
+						if(nodes_[i].used) stack[top++] = i;
+					}
+				}
+			}
+		}
+
+		/*
+		 * Finds or marks as used the node at the given level that contain the given position.
+		 * Returns nullptr if the position is not in this quad tree.
+		 *
+		 * @param level Find the child at this level
+		 */
+		node_t * child(const glm::vec2 &position, int level=0) {
+			if(level > level_ || level < 0) return nullptr;
+			node_t * node = &nodes_[0];
+			if(!(node->min.x <= position.x && position.x <= node->max.x &&
+				node->min.y <= position.y && position.y <= node->max.y)) {
+				return nullptr;
+			}
+
+			uint32_t code = 0;
+			for(int depth = 1; depth <= level_ - level; ++depth) {
+				const glm::vec2 middle = node->middle();
+				uint32_t quadrant = 0;
+				if(position.x >= middle.x) quadrant |= 1;
+				if(position.y >= middle.y) quadrant |= 2;
+				code = (code << 2) | quadrant;
+				node = &nodes_[offset(depth) + code];
+				node->used = true;
+			}
+			return node;
+		}
+
+		/*
+		 * Finds or marks as used the given child (quadrant) of node.
+		 * Returns nullptr if node is a leaf.
+		 */
+		node_t * child(const node_t * node, int quadrant) {
+			if(node->level == 0) return nullptr;
+			node_t * c = &nodes_[child_index(index(node), node->level, quadrant)];
+			c->used = true;
+			return c;
+		}
+
+		/*
+		 * Returns the given child (quadrant) of node, or nullptr if it is not
+		 * used or node is a leaf.
+		 */
+		node_t * existing_child(const node_t * node, int quadrant) {
+			if(node->level == 0) return nullptr;
+			node_t * c = &nodes_[child_index(index(node), node->level, quadrant)];
+			return c->used ? c : nullptr;
+		}
+
+		/*
+		 * This grows the tree upwards, in place. The root becomes twice the size
+		 * and the old root becomes its first child.
+		 * Existing node pointers are invalidated.
+		 *
+		 * returns this (for compatibility with QuadTree::grow)
+		 */
+		LinearQuadTree * grow() {
+			if(level_ + 1 > LINEAR_QUADTREE_MAX_LEVEL) {
+				Logging::fatal("[LinearQuadTree] Can't grow past max level %d\n", LINEAR_QUADTREE_MAX_LEVEL);
+			}
+
+			std::vector<node_t> old;
+			old.swap(nodes_);
+			const int old_level = level_;
+
+			size_ *= 2.f;
+			++level_;
+			layout();
+			nodes_[0].used = true;
+
+			/*
+			 * The old root is quadrant 0 of the new root, so every old node keeps
+			 * its morton code, just one level further down.
+			 */
+			for(int depth = 0; depth <= old_level; ++depth) {
+				const size_t count = size_t(1) << (2 * depth);
+				for(size_t m = 0; m < count; ++m) {
+					const node_t &src = old[offset(depth) + m];
+					node_t &dst = nodes_[offset(depth + 1) + m];
+					dst.data = src.data;
+					dst.used = src.used;
+				}
+			}
+			return this;
+		}
+
+		int level() const { return level_; }
+		AABB_2D aabb() const { return AABB_2D(min_, min_ + size_); }
+
+		node_t * root() { return &nodes_[0]; }
+
+		/*
+		 * All nodes (including unused ones) for linear scans
+		 */
+		std::vector<node_t> & nodes() { return nodes_; }
+		const std::vector<node_t> & nodes() const { return nodes_; }
+
+		size_t index(const node_t * node) const {
+			return static_cast<size_t>(node - nodes_.data());
+		}
+
+		/*
+		 * First index of the nodes at the given depth (root is depth 0)
+		 */
+		static size_t offset(int depth) {
+			return ((size_t(1) << (2 * depth)) - 1) / 3;
+		}
+
+		/*
+		 * Index of the given child of the node at index that is on the given level
+		 */
+		size_t child_index(size_t index, int level, int quadrant) const {
+			const int depth = level_ - level;
+			const size_t code = index - offset(depth);
+			return offset(depth + 1) + (code << 2) + static_cast<size_t>(quadrant);
+		}
+
+		/*
+		 * Interleave the bits of x and y, x in the even bits
+		 */
+		static uint32_t morton_encode(uint32_t x, uint32_t y) {
+			return spread_bits(x) | (spread_bits(y) << 1);
+		}
+
+		static void morton_decode(uint32_t code, uint32_t &x, uint32_t &y) {
+			x = compact_bits(code);
+			y = compact_bits(code >> 1);
+		}
+
+	private:
+		std::vector<node_t> nodes_;
+		glm::vec2 min_, size_;
+		int level_;
+
+		/*
+		 * Allocate all nodes and calculate their bounds
+		 */
+		void layout() {
+			nodes_.clear();
+			nodes_.resize(offset(level_ + 1));
+
+			for(int depth = 0; depth <= level_; ++depth) {
+				const uint32_t count = uint32_t(1) << (2 * depth);
+				const glm::vec2 cell_size = size_ / static_cast<float>(1 << depth);
+				for(uint32_t m = 0; m < count; ++m) {
+					uint32_t x, y;
+					morton_decode(m, x, y);
+					node_t &node = nodes_[offset(depth) + m];
+					node.data = T();
+					node.min = min_ + cell_size * glm::vec2(static_cast<float>(x), static_cast<float>(y));
+					node.max = node.min + cell_size;
+					node.level = level_ - depth;
+					node.used = false;
+				}
+			}
+		}
+
+		template <class Visitor>
+		void visit(size_t index, Visitor & visitor) {
+			node_t * node = &nodes_[index];
+			if(!visitor(node) || node->level == 0) return;
+
+			const size_t first = child_index(index, node->level, 0);
+			for(size_t i=first; i<first + 4; ++i) {
+				if(nodes_[i].used) visit(i, visitor);
+			}
+		}
+
+		static uint32_t spread_bits(uint32_t v) {
+			v &= 0x0000ffff;
+			v = (v | (v << 8)) & 0x00ff00ff;
+			v = (v | (v << 4)) & 0x0f0f0f0f;
+			v = (v | (v << 2)) & 0x33333333;
+			v = (v | (v << 1)) & 0x55555555;
+			return v;
+		}
+
+		static uint32_t compact_bits(uint32_t v) {
+			v &= 0x55555555;
+			v = (v | (v >> 1)) & 0x33333333;
+			v = (v | (v >> 2)) & 0x0f0f0f0f;
+			v = (v | (v >> 4)) & 0x00ff00ff;
+			v = (v | (v >> 8)) & 0x0000ffff;
+			return v;
+		}
+};
+
+#endif
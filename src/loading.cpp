@@ -34,6 +34,7 @@ namespace Loading {
 		quad->render();
 
 		SDL_GL_SwapBuffers();
+		Shader::end_frame();
 	}
 
 	void init(const glm::ivec2& resolution){
@@ -4,6 +4,7 @@
 
 #include "data.hpp"
 #include "engine.hpp"
+#include "gl_state.hpp"
 #include "globals.hpp"
 #include "loading.hpp"
 #include "logging.hpp"
@@ -19,6 +20,8 @@
 #include "config.hpp"
 #include "sound.hpp"
 #include "movable_light.hpp"
+#include "particle_system.hpp"
+#include "threading.hpp"
 
 #include <cstdio>
 #include <cstdlib>
@@ -52,6 +55,8 @@ static bool fullscreen = FULLSCREEN;
 static bool vsync = true;
 static bool verbose_flag = false;
 static bool skip_load_scene = false;
+static bool cpu_particles = false;
+static bool soa_particles = false;
 glm::ivec2 resolution(800, 600);
 
 static void poll();
@@ -156,7 +161,13 @@ static void init(const char* title){
 		"shader:/shaders/passthru",
 	};
 	Engine::preload(std::vector<std::string>(resources, resources + sizeof(resources)/sizeof(char*)), Loading::progress);
-	CL::init();
+	if(cpu_particles || !CL::init()) {
+		Logging::verbose("Using CPU particle backend\n");
+		ParticleSystem::backend = ParticleSystem::BACKEND_CPU;
+	}
+	if(soa_particles) {
+		ParticleSystem::layout = ParticleSystem::LAYOUT_SOA;
+	}
 	srand((unsigned int)time(0));
 
 	Engine::init();
@@ -166,8 +177,13 @@ static void init(const char* title){
 }
 
 static void cleanup(){
+	if ( verbose_flag ){
+		GLState::usage_report(stderr);
+	}
+
 	CL::cleanup();
 	Engine::cleanup();
+	Threading::cleanup();
 	Texture2D::cleanup();
 	Logging::cleanup();
 	SDL_Quit();
@@ -230,6 +246,7 @@ static void render(){
 	Engine::render();
 
 	SDL_GL_SwapBuffers();
+	Shader::end_frame();
 	checkForGLErrors("Frame end");
 }
 
@@ -293,11 +310,13 @@ void show_usage(){
 	       "  -v, --verbose           Enable verbose output to stdout (redirected to logfile otherwise)\n"
 	       "  -q, --quiet             Inverse of --verbose.\n"
 				 "  -l, --no-loading        Don't show loading scene (faster load).\n"
+	       "  -c, --cpu-particles     Simulate particles on the CPU instead of with OpenCL.\n"
+	       "  -a, --soa-particles     Store the OpenCL particle state as structure of arrays.\n"
 	       "  -h, --help              This text\n",
 	       program_name, program_name, FULLSCREEN ? "true" : "false");
 }
 
-static const char* shortopts = "r:s:fwnvqlh";
+static const char* shortopts = "r:s:fwnvqlcah";
 static struct option longopts[] = {
 	{"resolution",   required_argument, 0, 'r'},
 	{"seek",         required_argument, 0, 's'},
@@ -307,6 +326,8 @@ static struct option longopts[] = {
 	{"verbose",      no_argument,       0, 'v'},
 	{"quiet",        no_argument,       0, 'q'},
 	{"no-loading",   no_argument,       0, 'l'},
+	{"cpu-particles", no_argument,      0, 'c'},
+	{"soa-particles", no_argument,      0, 'a'},
 	{"help",         no_argument,       0, 'h'},
 	{0,0,0,0} /* sentinel */
 };
@@ -330,6 +351,14 @@ static void parse_argv(int argc, char* argv[]){
 			skip_load_scene = true;
 			break;
 
+		case 'c': /* --cpu-particles */
+			cpu_particles = true;
+			break;
+
+		case 'a': /* --soa-particles */
+			soa_particles = true;
+			break;
+
 		case 'w': /* --windowed */
 			fullscreen = false;
 			break;
@@ -372,6 +401,8 @@ void show_usage(){
 	       "  -w          Inverse of --fullscreen.\n"
 	       "  -n          Disable vsync.\n"
 	       "  -v           Enable verbose output to stdout (redirected to logfile otherwise)\n"
+	       "  -c           Simulate particles on the CPU instead of with OpenCL.\n"
+	       "  -a           Store the OpenCL particle state as structure of arrays.\n"
 	       "  -h              This text\n",
 	       program_name, program_name, FULLSCREEN ? "true" : "false");
 };
@@ -387,6 +418,10 @@ static void parse_argv(int argc, char* argv[]){
 			fullscreen = false;
 		else if (strcmp(arg, "-n") == 0)
 			vsync = false;
+		else if (strcmp(arg, "-c") == 0)
+			cpu_particles = true;
+		else if (strcmp(arg, "-a") == 0)
+			soa_particles = true;
 		else if (strcmp(arg, "-h") == 0) {
 			show_usage();
 			exit(0);
@@ -6,6 +6,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "aabb2d.hpp"
+#include "gl_state.hpp"
 #include "mesh.hpp"
 #include "logging.hpp"
 #include "shader.hpp"
@@ -24,9 +25,10 @@ Mesh::Mesh(float partition_size)
 	, vbos_generated_(false)
 	, has_tangents_(false)
 	, partition_size_(partition_size)
+	, vertex_format_(VERTEX_FORMAT_FULL)
 {
-	submesh_tree = new QuadTree(AABB_2D(glm::vec2(0.f), glm::vec2(partition_size)));
-	submesh_tree->data = new SubMesh(*this);
+	submesh_tree = new submesh_tree_t(AABB_2D(glm::vec2(0.f), glm::vec2(partition_size)));
+	submesh_tree->root()->data = new SubMesh(*this);
 }
 
 Mesh::Mesh(const std::vector<Shader::vertex_t> &vertices, const std::vector<unsigned int> &indices, float partition_size) :
@@ -35,10 +37,11 @@ Mesh::Mesh(const std::vector<Shader::vertex_t> &vertices, const std::vector<unsi
 	, vertices_(vertices)
 	,	vbos_generated_(false),has_tangents_(false)
 	, partition_size_(partition_size)
+	, vertex_format_(VERTEX_FORMAT_FULL)
 {
 
-	submesh_tree = new QuadTree(AABB_2D(glm::vec2(0.f), glm::vec2(partition_size)));
-	submesh_tree->data = new SubMesh(*this);
+	submesh_tree = new submesh_tree_t(AABB_2D(glm::vec2(0.f), glm::vec2(partition_size)));
+	submesh_tree->root()->data = new SubMesh(*this);
 
 	if(!(indices.size()%3)==0) {
 		Logging::fatal("Trying to create a Mesh with number of indices not a factor of 3\n");
@@ -47,8 +50,8 @@ Mesh::Mesh(const std::vector<Shader::vertex_t> &vertices, const std::vector<unsi
 }
 
 void Mesh::free_submesh_tree() {
-	submesh_tree->traverse([](QuadTree * qt) -> bool {
-		if(qt->data != nullptr) delete (SubMesh*) qt->data;
+	submesh_tree->traverse([](submesh_tree_t::node_t * node) -> bool {
+		if(node->data != nullptr) delete node->data;
 		return true;
 	});
 
@@ -59,11 +62,17 @@ Mesh::~Mesh() {
 	free_submesh_tree();
 
 	if(vbos_generated_) {
-		glDeleteBuffers(2, buffers);
+		GLState::delete_vertex_arrays(1, &vao_);
+		GLState::delete_buffers(2, buffers);
 	}
 }
 
-SubMesh::SubMesh(Mesh &mesh) : parent(mesh) { }
+SubMesh::SubMesh(Mesh &mesh)
+	: parent(mesh)
+	, indices_start(0)
+	, index_type(GL_UNSIGNED_INT)
+	, base_vertex(0)
+{ }
 
 SubMesh::~SubMesh() { }
 
@@ -80,7 +89,7 @@ void Mesh::add_indices(const std::vector<unsigned int> &indices, int level) {
 
 	 if(partition_size_ < 0.f) {
 		//Ignore quad tree size, just insert in the quad tree node
-		SubMesh * m = (SubMesh*) submesh_tree->data ;
+		SubMesh * m = submesh_tree->root()->data;
 		m->indices.insert(m->indices.end(), indices.begin(), indices.end());
 	 } else {
 
@@ -92,7 +101,7 @@ void Mesh::add_indices(const std::vector<unsigned int> &indices, int level) {
 						glm::vec2(vertices_[*(it + 2)].pos.x, vertices_[*(it + 2)].pos.z)
 					);
 			//Find child:
-			QuadTree * child = nullptr;
+			submesh_tree_t::node_t * child = nullptr;
 			while(child == nullptr) {
 				child = submesh_tree->child(min2d, level);
 				if(child == nullptr) {
@@ -100,9 +109,9 @@ void Mesh::add_indices(const std::vector<unsigned int> &indices, int level) {
 					submesh_tree = submesh_tree->grow();
 				}
 			}
-			if(child->data == nullptr) child->data = (void*) new SubMesh(*this);
+			if(child->data == nullptr) child->data = new SubMesh(*this);
 
-			SubMesh * m = ((SubMesh*) child->data );
+			SubMesh * m = child->data;
 			m->indices.insert(m->indices.end(), it, it + 3);
 		}
 	 }
@@ -128,8 +137,8 @@ void Mesh::generate_normals() {
 
 	if(vertices_.size() < 3) Logging::fatal("Mesh::generate_normals() called with vertices empty\n");
 
-	submesh_tree->traverse([](QuadTree * qt) -> bool {
-		if(qt->data != nullptr) ( (SubMesh*) qt->data )->generate_normals();
+	submesh_tree->traverse([](submesh_tree_t::node_t * node) -> bool {
+		if(node->data != nullptr) node->data->generate_normals();
 		return true;
 	});
 
@@ -187,8 +196,8 @@ void Mesh::ortonormalize_tangent_space() {
 void Mesh::generate_tangents_and_bitangents() {
 	if(vertices_.size() < 3) Logging::fatal("Mesh::generate_tangents_and_bitangents() called with vertices empty\n");
 
-	submesh_tree->traverse([](QuadTree * qt) -> bool {
-		if(qt->data != nullptr) ( (SubMesh*) qt->data )->generate_tangents_and_bitangents();
+	submesh_tree->traverse([](submesh_tree_t::node_t * node) -> bool {
+		if(node->data != nullptr) node->data->generate_tangents_and_bitangents();
 		return true;
 	});
 
@@ -217,6 +226,11 @@ void SubMesh::generate_tangents_and_bitangents() {
 	}
 }
 
+void Mesh::set_vertex_format(vertex_format_t format) {
+	verify_immutable("set_vertex_format()");
+	vertex_format_ = format;
+}
+
 void Mesh::verify_immutable(const char * where) {
 	if(vbos_generated_) {
 		Logging::fatal("Mesh::%s can not be used after vertex buffers have been generated\n", where);
@@ -226,33 +240,50 @@ void Mesh::verify_immutable(const char * where) {
 void Mesh::generate_vbos() {
 	verify_immutable("generate_vbos()");
 
+	localize_vertices();
+
 	glGenBuffers(2, buffers);
 	checkForGLErrors("Mesh::generate_vbos(): gen buffers");
 
-	glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Shader::vertex_t)*vertices_.size(), vertices_.data(), GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	checkForGLErrors("Mesh::generate_vbos(): fill vertex buffer");
-
-	size_t num_indices = 0;
+	size_t index_bytes = 0;
 
-	//Iterate subtree to find the total number of indices
-	submesh_tree->traverse([&num_indices](QuadTree * qt) -> bool {
-		if(qt->data != nullptr) num_indices += ( (SubMesh*) qt->data )->indices.size();
+	//Iterate subtree to find the total size of the indices
+	submesh_tree->visit([&index_bytes](submesh_tree_t::node_t * node) -> bool {
+		if(node->data != nullptr) index_bytes += node->data->choose_index_type();
 		return true;
 	});
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[1]);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, num_indices * sizeof(unsigned int), nullptr, GL_STATIC_DRAW);
+	GLState::bind_buffer(GL_ELEMENT_ARRAY_BUFFER, buffers[1]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, static_cast<GLsizeiptr>(index_bytes), nullptr, GL_STATIC_DRAW);
 
 	size_t cur_pos = 0;
 
-	submesh_tree->traverse([&cur_pos](QuadTree * qt) -> bool {
-		if(qt->data != nullptr) cur_pos = ( (SubMesh*) qt->data )->buffer_data(cur_pos);
+	submesh_tree->visit([&cur_pos](submesh_tree_t::node_t * node) -> bool {
+		if(node->data != nullptr) cur_pos = node->data->buffer_data(cur_pos);
 		return true;
 	});
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	GLState::bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	/* Set up the attributes once, rendering only binds the vertex array */
+	glGenVertexArrays(1, &vao_);
+	GLState::bind_vertex_array(vao_);
+	GLState::bind_buffer(GL_ARRAY_BUFFER, buffers[0]);
+	GLState::bind_buffer(GL_ELEMENT_ARRAY_BUFFER, buffers[1]);
+
+	if(vertex_format_ == VERTEX_FORMAT_PACKED) {
+		upload_packed_vertices();
+	} else {
+		upload_full_vertices();
+	}
+
+	GLState::bind_vertex_array(0);
+	GLState::bind_buffer(GL_ARRAY_BUFFER, 0);
+	GLState::bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	checkForGLErrors("Mesh::generate_vbos(): create vertex array");
+
+	submesh_bounds_.assign(submesh_tree->nodes().size(), AABB());
+	calculate_submesh_bounds(submesh_tree->root());
 
 	raw_aabb_.min = vertices_[0].pos;
 	raw_aabb_.max = vertices_[0].pos;
@@ -263,51 +294,224 @@ void Mesh::generate_vbos() {
 
 	aabb_dirty_ = true;
 
+	if(vertex_format_ == VERTEX_FORMAT_PACKED) {
+		/* Everything that needs the vertices is done, free the memory */
+		std::vector<Shader::vertex_t>().swap(vertices_);
+	}
+
 	vbos_generated_ = true;
 }
 
+void Mesh::upload_full_vertices() {
+	glBufferData(GL_ARRAY_BUFFER, sizeof(Shader::vertex_t)*vertices_.size(), vertices_.data(), GL_STATIC_DRAW);
+	checkForGLErrors("Mesh::generate_vbos(): fill vertex buffer");
+
+	for(int i=0; i<Shader::NUM_ATTR; ++i) {
+		glEnableVertexAttribArray(i);
+	}
+
+	glVertexAttribPointer(Shader::ATTR_POSITION,  3, GL_FLOAT, GL_FALSE, sizeof(Shader::vertex_t), (const GLvoid*) offsetof(Shader::vertex_t, pos));
+	glVertexAttribPointer(Shader::ATTR_TEXCOORD,  2, GL_FLOAT, GL_FALSE, sizeof(Shader::vertex_t), (const GLvoid*) offsetof(Shader::vertex_t, uv));
+	glVertexAttribPointer(Shader::ATTR_NORMAL,    3, GL_FLOAT, GL_FALSE, sizeof(Shader::vertex_t), (const GLvoid*) offsetof(Shader::vertex_t, normal));
+	glVertexAttribPointer(Shader::ATTR_TANGENT,   3, GL_FLOAT, GL_FALSE, sizeof(Shader::vertex_t), (const GLvoid*) offsetof(Shader::vertex_t, tangent));
+	glVertexAttribPointer(Shader::ATTR_BITANGENT, 3, GL_FLOAT, GL_FALSE, sizeof(Shader::vertex_t), (const GLvoid*) offsetof(Shader::vertex_t, bitangent));
+	glVertexAttribPointer(Shader::ATTR_COLOR,     4, GL_FLOAT, GL_FALSE, sizeof(Shader::vertex_t), (const GLvoid*) offsetof(Shader::vertex_t, color));
+}
+
+void Mesh::upload_packed_vertices() {
+	std::vector<Shader::packed_vertex_t> packed(vertices_.size());
+	for(size_t i=0; i<vertices_.size(); ++i) {
+		packed[i] = Shader::pack_vertex(vertices_[i]);
+	}
+
+	glBufferData(GL_ARRAY_BUFFER, sizeof(Shader::packed_vertex_t)*packed.size(), packed.data(), GL_STATIC_DRAW);
+	checkForGLErrors("Mesh::generate_vbos(): fill packed vertex buffer");
+
+	/* The bitangent is rebuilt in the shader and there is no color */
+	glEnableVertexAttribArray(Shader::ATTR_POSITION);
+	glEnableVertexAttribArray(Shader::ATTR_TEXCOORD);
+	glEnableVertexAttribArray(Shader::ATTR_NORMAL);
+	glEnableVertexAttribArray(Shader::ATTR_TANGENT);
+
+	glVertexAttribPointer(Shader::ATTR_POSITION, 3, GL_FLOAT,      GL_FALSE, sizeof(Shader::packed_vertex_t), (const GLvoid*) offsetof(Shader::packed_vertex_t, pos));
+	glVertexAttribPointer(Shader::ATTR_TEXCOORD, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(Shader::packed_vertex_t), (const GLvoid*) offsetof(Shader::packed_vertex_t, uv));
+	glVertexAttribPointer(Shader::ATTR_NORMAL,   2, GL_SHORT,      GL_TRUE,  sizeof(Shader::packed_vertex_t), (const GLvoid*) offsetof(Shader::packed_vertex_t, normal));
+	glVertexAttribPointer(Shader::ATTR_TANGENT,  3, GL_BYTE,       GL_TRUE,  sizeof(Shader::packed_vertex_t), (const GLvoid*) offsetof(Shader::packed_vertex_t, tangent));
+}
+
+void Mesh::localize_vertices() {
+	const unsigned int unused = static_cast<unsigned int>(-1);
+	std::vector<unsigned int> remap(vertices_.size(), unused);
+	unsigned int next = 0;
+
+	order_vertices(submesh_tree->root(), remap, next);
+
+	/* Vertices not used by any submesh goes last */
+	for(unsigned int &r : remap) {
+		if(r == unused) r = next++;
+	}
+
+	std::vector<Shader::vertex_t> ordered(vertices_.size());
+	for(size_t i=0; i<vertices_.size(); ++i) {
+		ordered[remap[i]] = vertices_[i];
+	}
+	vertices_.swap(ordered);
+
+	submesh_tree->visit([&remap](submesh_tree_t::node_t * node) -> bool {
+		if(node->data != nullptr) {
+			for(unsigned int &i : node->data->indices) {
+				i = remap[i];
+			}
+		}
+		return true;
+	});
+}
+
+void Mesh::order_vertices(submesh_tree_t::node_t * node, std::vector<unsigned int> &remap, unsigned int &next) {
+	for(int i=0; i<4; ++i) {
+		submesh_tree_t::node_t * child = submesh_tree->existing_child(node, i);
+		if(child != nullptr) order_vertices(child, remap, next);
+	}
+
+	const SubMesh * m = node->data;
+	if(m == nullptr) return;
+
+	for(const unsigned int &i : m->indices) {
+		if(remap[i] == static_cast<unsigned int>(-1)) remap[i] = next++;
+	}
+}
+
+AABB Mesh::calculate_submesh_bounds(submesh_tree_t::node_t * node) {
+	AABB bounds;
+	const SubMesh * m = node->data;
+
+	if(m != nullptr) {
+		for(const unsigned int &i : m->indices) {
+			bounds.add_point(vertices_[i].pos);
+		}
+	}
+
+	for(int i=0; i<4; ++i) {
+		submesh_tree_t::node_t * child = submesh_tree->existing_child(node, i);
+		if(child != nullptr) bounds += calculate_submesh_bounds(child);
+	}
+
+	submesh_bounds_[submesh_tree->index(node)] = bounds;
+
+	return bounds;
+}
+
+/* Keep every submesh 4 byte aligned, so 32 bit indices can follow 16 bit ones */
+static size_t align_index_bytes(size_t bytes) {
+	return (bytes + 3) & ~static_cast<size_t>(3);
+}
+
+size_t SubMesh::choose_index_type() {
+	index_type = GL_UNSIGNED_INT;
+	base_vertex = 0;
+
+	if(indices.empty()) return 0;
+
+	unsigned int min = indices[0], max = indices[0];
+	for(const unsigned int &i : indices) {
+		if(i < min) min = i;
+		if(i > max) max = i;
+	}
+
+	if(max - min <= 0xffff) {
+		index_type = GL_UNSIGNED_SHORT;
+		base_vertex = static_cast<GLint>(min);
+		return align_index_bytes(sizeof(GLushort) * indices.size());
+	}
+	return align_index_bytes(sizeof(GLuint) * indices.size());
+}
+
 size_t SubMesh::buffer_data(size_t start) {
 	//Upload data:
 
 	indices_start = start;
+	size_t bytes;
 
-	glBufferSubData(
-			GL_ELEMENT_ARRAY_BUFFER, 
-			static_cast<GLintptr>(sizeof(unsigned int) * start),
-			static_cast<GLsizeiptr>(sizeof(unsigned int)*indices.size()),
-			static_cast<const GLvoid*>(indices.data())
-		);
+	if(index_type == GL_UNSIGNED_SHORT) {
+		std::vector<GLushort> local(indices.size());
+		for(size_t i=0; i<indices.size(); ++i) {
+			local[i] = static_cast<GLushort>(indices[i] - static_cast<unsigned int>(base_vertex));
+		}
+		bytes = sizeof(GLushort) * local.size();
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, static_cast<GLintptr>(start), static_cast<GLsizeiptr>(bytes), local.data());
+	} else {
+		bytes = sizeof(GLuint) * indices.size();
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, static_cast<GLintptr>(start), static_cast<GLsizeiptr>(bytes), indices.data());
+	}
 	checkForGLErrors("SubMesh::generate_vbos(): fill index buffer");
 
 	num_faces = static_cast<unsigned int>( static_cast<float>(indices.size()) / 3.f );
 
-	return start + indices.size();
+	return start + align_index_bytes(bytes);
 }
 
 void Mesh::prepare_submesh_rendering(const glm::mat4& m) {
 	Shader::upload_model_matrix(m * matrix());
 
-	glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[1]);
+	GLState::bind_vertex_array(vao_);
+
+	for(draw_batch_t &batch : draw_batches_) {
+		batch.clear();
+	}
+}
+
+void Mesh::draw_batch_t::clear() {
+	counts.clear();
+	offsets.clear();
+	base_vertices.clear();
+}
+
+void Mesh::queue_submesh(const SubMesh * submesh) {
+	if(submesh->num_faces == 0) return;
+
+	draw_batch_t &batch = draw_batches_[submesh->index_type == GL_UNSIGNED_SHORT ? DRAW_BATCH_SHORT : DRAW_BATCH_INT];
+	batch.counts.push_back(static_cast<GLsizei>(submesh->num_faces * 3));
+	batch.offsets.push_back((const GLvoid*) submesh->indices_start);
+	batch.base_vertices.push_back(submesh->base_vertex);
+}
+
+void Mesh::finish_submesh_rendering() {
+	static const GLenum batch_type[NUM_DRAW_BATCHES] = { GL_UNSIGNED_SHORT, GL_UNSIGNED_INT };
+
+	for(int i=0; i<NUM_DRAW_BATCHES; ++i) {
+		draw_batch_t &batch = draw_batches_[i];
+		if(batch.counts.empty()) continue;
+
+		glMultiDrawElementsBaseVertex(GL_TRIANGLES, batch.counts.data(), batch_type[i],
+			const_cast<GLvoid**>(batch.offsets.data()), static_cast<GLsizei>(batch.counts.size()), batch.base_vertices.data());
+		batch.clear();
+	}
+
+	GLState::bind_vertex_array(0);
+	checkForGLErrors("Mesh::finish_submesh_rendering()");
 }
 
 void Mesh::render(const glm::mat4& m) {
 
 	prepare_submesh_rendering(m);
 
-	submesh_tree->traverse([](QuadTree * qt) -> bool {
-		if(qt->data != nullptr) ( (SubMesh*) qt->data )->render();
+	submesh_tree->visit([this](submesh_tree_t::node_t * node) -> bool {
+		if(node->data != nullptr) queue_submesh(node->data);
 		return true;
 	});
+
+	finish_submesh_rendering();
 }
 
 void Mesh::render_geometry(const glm::mat4& m) {
 	prepare_submesh_rendering(m);
 
-	submesh_tree->traverse([](QuadTree * qt) -> bool {
-		if(qt->data != nullptr) ( (SubMesh*) qt->data )->render_geometry();
+	submesh_tree->visit([this](submesh_tree_t::node_t * node) -> bool {
+		if(node->data != nullptr) queue_submesh(node->data);
 		return true;
 	});
+
+	finish_submesh_rendering();
 }
 
 void SubMesh::render() {
@@ -315,19 +519,7 @@ void SubMesh::render() {
 }
 
 void SubMesh::render_geometry() {
-
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Shader::vertex_t), (const GLvoid*) offsetof(Shader::vertex_t, pos));
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Shader::vertex_t), (const GLvoid*) offsetof(Shader::vertex_t, uv));
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Shader::vertex_t), (const GLvoid*) offsetof(Shader::vertex_t, normal));
-	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Shader::vertex_t), (const GLvoid*) offsetof(Shader::vertex_t, tangent));
-	glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Shader::vertex_t), (const GLvoid*) offsetof(Shader::vertex_t, bitangent));
-	glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(Shader::vertex_t), (const GLvoid*) offsetof(Shader::vertex_t, color));
-
-	checkForGLErrors("SubMesh::render(): Set vertex attribs");
-
-	glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(num_faces * 3), GL_UNSIGNED_INT, (void*)(indices_start * sizeof(GLuint)));
-
-	checkForGLErrors("SubMesh::render(): glDrawElements()");
+	glDrawElementsBaseVertex(GL_TRIANGLES, static_cast<GLsizei>(num_faces * 3), index_type, (void*) indices_start, base_vertex);
 }
 
 void Mesh::calculate_aabb() {
@@ -354,8 +546,8 @@ void Mesh::set_partition_size(float size) {
 
 	free_submesh_tree();
 
-	submesh_tree = new QuadTree(AABB_2D(glm::vec2(0.f), glm::vec2(size)));
-	submesh_tree->data = new SubMesh(*this);
+	submesh_tree = new submesh_tree_t(AABB_2D(glm::vec2(0.f), glm::vec2(size)));
+	submesh_tree->root()->data = new SubMesh(*this);
 
 	partition_size_ = size;
 }
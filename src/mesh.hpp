@@ -9,7 +9,7 @@
 #include "aabb.hpp"
 #include "shader.hpp"
 #include "movable_object.hpp"
-#include "quadtree.hpp"
+#include "linear_quadtree.hpp"
 
 class Mesh;
 
@@ -25,20 +25,34 @@ class SubMesh {
 		unsigned long num_faces;
 
 		virtual void render();
+
+		/*
+		 * Draw this submesh right away. Must be called between
+		 * Mesh::prepare_submesh_rendering and Mesh::finish_submesh_rendering.
+		 */
 		virtual void render_geometry();
 
 	protected:
 		void generate_normals();
 		void generate_tangents_and_bitangents();
 		/*
-		 * Buffer the buffer bound to GL_ELEMENT_ARRAY_BUFFER from start to size,
-		 * return start + size
+		 * Pick 16 bit indices relative to base_vertex if the vertices used by
+		 * this submesh span less than 65536, otherwise 32 bit indices.
+		 * Returns the number of bytes needed in the index buffer.
+		 */
+		size_t choose_index_type();
+
+		/*
+		 * Buffer the buffer bound to GL_ELEMENT_ARRAY_BUFFER from start (in bytes) to size,
+		 * return start + size (aligned to 4 bytes)
 		 */
 		size_t buffer_data(size_t start);
 
 		Mesh &parent;
 
-		size_t indices_start; //Where in the index buffer our data is located
+		size_t indices_start; //Where in the index buffer our data is located (in bytes)
+		GLenum index_type; //GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+		GLint base_vertex; //Added to each index when drawing
 };
 
 class Mesh : public MovableObject {
@@ -59,6 +73,18 @@ class Mesh : public MovableObject {
 		void activate_normals();
 		void activate_tangents_and_bitangents();
 
+		enum vertex_format_t {
+			VERTEX_FORMAT_FULL,   /* Shader::vertex_t, all attributes as floats */
+			VERTEX_FORMAT_PACKED, /* Shader::packed_vertex_t, needs a shader that decodes it (see terrain.vert) */
+		};
+
+		/*
+		 * Select the vertex layout used in the vertex buffer (default is full).
+		 * With the packed format the vertices are released from memory
+		 * once they have been uploaded.
+		 */
+		void set_vertex_format(vertex_format_t format);
+
 		void add_vertices(const std::vector<Shader::vertex_t> &vertices);
 		void add_indices(const std::vector<unsigned int> &indices, int level=0);
 
@@ -78,10 +104,23 @@ class Mesh : public MovableObject {
 		/*
 		 * This must be called before rendering submeshes (if not using Mesh::render or Mesh::render_geometri)
 		 *
-		 * Uploads model matrix and binds vertex buffer
+		 * Uploads model matrix and binds the vertex array
 		 */
 		virtual void prepare_submesh_rendering(const glm::mat4& m = glm::mat4());
 
+		/*
+		 * Queue a submesh to be drawn by finish_submesh_rendering.
+		 * All queued submeshes are submitted with one glMultiDrawElementsBaseVertex
+		 * call per index type.
+		 */
+		void queue_submesh(const SubMesh * submesh);
+
+		/*
+		 * Draws the queued submeshes and unbinds the vertex array.
+		 * Must be called after the submeshes have been rendered/queued.
+		 */
+		void finish_submesh_rendering();
+
 		virtual void render(const glm::mat4& m = glm::mat4());
 		virtual void render_geometry(const glm::mat4& m = glm::mat4());
 
@@ -95,27 +134,79 @@ class Mesh : public MovableObject {
 		virtual void calculate_aabb();
 		virtual void matrix_becomes_dirty();
 
-		QuadTree * submesh_tree;
+		/* Submeshes by position, the tree is walked every frame while culling */
+		typedef LinearQuadTree<SubMesh*> submesh_tree_t;
+		submesh_tree_t * submesh_tree;
+
+		/*
+		 * Bounds of the vertices used by the submeshes in the subtree of each
+		 * node (before any matrices), indexed as submesh_tree->nodes().
+		 * Nodes without a submesh of their own have bounds too.
+		 * Calculated in generate_vbos.
+		 */
+		std::vector<AABB> submesh_bounds_;
 
 		std::vector<Shader::vertex_t> vertices_;
 
 		bool vbos_generated_, has_normals_, has_tangents_;
 		float partition_size_;
+		vertex_format_t vertex_format_;
 
 		glm::vec3 scale_;
 
 		GLuint buffers[2];
+		GLuint vao_; /* Vertex attribute setup and buffers, created with the vbos */
+
+		/* Submeshes queued for drawing, one batch per index type */
+		struct draw_batch_t {
+			std::vector<GLsizei> counts;
+			std::vector<const GLvoid*> offsets; /* in the index buffer */
+			std::vector<GLint> base_vertices;
+
+			void clear();
+		};
+
+		enum {
+			DRAW_BATCH_SHORT = 0,
+			DRAW_BATCH_INT,
+			NUM_DRAW_BATCHES
+		};
+
+		draw_batch_t draw_batches_[NUM_DRAW_BATCHES];
 
 		void verify_immutable(const char * where); //Checks that vbos_generated == false
 
+		/*
+		 * Fill the bound vertex buffer and set up the attributes of the bound vertex array
+		 */
+		void upload_full_vertices();
+		void upload_packed_vertices();
+
 		/*
 		 * Warning! Calling this will remove any currently added indices
 		 */
 		void set_partition_size(float size);
 
-	private:
+		/*
+		 * Delete the submesh tree and all submeshes in it
+		 */
 		void free_submesh_tree();
 
+		/*
+		 * Reorder vertices_ so the vertices first used by a submesh are
+		 * contiguous, with the submeshes in post order (children before
+		 * their parent). This keeps the vertex range of each submesh small
+		 * enough for 16 bit indices, see SubMesh::choose_index_type.
+		 * Indices are remapped.
+		 */
+		void localize_vertices();
+		void order_vertices(submesh_tree_t::node_t * node, std::vector<unsigned int> &remap, unsigned int &next);
+
+		/*
+		 * Calculate submesh_bounds_ for node and everything below it,
+		 * returns the bounds of the subtree
+		 */
+		AABB calculate_submesh_bounds(submesh_tree_t::node_t * node);
 
 };
 
@@ -0,0 +1,374 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "particle_cpu.hpp"
+#include "threading.hpp"
+#include "utils.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+	#define PARTICLE_SSE 1
+	#include <xmmintrin.h>
+#else
+	#define PARTICLE_SSE 0
+#endif
+
+/* Particles per range given to the worker pool */
+#define PARTICLE_CPU_GRAIN 4096
+
+static const float PARTICLE_PI = 3.14159265f;
+
+#define RANDOM_STREAM_SPAWN 0
+#define RANDOM_STREAM_RUN 1
+
+namespace {
+	/*
+	 * Same streams as rng_t in cl_programs/particles_random.cl, each call
+	 * takes a new Philox block and uses as many of its four values as needed.
+	 */
+	struct random_t {
+		uint32_t counter[4];
+		uint32_t key[2];
+
+		random_t(int id, uint32_t frame, uint32_t seed, uint32_t stream) {
+			counter[0] = static_cast<uint32_t>(id);
+			counter[1] = frame;
+			counter[2] = 0;
+			counter[3] = stream;
+			key[0] = seed;
+			key[1] = 0x2545F491u;
+		}
+
+		/* Four numbers in [0, 1) */
+		void next(float r[4]) {
+			uint32_t out[4];
+			util_philox4x32(counter, key, out);
+			++counter[2];
+			for(int i = 0; i < 4; ++i) {
+				r[i] = static_cast<float>(out[i] >> 8) * (1.f / 16777216.f);
+			}
+		}
+
+		/* Same as random1 in particles_random.cl: 0..m, or -m..m if dual is set */
+		float random1(float m, bool dual) {
+			float r[4];
+			next(r);
+			return dual ? (2.f * r[0] - 1.f) * m : r[0] * m;
+		}
+
+		void random3(const glm::vec4 &m, bool dual, float out[3]) {
+			float r[4];
+			next(r);
+			for(int i = 0; i < 3; ++i) {
+				out[i] = dual ? (2.f * r[i] - 1.f) * m[i] : r[i] * m[i];
+			}
+		}
+	};
+}
+
+ParticleCPU::ParticleCPU(int max_num_particles)
+	: max_num_particles_(max_num_particles)
+	, dead_count_(max_num_particles)
+	, height_map_width_(0)
+	, height_map_height_(0)
+	, height_map_scale_(1.f) {
+
+	const size_t size = static_cast<size_t>(max_num_particles);
+	for(std::vector<float> &v : position_) v.assign(size, 0.f);
+	for(std::vector<float> &v : velocity_) v.assign(size, 0.f);
+	ttl_.assign(size, 0.f);
+	org_ttl_.assign(size, 1.f);
+	rotation_speed_.assign(size, 0.f);
+	initial_scale_.assign(size, 0.f);
+	final_scale_.assign(size, 0.f);
+	wind_influence_.assign(size, 0.f);
+	gravity_influence_.assign(size, 0.f);
+	dead_.assign(size, 1.f);
+	texture_index_.assign(size, 0);
+	emitter_.assign(size, 0);
+	scratch_.resize(size);
+
+	/* Popped from the back, so the pool is used from the start */
+	dead_indices_.resize(size);
+	for(int i = 0; i < max_num_particles; ++i) {
+		dead_indices_[i] = max_num_particles - 1 - i;
+	}
+}
+
+int ParticleCPU::max_num_particles() const {
+	return max_num_particles_;
+}
+
+int ParticleCPU::num_alive() const {
+	return max_num_particles_ - dead_count_;
+}
+
+void ParticleCPU::set_height_map(const float * height_map, int width, int height, float scale) {
+	if(height_map == nullptr) {
+		height_map_.clear();
+		height_map_width_ = height_map_height_ = 0;
+		return;
+	}
+	height_map_.assign(height_map, height_map + width * height);
+	height_map_width_ = width;
+	height_map_height_ = height;
+	height_map_scale_ = scale;
+}
+
+float ParticleCPU::terrain_height(float x, float z) const {
+	if(height_map_.empty()) return -std::numeric_limits<float>::infinity();
+
+	float fx = x / height_map_scale_;
+	float fz = z / height_map_scale_;
+	const float x0 = floorf(fx);
+	const float z0 = floorf(fz);
+	/* Written so NaN is outside too */
+	if(!(x0 >= 0.f && z0 >= 0.f && x0 < static_cast<float>(height_map_width_ - 1) && z0 < static_cast<float>(height_map_height_ - 1))) {
+		return -std::numeric_limits<float>::infinity();
+	}
+
+	fx -= x0;
+	fz -= z0;
+	const float * row = &height_map_[static_cast<size_t>(z0) * height_map_width_ + static_cast<size_t>(x0)];
+	const float h0 = row[0] + (row[1] - row[0]) * fx;
+	const float h1 = row[height_map_width_] + (row[height_map_width_ + 1] - row[height_map_width_]) * fx;
+	return h0 + (h1 - h0) * fz;
+}
+
+void ParticleCPU::push_dead(int id) {
+	dead_[id] = 1.f;
+	dead_indices_[dead_count_++] = id;
+}
+
+int ParticleCPU::spawn(const particle_config_t &config, int count, uint32_t seed, uint32_t frame) {
+	int spawned = 0;
+	for(; spawned < count && dead_count_ > 0; ++spawned) {
+		const int id = dead_indices_[--dead_count_];
+		random_t rnd(id, frame, seed, RANDOM_STREAM_SPAWN);
+
+		float area[3];
+		rnd.random3(config.spawn_area, false, area);
+		float x = config.spawn_position.x + area[0];
+		float y = config.spawn_position.y + area[1];
+		float z = config.spawn_position.z + area[2];
+
+		const float a = rnd.random1(2.f * PARTICLE_PI, false);
+		const float a2 = rnd.random1(2.f * PARTICLE_PI, false);
+		const float len = rnd.random1(config.spawn_area.w, false);
+		x += len * cosf(a);
+		y += len * sinf(a);
+		z += len * sinf(a) * cosf(a2);
+
+		position_[0][id] = x;
+		position_[1][id] = y;
+		position_[2][id] = z;
+		position_[3][id] = 0.f;
+		emitter_[id] = config.emitter;
+		texture_index_[id] = config.start_texture + static_cast<int>(floorf(rnd.random1(static_cast<float>(config.num_textures) - 0.1f, false)));
+
+		wind_influence_[id] = config.avg_wind_influence + rnd.random1(config.wind_influence_var, true);
+		gravity_influence_[id] = config.avg_gravity_influence + rnd.random1(config.gravity_influence_var, true);
+
+		float var[3];
+		rnd.random3(config.spawn_velocity_var, true, var);
+		float vx = config.avg_spawn_velocity.x + var[0];
+		float vy = config.avg_spawn_velocity.y + var[1];
+		float vz = config.avg_spawn_velocity.z + var[2];
+		const float vlen = sqrtf(vx*vx + vy*vy + vz*vz);
+		if(vlen > 0.f) {
+			vx /= vlen;
+			vy /= vlen;
+			vz /= vlen;
+		}
+		velocity_[0][id] = vx;
+		velocity_[1][id] = vy;
+		velocity_[2][id] = vz;
+
+		ttl_[id] = org_ttl_[id] = config.avg_ttl + rnd.random1(config.ttl_var, true);
+		rotation_speed_[id] = config.avg_rotation_speed + rnd.random1(config.rotation_speed_var, true);
+		initial_scale_[id] = config.avg_scale + rnd.random1(config.scale_var, true);
+		final_scale_[id] = initial_scale_[id] + config.avg_scale_change + rnd.random1(config.scale_change_var, true);
+
+		/* Move particles spawned below ground up, if there is no room above it run kills it at once */
+		const float ground = terrain_height(x, z);
+		if(y <= ground) {
+			const float top = config.spawn_position.y + config.spawn_area.y;
+			if(ground < top) {
+				position_[1][id] = ground + rnd.random1(top - ground, false);
+			} else {
+				ttl_[id] = 0.f;
+			}
+		}
+		dead_[id] = 0.f;
+	}
+	return spawned;
+}
+
+int ParticleCPU::run(const particle_config_t * configs, float dt, uint32_t seed, uint32_t frame, particle_vertex_t * vertices) {
+	std::atomic<int> num_vertices(0);
+	Threading::parallel_for(0, max_num_particles_, [&](int begin, int end) {
+		/* Compacted into the scratch range first, then copied in one go to the (write combined) output */
+		const int count = run_range(configs, dt, seed, frame, &scratch_[begin], begin, end);
+		if(count > 0) {
+			memcpy(vertices + num_vertices.fetch_add(count), &scratch_[begin], sizeof(particle_vertex_t) * count);
+		}
+	}, PARTICLE_CPU_GRAIN);
+	return num_vertices.load();
+}
+
+bool ParticleCPU::run_particle(const particle_config_t * configs, float dt, uint32_t seed, uint32_t frame, particle_vertex_t &vertex, int id) {
+	const particle_config_t &config = configs[emitter_[id]];
+	float * pos[4] = { &position_[0][id], &position_[1][id], &position_[2][id], &position_[3][id] };
+
+	bool alive = dead_[id] == 0.f;
+	if(alive) {
+		ttl_[id] -= dt;
+		for(int c = 0; c < 3; ++c) {
+			alive = alive && *pos[c] > config.bounds_min[c] && *pos[c] < config.bounds_max[c];
+		}
+		alive = alive && ttl_[id] > 0.f && *pos[1] > terrain_height(*pos[0], *pos[2]);
+
+		if(!alive) push_dead(id);
+	}
+
+	if(!alive) return false;
+
+	const float life_progression = 1.f - ttl_[id] / org_ttl_[id];
+	float motion[3];
+	random_t(id, frame, seed, RANDOM_STREAM_RUN).random3(config.motion_rand, true, motion);
+
+	for(int c = 0; c < 3; ++c) {
+		float v = velocity_[c][id];
+		v += config.gravity[c] * gravity_influence_[id] * dt;
+		v -= (v - config.wind_velocity[c]) * wind_influence_[id] * dt;
+		velocity_[c][id] = v;
+		*pos[c] += (v + motion[c]) * dt;
+	}
+	*pos[3] += rotation_speed_[id] * dt;
+
+	vertex.position = glm::vec4(*pos[0], *pos[1], *pos[2], *pos[3]);
+	vertex.color = config.birth_color + (config.death_color - config.birth_color) * life_progression;
+	vertex.scale = initial_scale_[id] + (final_scale_[id] - initial_scale_[id]) * life_progression;
+	vertex.texture_index = texture_index_[id];
+	return true;
+}
+
+int ParticleCPU::run_range(const particle_config_t * configs, float dt, uint32_t seed, uint32_t frame, particle_vertex_t * vertices, int begin, int end) {
+	int i = begin;
+	int count = 0;
+#if PARTICLE_SSE
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.f);
+	const __m128 dt4 = _mm_set1_ps(dt);
+
+	for(; i + 4 <= end; i += 4) {
+		const __m128 was_alive = _mm_cmpeq_ps(_mm_loadu_ps(&dead_[i]), zero);
+		const int alive_lanes = _mm_movemask_ps(was_alive);
+		if(alive_lanes == 0) continue;
+
+		/* Blocks with particles from different emitters take the scalar path */
+		int emitter = -1;
+		bool mixed = false;
+		for(int l = 0; l < 4; ++l) {
+			if(!(alive_lanes & (1 << l))) continue;
+			if(emitter < 0) emitter = emitter_[i + l];
+			mixed = mixed || emitter_[i + l] != emitter;
+		}
+		if(mixed) {
+			for(int l = 0; l < 4; ++l) {
+				if(run_particle(configs, dt, seed, frame, vertices[count], i + l)) ++count;
+			}
+			continue;
+		}
+		const particle_config_t &config = configs[emitter];
+
+		__m128 pos[4];
+		for(int c = 0; c < 4; ++c) pos[c] = _mm_loadu_ps(&position_[c][i]);
+
+		__m128 alive = was_alive;
+
+		const __m128 ttl = _mm_sub_ps(_mm_loadu_ps(&ttl_[i]), dt4);
+		_mm_storeu_ps(&ttl_[i], ttl);
+
+		alive = _mm_and_ps(alive, _mm_cmpgt_ps(ttl, zero));
+		for(int c = 0; c < 3; ++c) {
+			alive = _mm_and_ps(alive, _mm_cmpgt_ps(pos[c], _mm_set1_ps(config.bounds_min[c])));
+			alive = _mm_and_ps(alive, _mm_cmplt_ps(pos[c], _mm_set1_ps(config.bounds_max[c])));
+		}
+		if(!height_map_.empty()) {
+			float ground[4];
+			for(int l = 0; l < 4; ++l) ground[l] = terrain_height(position_[0][i + l], position_[2][i + l]);
+			alive = _mm_and_ps(alive, _mm_cmpgt_ps(pos[1], _mm_loadu_ps(ground)));
+		}
+
+		/* Same sequence per particle as run_particle */
+		float motion[3][4] = { { 0.f } };
+		const int live_lanes = _mm_movemask_ps(alive);
+		for(int l = 0; l < 4; ++l) {
+			if(!(live_lanes & (1 << l))) continue;
+			float m[3];
+			random_t(i + l, frame, seed, RANDOM_STREAM_RUN).random3(config.motion_rand, true, m);
+			for(int c = 0; c < 3; ++c) motion[c][l] = m[c];
+		}
+
+		const __m128 life = _mm_sub_ps(one, _mm_div_ps(ttl, _mm_loadu_ps(&org_ttl_[i])));
+		const __m128 gravity_dt = _mm_mul_ps(_mm_loadu_ps(&gravity_influence_[i]), dt4);
+		const __m128 wind_dt = _mm_mul_ps(_mm_loadu_ps(&wind_influence_[i]), dt4);
+
+		for(int c = 0; c < 3; ++c) {
+			const __m128 old_v = _mm_loadu_ps(&velocity_[c][i]);
+			__m128 v = _mm_add_ps(old_v, _mm_mul_ps(_mm_set1_ps(config.gravity[c]), gravity_dt));
+			v = _mm_sub_ps(v, _mm_mul_ps(_mm_sub_ps(v, _mm_set1_ps(config.wind_velocity[c])), wind_dt));
+			const __m128 p = _mm_add_ps(pos[c], _mm_mul_ps(_mm_add_ps(v, _mm_loadu_ps(motion[c])), dt4));
+
+			/* Leave dead particles as they were */
+			_mm_storeu_ps(&velocity_[c][i], _mm_or_ps(_mm_and_ps(alive, v), _mm_andnot_ps(alive, old_v)));
+			pos[c] = _mm_or_ps(_mm_and_ps(alive, p), _mm_andnot_ps(alive, pos[c]));
+			_mm_storeu_ps(&position_[c][i], pos[c]);
+		}
+		const __m128 rot = _mm_add_ps(pos[3], _mm_mul_ps(_mm_loadu_ps(&rotation_speed_[i]), dt4));
+		pos[3] = _mm_or_ps(_mm_and_ps(alive, rot), _mm_andnot_ps(alive, pos[3]));
+		_mm_storeu_ps(&position_[3][i], pos[3]);
+
+		__m128 color[4];
+		for(int c = 0; c < 4; ++c) {
+			const __m128 birth = _mm_set1_ps(config.birth_color[c]);
+			const __m128 death = _mm_set1_ps(config.death_color[c]);
+			color[c] = _mm_add_ps(birth, _mm_mul_ps(_mm_sub_ps(death, birth), life));
+		}
+
+		const __m128 initial = _mm_loadu_ps(&initial_scale_[i]);
+		const __m128 scale = _mm_add_ps(initial, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&final_scale_[i]), initial), life));
+
+		const int died = alive_lanes & ~live_lanes;
+		for(int l = 0; l < 4; ++l) {
+			if(died & (1 << l)) push_dead(i + l);
+		}
+		if(live_lanes == 0) continue;
+
+		/* SoA to the vertex layout */
+		_MM_TRANSPOSE4_PS(pos[0], pos[1], pos[2], pos[3]);
+		_MM_TRANSPOSE4_PS(color[0], color[1], color[2], color[3]);
+		float scales[4];
+		_mm_storeu_ps(scales, scale);
+
+		for(int l = 0; l < 4; ++l) {
+			if(!(live_lanes & (1 << l))) continue;
+			particle_vertex_t &vertex = vertices[count++];
+			_mm_storeu_ps(reinterpret_cast<float*>(&vertex.position), pos[l]);
+			_mm_storeu_ps(reinterpret_cast<float*>(&vertex.color), color[l]);
+			vertex.scale = scales[l];
+			vertex.texture_index = texture_index_[i + l];
+		}
+	}
+#endif
+
+	for(; i < end; ++i) {
+		if(run_particle(configs, dt, seed, frame, vertices[count], i)) ++count;
+	}
+	return count;
+}
@@ -0,0 +1,88 @@
+#ifndef PARTICLE_CPU_HPP
+#define PARTICLE_CPU_HPP
+
+#include "particle_types.hpp"
+
+#include <atomic>
+#include <stdint.h>
+#include <vector>
+
+/*
+ * CPU implementation of the run_particles and spawn_particles kernels in
+ * cl_programs/particles.cl, used when OpenCL with GL sharing is not available.
+ *
+ * The state is kept as structure of arrays so run can update four particles
+ * at a time with SSE, and the work is split over the Threading worker pool.
+ */
+class ParticleCPU {
+	public:
+		ParticleCPU(int max_num_particles);
+
+		/*
+		 * Spawn up to count dead particles with the given config, taken from
+		 * the dead index stack. Returns the number of particles spawned.
+		 *
+		 * Random numbers are keyed by particle id, frame and seed, as in the kernels.
+		 */
+		int spawn(const particle_config_t &config, int count, uint32_t seed, uint32_t frame);
+
+		/*
+		 * Advance all particles dt seconds and write the live ones contiguously
+		 * to vertices, returns the number of vertices written. Each particle uses
+		 * configs[emitter], with emitter from the config it was spawned with.
+		 * The order is not preserved between calls. vertices may be a mapped
+		 * GL buffer, it is only written to, sequentially.
+		 */
+		int run(const particle_config_t * configs, float dt, uint32_t seed, uint32_t frame, particle_vertex_t * vertices);
+
+		/*
+		 * Terrain the particles collide with, width * height heights in rows
+		 * along z, scale apart. Particles spawned below it are moved above
+		 * and particles hitting it die. The data is copied, nullptr removes it.
+		 */
+		void set_height_map(const float * height_map, int width, int height, float scale);
+
+		int max_num_particles() const;
+
+		/* Number of live particles */
+		int num_alive() const;
+
+	private:
+		const int max_num_particles_;
+
+		/* Per particle state */
+		std::vector<float> position_[4]; /* x, y, z, rotation */
+		std::vector<float> velocity_[3];
+		std::vector<float> ttl_;
+		std::vector<float> org_ttl_;
+		std::vector<float> rotation_speed_;
+		std::vector<float> initial_scale_;
+		std::vector<float> final_scale_;
+		std::vector<float> wind_influence_;
+		std::vector<float> gravity_influence_;
+		std::vector<float> dead_; /* 1.0 if dead, float so it can be used as a mask with the rest */
+		std::vector<int> texture_index_;
+		std::vector<int> emitter_;
+
+		/* Indices of the dead particles, run pushes the particles that die */
+		std::vector<int> dead_indices_;
+		std::atomic<int> dead_count_;
+
+		void push_dead(int id);
+
+		std::vector<float> height_map_;
+		int height_map_width_, height_map_height_;
+		float height_map_scale_;
+
+		/* Same as terrain_height in particles.cl, -inf outside the height map */
+		float terrain_height(float x, float z) const;
+
+		/* Scratch space for run_range, each range compacts into its own part */
+		std::vector<particle_vertex_t> scratch_;
+
+		/* Write the live particles of [begin, end) to vertices, returns the count */
+		int run_range(const particle_config_t * configs, float dt, uint32_t seed, uint32_t frame, particle_vertex_t * vertices, int begin, int end);
+		bool run_particle(const particle_config_t * configs, float dt, uint32_t seed, uint32_t frame, particle_vertex_t &vertex, int id);
+};
+
+#endif
@@ -3,12 +3,15 @@
 #endif
 
 #include "particle_system.hpp"
+#include "gl_state.hpp"
+#include "particle_cpu.hpp"
 #include "globals.hpp"
 #include "logging.hpp"
 #include "texture.hpp"
 
 #include <GL/glew.h>
 #include <glm/glm.hpp>
+#include <algorithm>
 #include <ctime>
 #include <memory>
 
@@ -16,21 +19,45 @@
 #include "globals.hpp"
 #include "utils.hpp"
 #include "aabb.hpp"
+#include "terrain.hpp"
+
+ParticleSystem::backend_t ParticleSystem::backend = ParticleSystem::BACKEND_OPENCL;
+ParticleSystem::layout_t ParticleSystem::layout = ParticleSystem::LAYOUT_AOS;
+
+/*
+ * Structure of arrays layout, see particles_soa in particles_structs.cl:
+ * four vec4 arrays followed by seven float and three int arrays.
+ */
+#define PARTICLE_SOA_BYTES (4 * sizeof(glm::vec4) + 7 * sizeof(cl_float) + 3 * sizeof(cl_int))
+#define PARTICLE_SOA_DEAD_OFFSET (4 * sizeof(glm::vec4) + 7 * sizeof(cl_float))
+
+/* Gives systems created in the same second different random streams */
+static uint32_t num_systems = 0;
 
 ParticleSystem::ParticleSystem(const int max_num_particles, const AABB &bounds, TextureArray* texture, bool _auto_spawn)
 	: avg_spawn_rate(static_cast<float>(max_num_particles)/10.f)
 	, spawn_rate_var(avg_spawn_rate/100.f)
 	, auto_spawn(_auto_spawn)
 	,	max_num_particles_(max_num_particles)
+	,	cpu_(nullptr)
+	,	seed_(static_cast<uint32_t>(time(0)) ^ (++num_systems * 0x9e3779b9u))
+	,	frame_(0)
+	,	write_(0)
+	,	config_dirty_(true)
+	,	configs_capacity_(4)
+	,	spawn_capacity_(4)
 	,	texture_(texture) {
 
-	program_ = CL::create_program("/cl_programs/particles.cl");
-	run_kernel_  = CL::load_kernel(program_, "run_particles");
-	spawn_kernel_  = CL::load_kernel(program_, "spawn_particles");
+	render_fence_[0] = render_fence_[1] = 0;
+	num_vertices_[0] = num_vertices_[1] = 0;
+
+	if(backend == BACKEND_CPU) {
+		cpu_ = new ParticleCPU(max_num_particles);
+	}
 
 	shader_ = Shader::create_shader("/shaders/particles");
 
-	Logging::verbose("Created particle system with %d particles\n", max_num_particles);
+	Logging::verbose("Created particle system with %d particles (%s)\n", max_num_particles, cpu_ ? "CPU" : (layout == LAYOUT_SOA ? "OpenCL, SoA" : "OpenCL"));
 
 	//Empty vec4s:
 
@@ -50,124 +77,199 @@ ParticleSystem::ParticleSystem(const int max_num_particles, const AABB &bounds,
 	}
 
 	//Create VBO's
-	glGenBuffers(1, &gl_buffer_);
-	checkForGLErrors("[ParticleSystem] Generate GL buffer");
+	glGenBuffers(2, gl_buffers_);
+	checkForGLErrors("[ParticleSystem] Generate GL buffers");
+
+	/* Set up the attributes once, rendering only binds the vertex array */
+	glGenVertexArrays(2, vaos_);
+
+	for(int i=0; i<2; ++i) {
+		GLState::bind_vertex_array(vaos_[i]);
+		GLState::bind_buffer(GL_ARRAY_BUFFER, gl_buffers_[i]);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_t)*buf_size, empty, GL_DYNAMIC_DRAW);
+		checkForGLErrors("[ParticleSystem] Buffer vertices");
+
+		for(int attr=0; attr<4; ++attr) {
+			glEnableVertexAttribArray(attr);
+		}
+		glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(vertex_t), 0);
+		glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(vertex_t), (GLvoid*) sizeof(glm::vec4));
+		glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(vertex_t), (GLvoid*) (2*sizeof(glm::vec4)));
+		glVertexAttribPointer(3, 1, GL_INT, GL_FALSE, sizeof(vertex_t), (GLvoid*)		(2*sizeof(glm::vec4)+sizeof(float)));
+	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, gl_buffer_);
+	GLState::bind_vertex_array(0);
+	GLState::bind_buffer(GL_ARRAY_BUFFER, 0);
+	checkForGLErrors("[ParticleSystem] Create vertex arrays");
 
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_t)*buf_size, empty, GL_DYNAMIC_DRAW);
+	delete[] empty;
 
-	checkForGLErrors("[ParticleSystem] Buffer vertices");
+	if(cpu_ == nullptr) {
+		init_cl();
+	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	//Set default values in config:
+	config = particle_config_defaults();
 
-	delete[] empty;
+	set_bounds(bounds);
 
-	particle_t * initial_particles = new particle_t[max_num_particles];
-	for(int i=0; i<max_num_particles; ++i) {
-		initial_particles[i].dead = 1; //mark as dead
+	config.num_textures = static_cast<unsigned int>(texture->num_textures());
+	config.max_num_particles = max_num_particles;
+	update_config();
+
+}
+
+ParticleSystem::~ParticleSystem() {
+	for(int i=0; i<2; ++i) {
+		wait_for_simulation(i);
+		if(render_fence_[i]) glDeleteSync(render_fence_[i]);
 	}
+	GLState::delete_vertex_arrays(2, vaos_);
+	GLState::delete_buffers(2, gl_buffers_);
+	delete cpu_;
+}
 
-	//Create cl buffers:
-	cl_gl_buffers_.push_back(CL::create_gl_buffer(CL_MEM_READ_WRITE , gl_buffer_));
+std::string ParticleSystem::program_options(layout_t layout) {
+	return layout == LAYOUT_SOA ? "-DPARTICLES_SOA" : "";
+}
+
+std::vector<char> ParticleSystem::initial_state(layout_t layout, int max_num_particles) {
+	const size_t n = static_cast<size_t>(max_num_particles);
+	std::vector<char> state;
+
+	if(layout == LAYOUT_SOA) {
+		state.assign(PARTICLE_SOA_BYTES * n, 0);
+		cl_int * dead = reinterpret_cast<cl_int*>(&state[PARTICLE_SOA_DEAD_OFFSET * n]);
+		for(size_t i=0; i<n; ++i) {
+			dead[i] = 1; //mark as dead
+		}
+	} else {
+		state.assign(sizeof(particle_t) * n, 0);
+		particle_t * particles = reinterpret_cast<particle_t*>(&state[0]);
+		for(size_t i=0; i<n; ++i) {
+			particles[i].dead = 1; //mark as dead
+		}
+	}
+
+	return state;
+}
+
+void ParticleSystem::init_cl() {
+	program_ = CL::create_program("/cl_programs/particles.cl", program_options(layout));
+	run_kernel_  = CL::load_kernel(program_, "run_particles");
+	spawn_kernel_  = CL::load_kernel(program_, "spawn_particles");
 
-	particles_ = CL::create_buffer(CL_MEM_READ_WRITE, sizeof(particle_t)*max_num_particles);
-	config_ = CL::create_buffer(CL_MEM_READ_ONLY, sizeof(config));
-	spawn_rate_  = CL::create_buffer(CL_MEM_READ_WRITE, sizeof(cl_int));
+	const std::vector<char> initial_particles = initial_state(layout, max_num_particles_);
 
-	random_ = CL::create_buffer(CL_MEM_READ_ONLY, sizeof(float)*max_num_particles);
+	//Create cl buffers:
+	for(int i=0; i<2; ++i) {
+		cl_gl_buffers_[i] = CL::create_gl_buffer(CL_MEM_WRITE_ONLY, gl_buffers_[i]);
+	}
 
-	Logging::verbose("  - Generating random numbers\n");
-	std::unique_ptr<float[]> rnd(new float[max_num_particles]);
-	for ( int i = 0; i < max_num_particles; ++i ) {
-		rnd[i] = frand();
+	particles_ = CL::create_buffer(CL_MEM_READ_WRITE, initial_particles.size());
+	configs_ = CL::create_buffer(CL_MEM_READ_ONLY, sizeof(config_t)*configs_capacity_);
+	spawn_configs_ = CL::create_buffer(CL_MEM_READ_ONLY, sizeof(config_t)*spawn_capacity_);
+	spawn_offsets_ = CL::create_buffer(CL_MEM_READ_ONLY, sizeof(cl_int)*(spawn_capacity_ + 1));
+	dead_indices_ = CL::create_buffer(CL_MEM_READ_WRITE, sizeof(cl_int)*max_num_particles_);
+	dead_count_ = CL::create_buffer(CL_MEM_READ_WRITE, sizeof(cl_int));
+	vertex_count_ = CL::create_buffer(CL_MEM_READ_WRITE, sizeof(cl_int));
+	height_map_ = CL::create_buffer(CL_MEM_READ_ONLY, sizeof(float));
+
+	//All particles start dead, popped from the back so the pool is used from the start
+	std::unique_ptr<cl_int[]> dead_indices(new cl_int[max_num_particles_]);
+	for(int i=0; i<max_num_particles_; ++i) {
+		dead_indices[i] = max_num_particles_ - 1 - i;
 	}
+	const cl_int dead_count = max_num_particles_;
 
-	cl::Event lock[2];
+	cl::Event lock[3];
 
-	cl_int err = CL::queue().enqueueWriteBuffer(particles_, CL_FALSE, 0, sizeof(particle_t)*max_num_particles, initial_particles, NULL, &lock[0]);
+	cl_int err = CL::queue().enqueueWriteBuffer(particles_, CL_FALSE, 0, initial_particles.size(), &initial_particles[0], NULL, &lock[0]);
 	CL::check_error(err, "[ParticleSystem] Write particles buffer");
-	err = CL::queue().enqueueWriteBuffer(random_, CL_FALSE, 0, sizeof(float)*max_num_particles, rnd.get(), NULL, &lock[1]);
-	CL::check_error(err, "[ParticleSystem] Write random data buffer");
+	err = CL::queue().enqueueWriteBuffer(dead_indices_, CL_FALSE, 0, sizeof(cl_int)*max_num_particles_, dead_indices.get(), NULL, &lock[1]);
+	CL::check_error(err, "[ParticleSystem] Write dead indices");
+	err = CL::queue().enqueueWriteBuffer(dead_count_, CL_FALSE, 0, sizeof(cl_int), &dead_count, NULL, &lock[2]);
+	CL::check_error(err, "[ParticleSystem] Write dead count");
 
 	CL::flush();
 
-	lock[0].wait();
-	lock[1].wait();
-
-	delete[] initial_particles;
+	for(cl::Event &e : lock) {
+		e.wait();
+	}
 
-	err = run_kernel_.setArg(0, cl_gl_buffers_[0]);
-	CL::check_error(err, "[ParticleSystem] run: Set arg 0");
 	err = run_kernel_.setArg(1, particles_);
 	CL::check_error(err, "[ParticleSystem] run: Set arg 1");
-	err = run_kernel_.setArg(2, config_);
+	err = run_kernel_.setArg(2, configs_);
 	CL::check_error(err, "[ParticleSystem] run: Set arg 2");
-	err = run_kernel_.setArg(3, random_);
+	err = run_kernel_.setArg(3, dead_indices_);
 	CL::check_error(err, "[ParticleSystem] run: Set arg 3");
-
-	err = spawn_kernel_.setArg(0, cl_gl_buffers_[0]);
+	err = run_kernel_.setArg(4, dead_count_);
+	CL::check_error(err, "[ParticleSystem] run: Set arg 4");
+	err = run_kernel_.setArg(5, vertex_count_);
+	CL::check_error(err, "[ParticleSystem] run: Set arg 5");
+	err = run_kernel_.setArg(7, seed_);
+	CL::check_error(err, "[ParticleSystem] run: Set arg 7");
+
+	err = spawn_kernel_.setArg(0, particles_);
 	CL::check_error(err, "[ParticleSystem] spawn: Set arg 0");
-	err = spawn_kernel_.setArg(1, particles_);
-	CL::check_error(err, "[ParticleSystem] spawn: Set arg 1");
-	err = spawn_kernel_.setArg(2, config_);
-	CL::check_error(err, "[ParticleSystem] spawn: Set arg 2");
-	err = spawn_kernel_.setArg(3, random_);
-	CL::check_error(err, "[ParticleSystem] spawn: Set arg 3");
-	err = spawn_kernel_.setArg(4, spawn_rate_);
+	err = spawn_kernel_.setArg(4, dead_indices_);
 	CL::check_error(err, "[ParticleSystem] spawn: Set arg 4");
+	err = spawn_kernel_.setArg(5, dead_count_);
+	CL::check_error(err, "[ParticleSystem] spawn: Set arg 5");
+	err = spawn_kernel_.setArg(6, seed_);
+	CL::check_error(err, "[ParticleSystem] spawn: Set arg 6");
 
-	//Set default values in config:
-
-	set_bounds(bounds);
-
-	config.birth_color = glm::vec4(0.f, 1.f, 1.f, 1.f);;
-	config.death_color = glm::vec4(1.f, 0.f, 0.f, 1.f);;
-
-	config.motion_rand = glm::vec4(0.f, 0.f, 0.f, 0.f);
-
-	config.avg_spawn_velocity = glm::vec4(1.f, 0.f, 0.f, 0.f);
-	config.spawn_velocity_var = glm::vec4(0.f, 0.3f, 0.3f,0.f);
-
-	config.spawn_position = glm::vec4(0.f, 0.f, 0.f, 0.f);
-	config.spawn_area = glm::vec4(1.0f, 1.0f, 1.f, 0);
-
-	config.wind_velocity = glm::vec4(0.f);
-	config.gravity = glm::vec4(0, -1.f, 0, 0);
-
-	//Time to live
-	config.avg_ttl = 2.0;
-	config.ttl_var = 1.0;
-
-	//Scale
-	config.avg_scale = 0.01f;
-	config.scale_var = 0.005f;
-	config.avg_scale_change = 0.f;
-	config.scale_change_var = 0.f;
+	set_height_map_args(glm::ivec2(0), 1.f);
+}
 
-	//Rotation
-	config.avg_rotation_speed = 0.f;
-	config.rotation_speed_var = 0.f;
+void ParticleSystem::set_height_map_args(const glm::ivec2 &size, float scale) {
+	cl_int2 cl_size;
+	cl_size.s[0] = size.x;
+	cl_size.s[1] = size.y;
+
+	cl_int err = run_kernel_.setArg(9, height_map_);
+	CL::check_error(err, "[ParticleSystem] run: Set arg 9");
+	err = run_kernel_.setArg(10, cl_size);
+	CL::check_error(err, "[ParticleSystem] run: Set arg 10");
+	err = run_kernel_.setArg(11, scale);
+	CL::check_error(err, "[ParticleSystem] run: Set arg 11");
+
+	err = spawn_kernel_.setArg(8, height_map_);
+	CL::check_error(err, "[ParticleSystem] spawn: Set arg 8");
+	err = spawn_kernel_.setArg(9, cl_size);
+	CL::check_error(err, "[ParticleSystem] spawn: Set arg 9");
+	err = spawn_kernel_.setArg(10, scale);
+	CL::check_error(err, "[ParticleSystem] spawn: Set arg 10");
+}
 
-	config.avg_wind_influence = 0.1f;
-	config.wind_influence_var = 0.f;
-	config.avg_gravity_influence = 0.5f;
-	config.gravity_influence_var = 0.f;
+void ParticleSystem::set_terrain(const Terrain * terrain) {
+	if(cpu_) {
+		if(terrain == nullptr) {
+			cpu_->set_height_map(nullptr, 0, 0, 1.f);
+		} else {
+			const glm::ivec2 &size = terrain->heightmap_size();
+			cpu_->set_height_map(terrain->height_map(), size.x, size.y, terrain->horizontal_scale());
+		}
+		return;
+	}
 
-	config.start_texture = 0;
-	config.num_textures = static_cast<unsigned int>(texture->num_textures());
-	config.max_num_particles = max_num_particles;
-	update_config();
+	if(terrain == nullptr) {
+		set_height_map_args(glm::ivec2(0), 1.f);
+		return;
+	}
 
-}
+	/* Old buffer is kept alive by the queue until commands using it are done */
+	const glm::ivec2 &size = terrain->heightmap_size();
+	const size_t bytes = sizeof(float) * size.x * size.y;
+	height_map_ = CL::create_buffer(CL_MEM_READ_ONLY, bytes);
+	cl_int err = CL::queue().enqueueWriteBuffer(height_map_, CL_TRUE, 0, bytes, terrain->height_map(), NULL, NULL);
+	CL::check_error(err, "[ParticleSystem] Write height map");
 
-ParticleSystem::~ParticleSystem() {
-	glDeleteBuffers(1, &gl_buffer_);
+	set_height_map_args(size, terrain->horizontal_scale());
 }
 
 void ParticleSystem::update_config() {
-	cl_int err = CL::queue().enqueueWriteBuffer(config_, CL_TRUE, 0, sizeof(config), &config, NULL, NULL);
-	CL::check_error(err, "[ParticleSystem] Write config");
+	config_dirty_ = true;
 }
 
 
@@ -176,179 +278,215 @@ void ParticleSystem::callback_position(const glm::vec3 &position) {
 	update_config();
 }
 
-void ParticleSystem::spawn_particles(cl_int count, cl::Event * event) {
-	cl_int err = CL::queue().enqueueWriteBuffer(spawn_rate_, CL_TRUE, 0, sizeof(cl_int), &count, NULL, NULL);
-	CL::check_error(err, "[ParticleSystem] spawn: Write spawn count");
-
-	//TODO: Optimize!
-	err = CL::queue().enqueueNDRangeKernel(spawn_kernel_, cl::NullRange, cl::NDRange(max_num_particles_), cl::NullRange, NULL, event);
-	CL::check_error(err, "[ParticleSystem] Execute spawn_kernel");
-}
-
-void ParticleSystem::update(float dt) {
-	cl_int err;
-
-	//Make sure opengl is done with our vbos
-	glFinish();
+void ParticleSystem::spawn_particles(const staging_t &staging) {
+	const cl_int total = staging.spawn_offsets.back();
+	if(total == 0) return;
 
-	std::vector<cl::Event> lock(1,cl::Event());
+	const size_t num_spawns = staging.spawn_configs.size();
+	if(num_spawns > spawn_capacity_) {
+		/* Old buffers are kept alive by the queue until commands using them are done */
+		while(spawn_capacity_ < num_spawns) spawn_capacity_ *= 2;
+		spawn_configs_ = CL::create_buffer(CL_MEM_READ_ONLY, sizeof(config_t)*spawn_capacity_);
+		spawn_offsets_ = CL::create_buffer(CL_MEM_READ_ONLY, sizeof(cl_int)*(spawn_capacity_ + 1));
+	}
 
-	err = CL::queue().enqueueAcquireGLObjects((std::vector<cl::Memory>*) &cl_gl_buffers_, NULL, &lock[0]);
-	CL::check_error(err, "[ParticleSystem] acquire gl objects");
+	cl_int err = CL::queue().enqueueWriteBuffer(spawn_configs_, CL_FALSE, 0, sizeof(config_t)*num_spawns, &staging.spawn_configs[0], NULL, NULL);
+	CL::check_error(err, "[ParticleSystem] spawn: Write configs");
+	err = CL::queue().enqueueWriteBuffer(spawn_offsets_, CL_FALSE, 0, sizeof(cl_int)*(num_spawns + 1), &staging.spawn_offsets[0], NULL, NULL);
+	CL::check_error(err, "[ParticleSystem] spawn: Write offsets");
 
-	err = spawn_kernel_.setArg(5, (int)(time(0)%UINT_MAX));
-	CL::check_error(err, "[ParticleSystem] spawn: set time");
+	err = spawn_kernel_.setArg(1, spawn_configs_);
+	CL::check_error(err, "[ParticleSystem] spawn: Set arg 1");
+	err = spawn_kernel_.setArg(2, spawn_offsets_);
+	CL::check_error(err, "[ParticleSystem] spawn: Set arg 2");
+	err = spawn_kernel_.setArg(3, (cl_int) num_spawns);
+	CL::check_error(err, "[ParticleSystem] spawn: Set arg 3");
+	err = spawn_kernel_.setArg(7, frame_);
+	CL::check_error(err, "[ParticleSystem] spawn: set frame");
 
-	CL::flush();
-	lock[0].wait(); //Wait to aquire gl objects
+	//One work item per particle, each pops a dead particle
+	err = CL::queue().enqueueNDRangeKernel(spawn_kernel_, cl::NullRange, cl::NDRange(std::min(total, max_num_particles_)), cl::NullRange, NULL, NULL);
+	CL::check_error(err, "[ParticleSystem] Execute spawn_kernel");
+}
 
-	bool restore_config = !spawn_list_.empty();
+void ParticleSystem::wait_for_render(int index) {
+	if(render_fence_[index] == 0) return;
 
-	/*
-	 * Handle spawning
-	 */
-	while(!spawn_list_.empty()) {
-		spawn_data &sd = spawn_list_.front();
-
-		cl_int err = CL::queue().enqueueWriteBuffer(config_, CL_TRUE, 0, sizeof(config_t), &sd.first, NULL, NULL);
-		CL::check_error(err, "[ParticleSystem] Write config");
+	while(glClientWaitSync(render_fence_[index], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED);
+	glDeleteSync(render_fence_[index]);
+	render_fence_[index] = 0;
+}
 
-		spawn_particles((cl_int) sd.second, &lock[0]);
+void ParticleSystem::wait_for_simulation(int index) {
+	if(simulated_[index]() == NULL) return;
 
-		spawn_list_.pop_front();
+	cl_int err = simulated_[index].wait();
+	CL::check_error(err, "[ParticleSystem] Wait for simulation");
+	simulated_[index] = cl::Event();
+}
 
-		CL::flush();
+ParticleSystem::config_t ParticleSystem::emitter_config(int id) const {
+	config_t c = (id == 0) ? config : emitters_[id - 1].config;
+	c.emitter = id;
+	c.max_num_particles = max_num_particles_;
+	return c;
+}
 
-		lock[0].wait();
+void ParticleSystem::prepare_staging(staging_t &staging, float dt) {
+	staging.configs.resize(emitters_.size() + 1);
+	for(size_t i=0; i<staging.configs.size(); ++i) {
+		staging.configs[i] = emitter_config(static_cast<int>(i));
 	}
 
-	if(restore_config) {
-		update_config();
+	staging.spawn_configs.clear();
+	staging.spawn_offsets.assign(1, 0);
+
+	for(const spawn_data &sd : spawn_list_) {
+		staging.spawn_configs.push_back(sd.first);
+		staging.spawn_offsets.push_back(staging.spawn_offsets.back() + std::max(sd.second, 0));
 	}
+	spawn_list_.clear();
 
 	if(auto_spawn) {
-		//Write number of particles to spawn this round:
-		cl_int current_spawn_rate = (cl_int) round((avg_spawn_rate + 2.f*frand()*spawn_rate_var - spawn_rate_var)*dt);
-		spawn_particles(current_spawn_rate, &lock[0]);
-		CL::flush();
-		lock[0].wait();
+		//Number of particles to spawn this round:
+		const cl_int current_spawn_rate = (cl_int) round((avg_spawn_rate + 2.f*frand()*spawn_rate_var - spawn_rate_var)*dt);
+		staging.spawn_configs.push_back(staging.configs[0]);
+		staging.spawn_offsets.push_back(staging.spawn_offsets.back() + std::max(current_spawn_rate, 0));
 	}
 
-
-	err = run_kernel_.setArg(4, dt);
-	CL::check_error(err, "[ParticleSystem] run: set dt");
-	err = run_kernel_.setArg(5, (int)(time(0)%UINT_MAX));
-	CL::check_error(err, "[ParticleSystem] run: set time");
-
-	err = CL::queue().enqueueNDRangeKernel(run_kernel_, cl::NullRange, cl::NDRange(max_num_particles_), cl::NullRange, NULL, &lock[0]);
-	CL::check_error(err, "[ParticleSystem] Execute run_kernel");
-
-	//render_blocking_events_.push_back(e2);
-/*
-	vertex_t * vertices = (vertex_t* ) CL::queue().enqueueMapBuffer(cl_gl_buffers_[0], CL_TRUE, CL_MAP_READ, 0, sizeof(particle_t)*max_num_particles_, NULL, NULL, &err);
-
-	CL::finish();
-	for(int i=0; i < max_num_particles_; ++i ) {
-		printf("Dir: (%f, %f, %f), ttl: (%f/%f) speed: (%f) scale(%f->%f) rotation speed: %f\n", particles[i].direction.x, particles[i].direction.y,particles[i].direction.z, particles[i].ttl, particles[i].org_ttl, particles[i].speed, particles[i].initial_scale, particles[i].final_scale, particles[i].rotation_speed);
+	for(size_t i=0; i<emitters_.size(); ++i) {
+		const cl_int count = (cl_int) round(emitters_[i].spawn_rate * dt);
+		if(count <= 0) continue;
+		staging.spawn_configs.push_back(staging.configs[i + 1]);
+		staging.spawn_offsets.push_back(staging.spawn_offsets.back() + count);
 	}
+}
 
+void ParticleSystem::update_cpu(float dt) {
+	staging_t &staging = staging_[write_];
+	prepare_staging(staging, dt);
 
-*/
-	/*
-	vertex_t * vertices = (vertex_t*) CL::queue().enqueueMapBuffer(cl_gl_buffers_[0], CL_TRUE, CL_MAP_READ, 0, sizeof(particle_t)*max_num_particles_, NULL, NULL, &err);
-
-	CL::finish();
-	printf("---\n");
-	for(int i=0;i<max_num_particles_; ++i) {
-		printf("Vertex: pos:(%f, %f, %f, %f), color:(%f, %f, %f, %f) scale: %f, texture_index: %i\n", vertices[i].position.x, vertices[i].position.y, vertices[i].position.z, vertices[i].position.w, vertices[i].color.r, vertices[i].color.g, vertices[i].color.b, vertices[i].color.a, vertices[i].scale, vertices[i].texture_index);
+	for(size_t i=0; i<staging.spawn_configs.size(); ++i) {
+		const int count = staging.spawn_offsets[i + 1] - staging.spawn_offsets[i];
+		cpu_->spawn(staging.spawn_configs[i], count, seed_, frame_);
 	}
-	CL::queue().enqueueUnmapMemObject(cl_gl_buffers_[0], vertices, NULL, NULL); */
 
-	err = CL::queue().enqueueReleaseGLObjects((std::vector<cl::Memory>*)&cl_gl_buffers_, &lock, NULL);
-	CL::check_error(err, "[ParticleSystem] Release GL objects");
+	/* All vertices are written, so the old contents need not be kept or synchronized */
+	GLState::bind_buffer(GL_ARRAY_BUFFER, gl_buffers_[write_]);
+	vertex_t * vertices = (vertex_t*) glMapBufferRange(GL_ARRAY_BUFFER, 0, sizeof(vertex_t)*max_num_particles_,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	checkForGLErrors("[ParticleSystem] Map vertices");
+
+	num_vertices_[write_] = 0;
+	if(vertices != nullptr) {
+		num_vertices_[write_] = cpu_->run(&staging.configs[0], dt, seed_, frame_, vertices);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		checkForGLErrors("[ParticleSystem] Unmap vertices");
+	}
 
-	CL::flush();
+	GLState::bind_buffer(GL_ARRAY_BUFFER, 0);
+}
 
-	//render_blocking_events_.push_back(e3);
+void ParticleSystem::update_cl(float dt) {
+	cl_int err;
 
+	/*
+	 * The staging memory was last used by the update before the previous one,
+	 * which render normally has waited for already.
+	 */
+	wait_for_simulation(write_);
+	staging_t &staging = staging_[write_];
+	prepare_staging(staging, dt);
 
-	//BEGIN DEBUG
+	std::vector<cl::Memory> gl_objects(1, cl_gl_buffers_[write_]);
+	err = CL::queue().enqueueAcquireGLObjects(&gl_objects, NULL, NULL);
+	CL::check_error(err, "[ParticleSystem] acquire gl objects");
 
-/*
-	particle_t * particles = (particle_t*) CL::queue().enqueueMapBuffer(particles_, CL_TRUE, CL_MAP_READ, 0, sizeof(particle_t)*max_num_particles_, NULL, NULL, &err);
+	if(staging.configs.size() > configs_capacity_) {
+		/* Old buffer is kept alive by the queue until commands using it are done */
+		while(configs_capacity_ < staging.configs.size()) configs_capacity_ *= 2;
+		configs_ = CL::create_buffer(CL_MEM_READ_ONLY, sizeof(config_t)*configs_capacity_);
+		err = run_kernel_.setArg(2, configs_);
+		CL::check_error(err, "[ParticleSystem] run: Set arg 2");
+		config_dirty_ = true;
+	}
 
-	CL::finish();
-	for(int i=0; i < max_num_particles_; ++i ) {
-		printf("Dir: (%f, %f, %f), ttl: (%f/%f) speed: (%f) scale(%f->%f) rotation speed: %f\n", particles[i].direction.x, particles[i].direction.y,particles[i].direction.z, particles[i].ttl, particles[i].org_ttl, particles[i].speed, particles[i].initial_scale, particles[i].final_scale, particles[i].rotation_speed);
+	if(config_dirty_) {
+		err = CL::queue().enqueueWriteBuffer(configs_, CL_FALSE, 0, sizeof(config_t)*staging.configs.size(), &staging.configs[0], NULL, NULL);
+		CL::check_error(err, "[ParticleSystem] Write configs");
+		config_dirty_ = false;
 	}
 
-	CL::queue().enqueueUnmapMemObject(particles_, particles, NULL, NULL);
-	*/
-/*
-	cl_int  * spawn_rate = (cl_int*) CL::queue().enqueueMapBuffer(spawn_rate_, CL_TRUE, CL_MAP_READ, 0, sizeof(cl_int), NULL, NULL, &err);
+	spawn_particles(staging);
 
-	CL::finish();
+	err = run_kernel_.setArg(0, cl_gl_buffers_[write_]);
+	CL::check_error(err, "[ParticleSystem] run: Set arg 0");
+	err = run_kernel_.setArg(6, dt);
+	CL::check_error(err, "[ParticleSystem] run: set dt");
+	err = run_kernel_.setArg(8, frame_);
+	CL::check_error(err, "[ParticleSystem] run: set frame");
 
-	printf("Spawn_rate: %d\n", *spawn_rate);
+	static const cl_int zero = 0;
+	err = CL::queue().enqueueWriteBuffer(vertex_count_, CL_FALSE, 0, sizeof(cl_int), &zero, NULL, NULL);
+	CL::check_error(err, "[ParticleSystem] Reset vertex count");
 
-	CL::queue().enqueueUnmapMemObject(spawn_rate_, spawn_rate, NULL, NULL);
+	err = CL::queue().enqueueNDRangeKernel(run_kernel_, cl::NullRange, cl::NDRange(max_num_particles_), cl::NullRange, NULL, NULL);
+	CL::check_error(err, "[ParticleSystem] Execute run_kernel");
 
-	CL::finish();*/
+	/* Done before the release below, which render waits for */
+	err = CL::queue().enqueueReadBuffer(vertex_count_, CL_FALSE, 0, sizeof(cl_int), &num_vertices_[write_], NULL, NULL);
+	CL::check_error(err, "[ParticleSystem] Read vertex count");
 
-	//END DEBUG
+	err = CL::queue().enqueueReleaseGLObjects(&gl_objects, NULL, &simulated_[write_]);
+	CL::check_error(err, "[ParticleSystem] Release GL objects");
 
-	CL::finish();
+	CL::flush();
 }
 
-void ParticleSystem::render(const glm::mat4&  m) {
-
-	shader_->bind();
-
-	Shader::push_vertex_attribs(4);
-
-	glPushAttrib(GL_ENABLE_BIT|GL_DEPTH_BUFFER_BIT);
+void ParticleSystem::update(float dt) {
+	/* GL may still be drawing the buffer from two frames ago */
+	wait_for_render(write_);
 
-	glDepthMask(GL_FALSE);
-	glDisable(GL_CULL_FACE);
+	/* Part of the random number counter, see particles_random.cl */
+	++frame_;
 
-	Shader::upload_model_matrix(matrix() * m);
+	if(cpu_) {
+		update_cpu(dt);
+	} else {
+		update_cl(dt);
+	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, gl_buffer_);
+	write_ = 1 - write_;
+}
 
-	//DEBUG
-/*
-	vertex_t * vertices = (vertex_t* )glMapBuffer(GL_ARRAY_BUFFER, GL_READ_ONLY);
+void ParticleSystem::render(const glm::mat4&  m) {
+	const int read = 1 - write_;
 
-	printf("---\n");
-	for(int i=0;i<max_num_particles_; ++i) {
-		printf("Vertex: pos:(%f, %f, %f, %f), color:(%f, %f, %f, %f) scale: %f, texture_index: %i\n", vertices[i].position.x, vertices[i].position.y, vertices[i].position.z, vertices[i].position.w, vertices[i].color.r, vertices[i].color.g, vertices[i].color.b, vertices[i].color.a, vertices[i].scale, vertices[i].texture_index);
-	}
+	/* Normally finished during the previous frame */
+	wait_for_simulation(read);
 
-	printf("Sizeof(vertex_t): %d\n", sizeof(vertex_t));
+	shader_->bind();
 
-	if(!glUnmapBuffer(GL_ARRAY_BUFFER)) {
-		printf("glUnmapBuffer returned False\n");
-		abort();
-	}
-	*/
+	const GLState::saved_t saved = GLState::save();
 
+	GLState::depth_mask(GL_FALSE);
+	GLState::disable(GL_CULL_FACE);
 
-	//END DEBUG
+	Shader::upload_model_matrix(matrix() * m);
 
-	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(vertex_t), 0);
-	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(vertex_t), (GLvoid*) sizeof(glm::vec4));
-	glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(vertex_t), (GLvoid*) (2*sizeof(glm::vec4)));
-	glVertexAttribPointer(3, 1, GL_INT, GL_FALSE, sizeof(vertex_t), (GLvoid*)		(2*sizeof(glm::vec4)+sizeof(float)));
+	GLState::bind_vertex_array(vaos_[read]);
 	texture_->texture_bind(Shader::TEXTURE_ARRAY_0);
 
-	glDrawArrays(GL_POINTS, 0, max_num_particles_);
+	/* Only the live particles, so dead ones cost no vertex or geometry shader work */
+	glDrawArrays(GL_POINTS, 0, num_vertices_[read]);
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	GLState::bind_vertex_array(0);
 
-	glPopAttrib();
-
-	Shader::pop_vertex_attribs();
+	/* The next update writing to this buffer waits for this */
+	if(render_fence_[read]) glDeleteSync(render_fence_[read]);
+	render_fence_[read] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 
+	GLState::restore(saved);
 }
 
 void ParticleSystem::push_config() {
@@ -361,12 +499,33 @@ void ParticleSystem::pop_config() {
 }
 
 void ParticleSystem::spawn(int count) {
+	spawn(0, count);
+}
+
+void ParticleSystem::spawn(int emitter, int count) {
 	spawn_data sd;
-	sd.first = config;
+	sd.first = emitter_config(emitter);
 	sd.second = count;
 	spawn_list_.push_back(sd);
 }
 
+int ParticleSystem::add_emitter(const config_t &config, float spawn_rate) {
+	emitter_t e;
+	e.config = config;
+	e.spawn_rate = spawn_rate;
+	emitters_.push_back(e);
+	update_config();
+	return static_cast<int>(emitters_.size());
+}
+
+ParticleSystem::emitter_t &ParticleSystem::emitter(int id) {
+	return emitters_[id - 1];
+}
+
+int ParticleSystem::num_emitters() const {
+	return static_cast<int>(emitters_.size()) + 1;
+}
+
 void ParticleSystem::read_config(const ConfigEntry * cfg) {
 	config.spawn_position = glm::vec4(cfg->find("spawn_position", true)->as_vec3(), 1.f);
 	config.spawn_area = cfg->find("spawn_area", true)->as_vec4();
@@ -5,84 +5,81 @@
 #include "movable_object.hpp"
 #include "cl.hpp"
 #include "config.hpp"
+#include "particle_types.hpp"
 #include <glm/glm.hpp>
 #include <list>
+#include <stdint.h>
+#include <string>
 #include <utility>
+#include <vector>
+
+class ParticleCPU;
+class Terrain;
 
 class ParticleSystem : public MovableObject {
 	public:
+		enum backend_t {
+			BACKEND_OPENCL,
+			BACKEND_CPU, /* Used when OpenCL with GL sharing is not available */
+		};
+
+		/* Backend used by new particle systems */
+		static backend_t backend;
+
+		/*
+		 * Layout of the OpenCL simulation state, see particles_structs.cl.
+		 * With LAYOUT_SOA each field is a separate array, so the kernels only
+		 * read the fields they use. The vertex buffer is the same for both.
+		 */
+		enum layout_t {
+			LAYOUT_AOS,
+			LAYOUT_SOA,
+		};
+
+		/* Layout used by new particle systems */
+		static layout_t layout;
+
+		/* Build options for cl_programs/particles.cl */
+		static std::string program_options(layout_t layout);
+
+		/* Simulation state with all particles dead, to upload to the device */
+		static std::vector<char> initial_state(layout_t layout, int max_num_particles);
 
 		ParticleSystem(const int max_num_particles, const AABB &bounds, TextureArray* texture, bool _auto_spawn = true);
 		~ParticleSystem();
 
+		/*
+		 * Simulate into one vertex buffer while render draws the other one,
+		 * so what is rendered is one update behind. Nothing here waits for
+		 * the GPU unless it is more than a frame behind.
+		 */
 		void update(float dt);
 		void render(const glm::mat4& m = glm::mat4());
 
+		/* The config is uploaded with the next update */
 		void update_config();
 
 		//Change values in this struct and call update_config() to update
-		struct __ALIGNED__(16) config_t {
-
-				glm::vec4 spawn_position;
-				glm::vec4 spawn_area; //The last component specifies radius (will be added to the position with a random angle)
-
-				glm::vec4 birth_color;
-
-				glm::vec4 death_color;
-
-				glm::vec4 motion_rand;
-
-				glm::vec4 avg_spawn_velocity;
-
-				glm::vec4 spawn_velocity_var;
-
-				glm::vec4 wind_velocity;	//Speed
-				glm::vec4 gravity;			//Acceleration
-
-				glm::vec4 bounds_min;
-				glm::vec4 bounds_max;
-
-				//Time to live
-				cl_float avg_ttl;
-				cl_float ttl_var;
-				//Scale
-				cl_float avg_scale;
-				cl_float scale_var;
-
-				cl_float avg_scale_change;
-				cl_float scale_change_var;
-				//Rotation
-				cl_float avg_rotation_speed;
-				cl_float rotation_speed_var;
-
-				cl_float avg_wind_influence;
-				cl_float wind_influence_var;
-				cl_float avg_gravity_influence;
-				cl_float gravity_influence_var;
-
-				//Texture is choosen between start and start+num
-				cl_int start_texture;
-				cl_int num_textures;
-				//Should not be manually changed!
-				cl_int max_num_particles;
-
-		} config;
+		typedef particle_config_t config_t;
+		config_t config;
 
 		float avg_spawn_rate; //Number of particles to spawn per second
 		float spawn_rate_var;
 		bool auto_spawn;
 
-		struct __ALIGNED__(16) vertex_t {
-			glm::vec4 position;
-			glm::vec4 color;
-			cl_float scale;
-			cl_int texture_index;
-		};
+		typedef particle_vertex_t vertex_t;
 
 		virtual void callback_position(const glm::vec3 &position);
 
 		void set_bounds(const AABB &bounds);
 
+		/*
+		 * Particles spawned below the terrain are moved above it (or not spawned
+		 * if the spawn area is below ground), and particles hitting it die.
+		 * The height map is copied, call again if it changes. nullptr removes it.
+		 */
+		void set_terrain(const Terrain * terrain);
+
 		void push_config();
 		void pop_config();
 
@@ -91,25 +88,97 @@ class ParticleSystem : public MovableObject {
 		 */
 		void spawn(int count);
 
+		/*
+		 * Additional emitters share the particle pool, the kernel dispatches
+		 * and the draw call with the main one (config, avg_spawn_rate), which
+		 * is emitter 0. Their textures are ranges of the same TextureArray,
+		 * selected with start_texture and num_textures in the config.
+		 * Changes to an emitter config are uploaded after update_config().
+		 */
+		struct emitter_t {
+			config_t config;
+			float spawn_rate; //Number of particles to spawn per second
+		};
+
+		/* Returns the id of the new emitter */
+		int add_emitter(const config_t &config, float spawn_rate = 0.f);
+		emitter_t &emitter(int id); /* id > 0 */
+		int num_emitters() const;   /* Including emitter 0 */
+
+		/* Spawn count particles with the current config of an emitter */
+		void spawn(int emitter, int count);
+
 		void read_config(const ConfigEntry * config);
 	private:
 
+		/* Host memory for the non-blocking writes, one set per vertex buffer */
+		struct staging_t {
+			std::vector<config_t> configs; /* One per emitter */
+			std::vector<config_t> spawn_configs;
+			std::vector<cl_int> spawn_offsets; /* Prefix summed counts, one more than spawn_configs */
+		};
+
 		/**
-		 * Internal function for spawning count particles now
-		 * event is set to the event for the execution
+		 * Internal function for enqueueing all spawn requests of a frame
+		 * in a single dispatch
 		 */
-		void spawn_particles(cl_int count,cl::Event * event);
+		void spawn_particles(const staging_t &staging);
+
+		/* Emitter configs and the spawn requests (including auto spawn) for this update */
+		void prepare_staging(staging_t &staging, float dt);
+
+		/* Config of an emitter with emitter and max_num_particles filled in */
+		config_t emitter_config(int id) const;
+
+		void init_cl();
+		void update_cl(float dt);
+		void update_cpu(float dt);
+
+		/* Block until the last draw from / simulation into vertex buffer index is done */
+		void wait_for_render(int index);
+		void wait_for_simulation(int index);
 
 		const int max_num_particles_;
 
+		ParticleCPU * cpu_; /* nullptr when using OpenCL */
+		uint32_t seed_;  /* Random number key, fixed for the lifetime of the system */
+		uint32_t frame_; /* Random number counter, incremented every update */
+
 
 		//Texture * texture_;
 
-		// Buffer 0: position buffer 1: color.
-		// Both are set in the opencl-kernel
-		GLuint gl_buffer_;
-		std::vector<cl::BufferGL> cl_gl_buffers_;
-		cl::Buffer particles_, config_, random_, spawn_rate_;
+		// Vertex buffers, written by the simulation every update. write_ is the
+		// one the next update writes to, render draws the other one.
+		GLuint gl_buffers_[2];
+		GLuint vaos_[2]; /* Attribute setup for each vertex buffer */
+		cl::BufferGL cl_gl_buffers_[2];
+		int write_;
+
+		/* Live particles are compacted to the start of the vertex buffer, this many */
+		cl_int num_vertices_[2];
+		cl::Buffer vertex_count_; /* Counter for run_particles, read back to num_vertices_ */
+
+		GLsync render_fence_[2];     /* Set after drawing the buffer */
+		cl::Event simulated_[2];     /* Release of the buffer after simulating */
+
+		staging_t staging_[2];
+		bool config_dirty_;
+
+		std::vector<emitter_t> emitters_; /* Emitter 1 and up */
+
+		cl::Buffer particles_;
+		cl::Buffer configs_;
+		size_t configs_capacity_;
+
+		cl::Buffer spawn_configs_, spawn_offsets_;
+		size_t spawn_capacity_;
+
+		/* Stack of dead particle indices, pushed by run_particles and popped by spawn_particles */
+		cl::Buffer dead_indices_, dead_count_;
+
+		/* Terrain heights, a single unused float when there is no terrain */
+		cl::Buffer height_map_;
+		void set_height_map_args(const glm::ivec2 &size, float scale);
 
 		cl::Program program_;
 		cl::Kernel run_kernel_, spawn_kernel_;
@@ -117,6 +186,7 @@ class ParticleSystem : public MovableObject {
 		Shader * shader_;
 
 		struct __ALIGNED__(16) particle_t {
+				glm::vec4 position; //w is rotation
 				glm::vec4 velocity;
 
 				cl_float ttl;
@@ -131,6 +201,9 @@ class ParticleSystem : public MovableObject {
 
 				glm::vec4 birth_color;
 				glm::vec4 death_color;
+
+				cl_int texture_index;
+				cl_int emitter;
 		};
 
 		TextureArray* texture_;
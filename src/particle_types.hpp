@@ -0,0 +1,118 @@
+#ifndef PARTICLE_TYPES_HPP
+#define PARTICLE_TYPES_HPP
+
+#include "platform.hpp"
+#include <glm/glm.hpp>
+
+/*
+ * Structures shared by the particle backends. The layout must match
+ * config_t and vertex_t in cl_programs/particles_structs.cl.
+ */
+
+struct __ALIGNED__(16) particle_config_t {
+
+		glm::vec4 spawn_position;
+		glm::vec4 spawn_area; //The last component specifies radius (will be added to the position with a random angle)
+
+		glm::vec4 birth_color;
+
+		glm::vec4 death_color;
+
+		glm::vec4 motion_rand;
+
+		glm::vec4 avg_spawn_velocity;
+
+		glm::vec4 spawn_velocity_var;
+
+		glm::vec4 wind_velocity;	//Speed
+		glm::vec4 gravity;			//Acceleration
+
+		glm::vec4 bounds_min;
+		glm::vec4 bounds_max;
+
+		//Time to live
+		float avg_ttl;
+		float ttl_var;
+		//Scale
+		float avg_scale;
+		float scale_var;
+
+		float avg_scale_change;
+		float scale_change_var;
+		//Rotation
+		float avg_rotation_speed;
+		float rotation_speed_var;
+
+		float avg_wind_influence;
+		float wind_influence_var;
+		float avg_gravity_influence;
+		float gravity_influence_var;
+
+		//Texture is choosen between start and start+num
+		int start_texture;
+		int num_textures;
+		//Should not be manually changed!
+		int max_num_particles;
+		int emitter; //Index in the emitter list of the particle system
+
+};
+
+/*
+ * Default particle settings, a slow falling cloud that lives for about two
+ * seconds. Bounds and max_num_particles are left for the caller.
+ */
+inline particle_config_t particle_config_defaults() {
+	particle_config_t c;
+
+	c.spawn_position = glm::vec4(0.f, 0.f, 0.f, 0.f);
+	c.spawn_area = glm::vec4(1.0f, 1.0f, 1.f, 0);
+
+	c.birth_color = glm::vec4(0.f, 1.f, 1.f, 1.f);
+	c.death_color = glm::vec4(1.f, 0.f, 0.f, 1.f);
+
+	c.motion_rand = glm::vec4(0.f, 0.f, 0.f, 0.f);
+
+	c.avg_spawn_velocity = glm::vec4(1.f, 0.f, 0.f, 0.f);
+	c.spawn_velocity_var = glm::vec4(0.f, 0.3f, 0.3f,0.f);
+
+	c.wind_velocity = glm::vec4(0.f);
+	c.gravity = glm::vec4(0, -1.f, 0, 0);
+
+	c.bounds_min = glm::vec4(0.f);
+	c.bounds_max = glm::vec4(0.f);
+
+	//Time to live
+	c.avg_ttl = 2.0;
+	c.ttl_var = 1.0;
+
+	//Scale
+	c.avg_scale = 0.01f;
+	c.scale_var = 0.005f;
+	c.avg_scale_change = 0.f;
+	c.scale_change_var = 0.f;
+
+	//Rotation
+	c.avg_rotation_speed = 0.f;
+	c.rotation_speed_var = 0.f;
+
+	c.avg_wind_influence = 0.1f;
+	c.wind_influence_var = 0.f;
+	c.avg_gravity_influence = 0.5f;
+	c.gravity_influence_var = 0.f;
+
+	c.start_texture = 0;
+	c.num_textures = 1;
+	c.max_num_particles = 0;
+	c.emitter = 0;
+
+	return c;
+}
+
+struct __ALIGNED__(16) particle_vertex_t {
+	glm::vec4 position; //w is rotation
+	glm::vec4 color;
+	float scale;
+	int texture_index;
+};
+
+#endif
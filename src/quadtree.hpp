@@ -1,10 +1,14 @@
 #ifndef QUADTREE_HPP
+#define QUADTREE_HPP
 
 #include <functional>
 #include <glm/glm.hpp>
 
 #include "aabb2d.hpp"
 
+/* Deepest tree visit_iterative handles without falling back to recursion */
+#define QUADTREE_MAX_DEPTH 32
+
 /*
  * This is actually just a node in a quad tree, but
  * the first node is the root of the tree
@@ -25,6 +29,45 @@ class QuadTree {
 		 */
 		void traverse(const std::function<bool(QuadTree*)> & func);
 
+		/*
+		 * Same as traverse, but the visitor type is known at compile time so
+		 * the call can be inlined. Use this in per frame code.
+		 * visitor(QuadTree*) returns true to continue down the branch.
+		 */
+		template <class Visitor>
+		void visit(Visitor && visitor) {
+			if(visitor(this)) {
+				for(int i=0; i<4; ++i) {
+					if(children[i] != nullptr) children[i]->visit(visitor);
+				}
+			}
+		}
+
+		/*
+		 * Same as visit, but iterative with an explicit stack instead of recursion.
+		 * Nodes are visited in the same order.
+		 */
+		template <class Visitor>
+		void visit_iterative(Visitor && visitor) {
+			/* Each level down adds at most 3 pending siblings */
+			QuadTree * stack[3 * QUADTREE_MAX_DEPTH + 1];
+			if(level_ >= QUADTREE_MAX_DEPTH) {
+				visit(visitor);
+				return;
+			}
+
+			int top = 0;
+			stack[top++] = this;
+			while(top > 0) {
+				QuadTree * node = stack[--top];
+				if(visitor(node)) {
+					for(int i=3; i>=0; --i) {
+						if(node->children[i] != nullptr) stack[top++] = node->children[i];
+					}
+				}
+			}
+		}
+
 		/*
 		 * Finds or allocates child that contain the given position, 
 		 * if the position is in this quad tree a quadtree ptr will be returned
@@ -3,6 +3,7 @@
 #endif
 
 #include "platform.hpp"
+#include "gl_state.hpp"
 #include "render_object.hpp"
 #include "engine.hpp"
 #include "globals.hpp"
@@ -298,14 +299,14 @@ void RenderObject::recursive_pre_render(const aiNode* node) {
 
 		glGenBuffers(1, &md.vb);
 
-		glBindBuffer(GL_ARRAY_BUFFER, md.vb);
+		GLState::bind_buffer(GL_ARRAY_BUFFER, md.vb);
 		glBufferData(GL_ARRAY_BUFFER, sizeof(Shader::vertex_t)*vertexData.size(), &vertexData.front(), GL_STATIC_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		GLState::bind_buffer(GL_ARRAY_BUFFER, 0);
 
 		glGenBuffers(1, &md.ib);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, md.ib);
+		GLState::bind_buffer(GL_ELEMENT_ARRAY_BUFFER, md.ib);
 		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int)*indexData.size(), &indexData.front(), GL_STATIC_DRAW);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		GLState::bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
 		mesh_data[mesh] = md;
 	}
@@ -334,8 +335,8 @@ void RenderObject::recursive_render(const aiNode* node,
 		if(mesh->mNumFaces > 0) {
 			mesh_data_t *md = &mesh_data[mesh];
 
-			glBindBuffer(GL_ARRAY_BUFFER, md->vb);
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, md->ib);
+			GLState::bind_buffer(GL_ARRAY_BUFFER, md->vb);
+			GLState::bind_buffer(GL_ELEMENT_ARRAY_BUFFER, md->ib);
 
 			glVertexAttribPointer(Shader::ATTR_POSITION,  3, GL_FLOAT, GL_FALSE, sizeof(Shader::vertex_t), (const GLvoid*)offsetof(Shader::vertex_t, pos));
 			glVertexAttribPointer(Shader::ATTR_TEXCOORD,  2, GL_FLOAT, GL_FALSE, sizeof(Shader::vertex_t), (const GLvoid*)offsetof(Shader::vertex_t, uv));
@@ -352,8 +353,8 @@ void RenderObject::recursive_render(const aiNode* node,
 			glDrawElements(GL_TRIANGLES, md->num_indices, GL_UNSIGNED_INT,0 );
 			checkForGLErrors("Draw material");
 
-			glBindBuffer(GL_ARRAY_BUFFER, 0);
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+			GLState::bind_buffer(GL_ARRAY_BUFFER, 0);
+			GLState::bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 			checkForGLErrors("Model post");
 		}
 	}
@@ -4,6 +4,7 @@
 
 #include "rendertarget.hpp"
 #include "engine.hpp"
+#include "gl_state.hpp"
 #include "globals.hpp"
 #include "logging.hpp"
 #include "utils.hpp"
@@ -12,6 +13,7 @@
 #include <cstdio>
 
 RenderTarget* RenderTarget::stack = nullptr;
+static GLState::saved_viewport_t saved_viewport; /* Restored by unbind */
 GLuint RenderTarget::vbo[2] = {0,0};
 
 RenderTarget::RenderTarget(const glm::ivec2& size, GLenum format, int flags, GLenum filter) throw()
@@ -45,7 +47,7 @@ RenderTarget::RenderTarget(const glm::ivec2& size, GLenum format, int flags, GLe
 	glGenTextures(color_buffers, color);
 	glGenTextures(1, &depth);
 
-	glBindFramebuffer(GL_FRAMEBUFFER, id);
+	GLState::bind_framebuffer(id);
 	Engine::setup_opengl();
 
 	/* enable doublebuffering */
@@ -55,7 +57,7 @@ RenderTarget::RenderTarget(const glm::ivec2& size, GLenum format, int flags, GLe
 
 	/* bind color buffers */
 	for ( unsigned int i = 0; i < max; i++ ){
-		glBindTexture(GL_TEXTURE_2D, color[i]);
+		GLState::bind_texture(GL_TEXTURE_2D, color[i]);
 		glTexImage2D(GL_TEXTURE_2D, 0, format, size.x, size.y, 0, format == GL_RGB8 ? GL_RGB : GL_RGBA, GL_UNSIGNED_INT, NULL);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -67,7 +69,7 @@ RenderTarget::RenderTarget(const glm::ivec2& size, GLenum format, int flags, GLe
 
 	/* bind depth buffer */
 	if ( flags & DEPTH_BUFFER ){
-		glBindTexture(GL_TEXTURE_2D, depth);
+		GLState::bind_texture(GL_TEXTURE_2D, depth);
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, size.x, size.y, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_BYTE, NULL);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -114,7 +116,7 @@ RenderTarget::RenderTarget(const glm::ivec2& size, GLenum format, int flags, GLe
 		}
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	GLState::bind_framebuffer(0);
 	checkForGLErrors("RenderTarget() fin");
 
 	with([this](){
@@ -123,9 +125,9 @@ RenderTarget::RenderTarget(const glm::ivec2& size, GLenum format, int flags, GLe
 }
 
 RenderTarget::~RenderTarget(){
-	glDeleteFramebuffers(1, &id);
-	glDeleteTextures(color_buffers, color);
-	glDeleteTextures(1, &depth);
+	GLState::delete_framebuffers(1, &id);
+	GLState::delete_textures(color_buffers, color);
+	GLState::delete_textures(1, &depth);
 }
 
 RenderTarget* RenderTarget::MRT(unsigned int targets){
@@ -145,16 +147,16 @@ RenderTarget* RenderTarget::MRT(unsigned int targets){
 	}
 
 	/* generate new textures */
-	glDeleteTextures(color_buffers, color);
+	GLState::delete_textures(color_buffers, color);
 	glGenTextures(targets, color);
 	color_buffers = targets;
 
-	glBindFramebuffer(GL_FRAMEBUFFER, id);
+	GLState::bind_framebuffer(id);
 	glDrawBuffers(targets, mrt);
 
 	/* bind color buffers */
 	for ( unsigned int i = 0; i < color_buffers; i++ ){
-		glBindTexture(GL_TEXTURE_2D, color[i]);
+		GLState::bind_texture(GL_TEXTURE_2D, color[i]);
 		glTexImage2D(GL_TEXTURE_2D, 0, format, size.x, size.y, 0, format == GL_RGB8 ? GL_RGB : GL_RGBA, GL_UNSIGNED_INT, NULL);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -165,7 +167,7 @@ RenderTarget* RenderTarget::MRT(unsigned int targets){
 		checkForGLErrors("glFramebufferTexture2D::color");
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	GLState::bind_framebuffer(0);
 	return this;
 }
 
@@ -187,12 +189,12 @@ void RenderTarget::init_vbo(){
 	glGenBuffers(2, vbo);
 
 	/* upload data */
-	glBindBuffer(GL_ARRAY_BUFFER, vbo[0]);
+	GLState::bind_buffer(GL_ARRAY_BUFFER, vbo[0]);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo[1]);
+	GLState::bind_buffer(GL_ARRAY_BUFFER, 0);
+	GLState::bind_buffer(GL_ELEMENT_ARRAY_BUFFER, vbo[1]);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	GLState::bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
 void RenderTarget::bind(){
@@ -200,9 +202,9 @@ void RenderTarget::bind(){
 		Logging::fatal("Nesting problem with RenderTarget, another target already bound.\n");
 	}
 
-	glPushAttrib(GL_VIEWPORT_BIT);
-	glViewport(0, 0, size.x, size.y);
-	glBindFramebuffer(GL_FRAMEBUFFER, id);
+	saved_viewport = GLState::save_viewport();
+	GLState::viewport(0, 0, size.x, size.y);
+	GLState::bind_framebuffer(id);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color[back], 0);
 
 	stack = this;
@@ -215,8 +217,8 @@ void RenderTarget::unbind(){
 
 	front = back;
 	back = (back + 1) % max;
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glPopAttrib();
+	GLState::bind_framebuffer(0);
+	GLState::restore_viewport(saved_viewport);
 	stack = nullptr;
 }
 
@@ -239,8 +241,8 @@ const glm::mat4& RenderTarget::ortho() const {
 }
 
 void RenderTarget::texture_bind(Shader::TextureUnit unit, unsigned int target) const {
-	glActiveTexture(unit);
-	glBindTexture(GL_TEXTURE_2D, texture(target));
+	GLState::active_texture(unit);
+	GLState::bind_texture(GL_TEXTURE_2D, texture(target));
 }
 
 void RenderTarget::texture_bind(Shader::TextureUnit unit) const {
@@ -248,16 +250,16 @@ void RenderTarget::texture_bind(Shader::TextureUnit unit) const {
 }
 
 void RenderTarget::texture_unbind() const {
-	glBindTexture(GL_TEXTURE_2D, 0);
+	GLState::bind_texture(GL_TEXTURE_2D, 0);
 }
 
 void RenderTarget::depth_bind(Shader::TextureUnit unit) const {
-	glActiveTexture(unit);
-	glBindTexture(GL_TEXTURE_2D, depthbuffer());
+	GLState::active_texture(unit);
+	GLState::bind_texture(GL_TEXTURE_2D, depthbuffer());
 }
 
 void RenderTarget::depth_unbind() const {
-	glBindTexture(GL_TEXTURE_2D, 0);
+	GLState::bind_texture(GL_TEXTURE_2D, 0);
 }
 
 void RenderTarget::clear(const Color& color){
@@ -303,8 +305,8 @@ void RenderTarget::draw(const Shader* shader, const glm::vec2& pos, const glm::v
 		depth_bind(Shader::TEXTURE_DEPTHMAP);
 	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, vbo[0]);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo[1]);
+	GLState::bind_buffer(GL_ARRAY_BUFFER, vbo[0]);
+	GLState::bind_buffer(GL_ELEMENT_ARRAY_BUFFER, vbo[1]);
 
 	glVertexAttribPointer(Shader::ATTR_POSITION,  3, GL_FLOAT, GL_FALSE, sizeof(Shader::vertex_t), (const GLvoid*)offsetof(Shader::vertex_t, pos));
 	glVertexAttribPointer(Shader::ATTR_TEXCOORD,  2, GL_FLOAT, GL_FALSE, sizeof(Shader::vertex_t), (const GLvoid*)offsetof(Shader::vertex_t, uv));
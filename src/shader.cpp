@@ -3,6 +3,8 @@
 #endif
 
 #include "shader.hpp"
+#include "cache.hpp"
+#include "gl_state.hpp"
 #include "globals.hpp"
 #include "light.hpp"
 #include "logging.hpp"
@@ -21,6 +23,7 @@
 #include <vector>
 #include <map>
 #include <cassert>
+#include <cmath>
 #include <memory>
 
 #include <GL/glew.h>
@@ -61,6 +64,29 @@ static const struct UBO ubo[Shader::NUM_GLOBAL_UNIFORMS] = {
 };
 
 static GLuint global_uniform_buffers_[Shader::NUM_GLOBAL_UNIFORMS];
+
+/*
+ * Uniform ring. With GL_ARB_buffer_storage every upload is written to a
+ * persistently mapped buffer and bound with glBindBufferRange instead of
+ * calling glBufferSubData on the buffers above, which makes the driver sync
+ * or orphan on every draw. The ring has one region per frame in flight and a
+ * fence keeps a region from being reused while the GPU may still read it.
+ *
+ * Uniforms that are not uploaded every frame (e.g. fog) would still point
+ * into an old region, so the last data of each is copied to the new region
+ * by end_frame.
+ */
+#define UNIFORM_RING_FRAMES 3
+#define UNIFORM_RING_REGION_SIZE (2*1024*1024)
+
+static GLuint ring_buffer_ = 0;
+static char* ring_data_ = nullptr;
+static size_t ring_alignment_ = 256;
+static int ring_region_ = 0;
+static size_t ring_offset_ = 0; /* in current region */
+static GLsync ring_fence_[UNIFORM_RING_FRAMES] = { nullptr };
+static bool ring_full_ = false;
+static std::vector<char> uniform_shadow_[Shader::NUM_GLOBAL_UNIFORMS];
 const Shader* Shader::current = nullptr;
 
 typedef std::map<std::string, Shader*> ShaderMap;
@@ -68,6 +94,40 @@ typedef std::pair<std::string, Shader*> ShaderPair;
 static ShaderMap shadercache;
 static bool initialized = false;
 
+/* Preprocessed source by filename, files included by several programs are only read once */
+static std::map<std::string, Shader::source_file_t> sourcecache;
+
+/*
+ * Program binary cache file layout:
+ *   binary_header_t
+ *   char binary[length]
+ */
+#define SHADER_CACHE_VERSION 1
+
+struct binary_header_t {
+	char magic[4];
+	uint32_t version;
+	uint64_t key;
+	uint32_t format;
+	uint32_t length;
+};
+
+static const char binary_magic[4] = { 'S', 'H', 'D', 'B' };
+
+static bool binary_cache_available = false;
+static uint64_t binary_key_seed = UTIL_HASH_SEED; /* Hash of the GL implementation */
+
+static std::string binary_cache_name(uint64_t key) {
+	char name[64];
+	snprintf(name, sizeof(name), "program-%016llx.bin", static_cast<unsigned long long>(key));
+	return std::string(name);
+}
+
+static std::string gl_string(GLenum name) {
+	const GLubyte * str = glGetString(name);
+	return str ? std::string(reinterpret_cast<const char*>(str)) : std::string();
+}
+
 void Shader::initialize() {
 	//Generate global uniforms:
 	glGenBuffers(NUM_GLOBAL_UNIFORMS, global_uniform_buffers_);
@@ -76,34 +136,93 @@ void Shader::initialize() {
 
 	for( int i = 0; i < NUM_GLOBAL_UNIFORMS; ++i) {
 		//Allocate memory in the buffer:
-		glBindBuffer(GL_UNIFORM_BUFFER, global_uniform_buffers_[i]);
+		GLState::bind_buffer(GL_UNIFORM_BUFFER, global_uniform_buffers_[i]);
 		glBufferData(GL_UNIFORM_BUFFER, ubo[i].size, NULL, ubo[i].usage);
 		//Bind buffers to range
-		glBindBufferRange(GL_UNIFORM_BUFFER, i, global_uniform_buffers_[i], 0, ubo[i].size);
+		GLState::bind_buffer_range(GL_UNIFORM_BUFFER, i, global_uniform_buffers_[i], 0, ubo[i].size);
 	}
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	GLState::bind_buffer(GL_UNIFORM_BUFFER, 0);
 	checkForGLErrors("Bind and allocate global uniforms");
 
+	if ( GLEW_ARB_buffer_storage ){
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		const GLsizeiptr size = UNIFORM_RING_REGION_SIZE * UNIFORM_RING_FRAMES;
+
+		GLint alignment;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		ring_alignment_ = static_cast<size_t>(std::max(alignment, 1));
+
+		glGenBuffers(1, &ring_buffer_);
+		GLState::bind_buffer(GL_UNIFORM_BUFFER, ring_buffer_);
+		glBufferStorage(GL_UNIFORM_BUFFER, size, nullptr, flags);
+		ring_data_ = static_cast<char*>(glMapBufferRange(GL_UNIFORM_BUFFER, 0, size, flags));
+		GLState::bind_buffer(GL_UNIFORM_BUFFER, 0);
+		checkForGLErrors("Create uniform ring");
+
+		if ( ring_data_ == nullptr ){
+			Logging::warning("Failed to map uniform ring, using glBufferSubData\n");
+			GLState::delete_buffers(1, &ring_buffer_);
+			ring_buffer_ = 0;
+		} else {
+			Logging::verbose("Uniform ring: %d x %d bytes, alignment %d\n", UNIFORM_RING_FRAMES, UNIFORM_RING_REGION_SIZE, alignment);
+		}
+	}
+
 
 	/* Enable all attribs for Shader::vertex_x */
 	for ( int i = 0; i < NUM_ATTR; ++i ) {
 		glEnableVertexAttribArray(i);
 	}
 
+	/* Program binaries are only usable with the exact same driver */
+	GLint num_binary_formats = 0;
+	if ( GLEW_ARB_get_program_binary ){
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_binary_formats);
+	}
+	binary_cache_available = num_binary_formats > 0;
+	binary_key_seed = util_hash(gl_string(GL_VENDOR));
+	binary_key_seed = util_hash(gl_string(GL_RENDERER), binary_key_seed);
+	binary_key_seed = util_hash(gl_string(GL_VERSION), binary_key_seed);
+	Logging::verbose("Program binary cache %s\n", binary_cache_available ? "enabled" : "not supported");
+
+#ifdef GL_KHR_parallel_shader_compile
+	/* Let the driver pick the number of compiler threads */
+	if ( GLEW_KHR_parallel_shader_compile ){
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+	}
+#endif
+
 	initialized = true;
 }
 
 void Shader::cleanup(){
-	glDeleteBuffers(NUM_GLOBAL_UNIFORMS, global_uniform_buffers_);
+	GLState::delete_buffers(NUM_GLOBAL_UNIFORMS, global_uniform_buffers_);
+
+	if ( ring_buffer_ != 0 ){
+		for ( GLsync &fence : ring_fence_ ){
+			if ( fence ) glDeleteSync(fence);
+			fence = nullptr;
+		}
+		GLState::bind_buffer(GL_UNIFORM_BUFFER, ring_buffer_);
+		glUnmapBuffer(GL_UNIFORM_BUFFER);
+		GLState::bind_buffer(GL_UNIFORM_BUFFER, 0);
+		GLState::delete_buffers(1, &ring_buffer_);
+		ring_buffer_ = 0;
+		ring_data_ = nullptr;
+	}
 
 	/* remove all shaders */
 	for ( ShaderPair p: shadercache ){
 		delete p.second;
 	}
+
+	sourcecache.clear();
 }
 
 Shader::Shader(const std::string &name_, GLuint program) :
 	program_(program)
+	,	from_binary_(false)
+	,	load_time_(0)
 	,	name(name_) {
 	glGetProgramiv(program_, GL_ACTIVE_ATTRIBUTES, &num_attributes_);
 	Logging::verbose("Created shader %s\n"
@@ -137,12 +256,15 @@ void Shader::load_file(const std::string &filename, std::stringstream &shaderDat
 	Logging::verbose("    - Source: \"%s\"\n", filename.c_str());
 }
 
-std::string Shader::parse_shader(
+const Shader::source_file_t& Shader::parse_shader(
 	const std::string &filename,
 	std::set<std::string> included_files,
 	std::string included_from
 	) {
-	char buffer[2048];
+	const auto it = sourcecache.find(filename);
+	if ( it != sourcecache.end() ){
+		return it->second;
+	}
 
 	std::pair<std::set<std::string>::iterator, bool> ret = included_files.insert(filename);
 	if(ret.second == false) {
@@ -151,35 +273,52 @@ std::string Shader::parse_shader(
 
 	std::stringstream raw_content;
 	load_file(filename, raw_content, included_from);
-	std::stringstream parsed_content;
+
+	source_file_t parsed;
+	std::string line;
 	int linenr = 0;
-	while(!raw_content.eof()) {
+	while(std::getline(raw_content, line)) {
 		++linenr;
-		raw_content.getline(buffer, 2048);
-		std::string line(buffer);
 		//Parse preprocessor:
 		if(line.find(PP_INCLUDE) == 0) {
-			line = line.substr(line.find_first_not_of(" ", strlen(PP_INCLUDE)));
+			std::string include = line.substr(line.find_first_not_of(" ", strlen(PP_INCLUDE)));
 
-			size_t first_quote = line.find_first_of('"');
+			size_t first_quote = include.find_first_of('"');
 			if(first_quote != std::string::npos) {
-				size_t end_quote = line.find_last_of('"');
+				size_t end_quote = include.find_last_of('"');
 				if(end_quote == std::string::npos || end_quote == first_quote) {
-					Logging::fatal("%s\nShader preprocessor error in %s:%d: Missing closing quote for #include command\n", buffer, filename.c_str(),  linenr);
+					Logging::fatal("%s\nShader preprocessor error in %s:%d: Missing closing quote for #include command\n", line.c_str(), filename.c_str(),  linenr);
 				}
 				//Trim quotes
-				line = line.substr(first_quote+1, (end_quote - first_quote)-1);
+				include = include.substr(first_quote+1, (end_quote - first_quote)-1);
 			}
 
 			//Include the file:
 			char loc[256];
 			snprintf(loc, sizeof(loc), "%s:%d", filename.c_str(), linenr);
-			parsed_content << parse_shader("/shaders/" + line, included_files, std::string(loc));
+			const std::string include_file = "/shaders/" + include;
+			parsed.source += parse_shader(include_file, included_files, std::string(loc)).source;
+			parsed.includes.push_back(include_file);
 		} else {
-			parsed_content << line << std::endl;
+			parsed.source += line;
+			parsed.source += '\n';
+		}
+	}
+	parsed.hash = util_hash(parsed.source);
+
+	return sourcecache[filename] = parsed;
+}
+
+/* Add the files filename includes, directly or not, to files */
+void Shader::source_dependencies(const std::string &filename, std::set<std::string> &files) {
+	const auto it = sourcecache.find(filename);
+	if ( it == sourcecache.end() ) return;
+
+	for ( const std::string &include : it->second.includes ){
+		if ( files.insert(include).second ){
+			source_dependencies(include, files);
 		}
 	}
-	return parsed_content.str();
 }
 
 static const char* str_shader_type(GLenum type){
@@ -193,44 +332,48 @@ static const char* str_shader_type(GLenum type){
 	}
 }
 
-GLuint Shader::load_shader(GLenum eShaderType, const std::string &strFilename) {
+GLuint Shader::compile_shader(GLenum eShaderType, const std::string &source) {
 	const GLuint shader = glCreateShader(eShaderType);
 	Logging::verbose("  - Compiling %s shader (shader_%d)\n", str_shader_type(eShaderType), shader);
 
-	const std::string source = parse_shader(strFilename);
 	const char* source_ptr = source.c_str();
 	glShaderSource(shader, 1,&source_ptr , NULL);
 	glCompileShader(shader);
 
+	return shader;
+}
+
+void Shader::check_shader(GLuint shader, const stage_t &stage) {
 	GLint compile_status;
 	glGetShaderiv(shader, GL_COMPILE_STATUS, &compile_status);
 
 	if ( compile_status == GL_FALSE ) {
 		char buffer[2048];
 
-		Logging::error("Shader compile error (%s). Preproccessed source: \n", strFilename.c_str());
-		std::stringstream code(source);
+		Logging::error("Shader compile error (%s). Preproccessed source: \n", stage.filename.c_str());
+		std::stringstream code(stage.source->source);
 		int linenr=0;
 		while(!code.eof()) {
 			code.getline(buffer, 2048);
 			Logging::error("%d %s\n", ++linenr, buffer);
 		}
 		glGetShaderInfoLog(shader, 2048, NULL, buffer);
-		Logging::error("Error in shader %s: %s\n", strFilename.c_str(),  buffer);
+		Logging::error("Error in shader %s: %s\n", stage.filename.c_str(),  buffer);
 		checkForGLErrors("shader");
 		abort();
 	}
-
-	return shader;
 }
 
-GLuint Shader::create_program(const std::string &shader_name, const std::vector<GLuint> &shaderList) {
-	GLint gl_tmp;
+GLuint Shader::link_program(const std::vector<GLuint> &shaderList) {
 	GLuint program = glCreateProgram();
 	Logging::verbose("  - Linking program (program_%d)\n", program);
 
 	checkForGLErrors("glCreateProgram");
 
+	if ( binary_cache_available ){
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+
 	for(GLuint shader : shaderList) {
 		glAttachShader(program, shader);
 		checkForGLErrors("glAttachShader");
@@ -239,6 +382,16 @@ GLuint Shader::create_program(const std::string &shader_name, const std::vector<
 	glLinkProgram(program);
 	checkForGLErrors("glLinkProgram");
 
+	return program;
+}
+
+void Shader::check_program(const std::string &shader_name, GLuint program, const std::vector<GLuint> &shaderList, const std::vector<stage_t> &stages) {
+	GLint gl_tmp;
+
+	for ( size_t i = 0; i < shaderList.size(); ++i ){
+		check_shader(shaderList[i], stages[i]);
+	}
+
 	std::for_each(shaderList.begin(), shaderList.end(), glDeleteShader);
 
 	glGetProgramiv(program, GL_LINK_STATUS, &gl_tmp);
@@ -261,10 +414,123 @@ GLuint Shader::create_program(const std::string &shader_name, const std::vector<
 	}
 
 #endif
+}
+
+std::vector<Shader::stage_t> Shader::program_stages(const std::string& base_name) {
+	const std::string vs = base_name+VERT_SHADER_EXTENTION;
+	const std::string gs = base_name+GEOM_SHADER_EXTENTION;
+	const std::string fs = base_name+FRAG_SHADER_EXTENTION;
+
+	std::vector<stage_t> stages;
+	stages.push_back({GL_VERTEX_SHADER,   Data::file_exists(vs) ? vs : "/shaders/default.vert", nullptr});
+	stages.push_back({GL_FRAGMENT_SHADER, Data::file_exists(fs) ? fs : "/shaders/default.frag", nullptr});
+	if ( Data::file_exists(gs) ){
+		stages.push_back({GL_GEOMETRY_SHADER, gs, nullptr});
+	}
+
+	for ( stage_t &stage : stages ){
+		stage.source = &parse_shader(stage.filename);
+	}
+
+	return stages;
+}
+
+uint64_t Shader::binary_key(const std::vector<stage_t> &stages) {
+	uint64_t key = binary_key_seed;
+	for ( const stage_t &stage : stages ){
+		key = util_hash(&stage.type, sizeof(stage.type), key);
+		key = util_hash(&stage.source->hash, sizeof(stage.source->hash), key);
+	}
+	return key;
+}
+
+GLuint Shader::load_binary(const std::string &shader_name, uint64_t key) {
+	if ( !binary_cache_available ) return 0;
 
+	const std::string name = binary_cache_name(key);
+	Cache::mapping_t * mapping = Cache::map(name);
+	if ( mapping == nullptr ) return 0;
+
+	binary_header_t header;
+	if ( mapping->size < sizeof(header) ){
+		Logging::warning("Program binary %s is truncated, recompiling %s.\n", name.c_str(), shader_name.c_str());
+		Cache::unmap(mapping);
+		return 0;
+	}
+	memcpy(&header, mapping->data, sizeof(header));
+
+	if ( memcmp(header.magic, binary_magic, sizeof(binary_magic)) != 0
+		|| header.version != SHADER_CACHE_VERSION
+		|| header.key != key
+		|| mapping->size != sizeof(header) + header.length ){
+		Logging::verbose("  - Program binary %s is stale.\n", name.c_str());
+		Cache::unmap(mapping);
+		return 0;
+	}
+
+	const GLuint program = glCreateProgram();
+	glProgramBinary(program, header.format, static_cast<const char*>(mapping->data) + sizeof(header), header.length);
+	Cache::unmap(mapping);
+
+	GLint link_status = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &link_status);
+	if ( !link_status ){
+		/* An unknown format raises GL_INVALID_ENUM, not worth reporting */
+		while ( glGetError() != GL_NO_ERROR );
+		Logging::verbose("  - Program binary %s rejected by driver.\n", name.c_str());
+		glDeleteProgram(program);
+		return 0;
+	}
+
+	Logging::verbose("  - Loaded program binary %s (program_%d)\n", name.c_str(), program);
 	return program;
 }
 
+void Shader::write_binary(const std::string &shader_name, GLuint program, uint64_t key) {
+	if ( !binary_cache_available ) return;
+
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if ( length <= 0 ) return;
+
+	std::vector<char> data(static_cast<size_t>(length));
+	GLenum format;
+	GLsizei written = 0;
+	glGetProgramBinary(program, length, &written, &format, data.data());
+	if ( checkForGLErrors("glGetProgramBinary") || written <= 0 ) return;
+
+	binary_header_t header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, binary_magic, sizeof(binary_magic));
+	header.version = SHADER_CACHE_VERSION;
+	header.key = key;
+	header.format = format;
+	header.length = static_cast<uint32_t>(written);
+
+	const std::string name = binary_cache_name(key);
+	FILE * file = Cache::begin_write(name);
+	if ( file == nullptr ) return;
+
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(data.data(), 1, header.length, file);
+
+	if ( Cache::end_write(name, file) ){
+		Logging::verbose("  - Wrote program binary %s for %s\n", name.c_str(), shader_name.c_str());
+	}
+}
+
+Shader* Shader::add_shader(const std::string& base_name, GLuint program, const std::vector<stage_t> &stages, bool from_binary, unsigned long start) {
+	Shader* shader = new Shader(base_name, program);
+	for ( const stage_t &stage : stages ){
+		shader->files_.push_back(stage.filename);
+	}
+	shader->from_binary_ = from_binary;
+	shader->load_time_ = util_utime() - start;
+
+	shadercache[base_name] = shader;
+	return shader;
+}
+
 Shader* Shader::create_shader(const std::string& base_name, bool cache) {
 	Logging::verbose("Loading shader \"%s\"\n", base_name.c_str());
 
@@ -280,62 +546,143 @@ Shader* Shader::create_shader(const std::string& base_name, bool cache) {
 	}
 
 	Logging::verbose("  - Cache miss.\n");
-	Logging::verbose("Compiling shader \"%s\"\n", base_name.c_str());
 
-	const std::string vs = base_name+VERT_SHADER_EXTENTION;
-	const std::string gs = base_name+GEOM_SHADER_EXTENTION;
-	const std::string fs = base_name+FRAG_SHADER_EXTENTION;
+	const unsigned long start = util_utime();
+	const std::vector<stage_t> stages = program_stages(base_name);
+	const uint64_t key = binary_key(stages);
 
-	std::vector<GLuint> shader_list;
+	GLuint program = load_binary(base_name, key);
+	if ( program != 0 ){
+		return add_shader(base_name, program, stages, true, start);
+	}
 
-	//Load shaders:
-	shader_list.push_back(load_shader(GL_VERTEX_SHADER,   Data::file_exists(vs) ? vs : "/shaders/default.vert"));
-	shader_list.push_back(load_shader(GL_FRAGMENT_SHADER, Data::file_exists(fs) ? fs : "/shaders/default.frag"));
-	if ( Data::file_exists(gs) ){
-		shader_list.push_back(load_shader(GL_GEOMETRY_SHADER, gs));
+	Logging::verbose("Compiling shader \"%s\"\n", base_name.c_str());
+
+	std::vector<GLuint> shader_list;
+	for ( const stage_t &stage : stages ){
+		shader_list.push_back(compile_shader(stage.type, stage.source->source));
 	}
 
-	Shader* shader = new Shader(base_name, create_program(base_name, shader_list));
-	shadercache[base_name] = shader;
-	return shader;
+	program = link_program(shader_list);
+	check_program(base_name, program, shader_list, stages);
+	write_binary(base_name, program, key);
+
+	return add_shader(base_name, program, stages, false, start);
 }
 
 void Shader::preload(const std::string& base_name){
 	create_shader(base_name);
 }
 
-void Shader::usage_report(FILE* dst){
-	fprintf(dst, "Shader usage\n"
-	             "============\n");
+void Shader::preload(const std::vector<std::string>& base_names, std::function<void(const std::string&)> loaded){
+	if ( !initialized ){
+		Logging::fatal("Shader::preload(..) called before Shader::initialize()\n");
+	}
 
-	for ( ShaderPair p: shadercache ){
-		const GLuint id = p.second->program_;
+	struct pending_t {
+		std::string name;
+		std::vector<stage_t> stages;
+		uint64_t key;
+		std::vector<GLuint> shaders;
+		GLuint program;
+		unsigned long start;
+	};
+	std::vector<pending_t> pending;
+
+	/* Issue all compiles before checking anything, so the driver can work on
+	 * them in parallel (or at least while we read the next source) */
+	for ( const std::string &base_name : base_names ){
+		if ( shadercache.find(base_name) != shadercache.end() ){
+			if ( loaded ) loaded(base_name);
+			continue;
+		}
+
+		Logging::verbose("Loading shader \"%s\"\n", base_name.c_str());
 
-		GLint num_attached;
-		glGetProgramiv(id, GL_ATTACHED_SHADERS, &num_attached);
+		pending_t p;
+		p.name = base_name;
+		p.start = util_utime();
+		p.stages = program_stages(base_name);
+		p.key = binary_key(p.stages);
+		p.program = load_binary(base_name, p.key);
+
+		if ( p.program != 0 ){
+			add_shader(base_name, p.program, p.stages, true, p.start);
+			if ( loaded ) loaded(base_name);
+			continue;
+		}
 
-		std::unique_ptr<GLuint[]> shader(new GLuint[num_attached]);
-		glGetAttachedShaders(id, num_attached, nullptr, shader.get());
+		for ( const stage_t &stage : p.stages ){
+			p.shaders.push_back(compile_shader(stage.type, stage.source->source));
+		}
+		pending.push_back(p);
+	}
 
-		for ( int i = 0; i < num_attached; i++ ){
-			static const std::string extlut[] = { VERT_SHADER_EXTENTION, FRAG_SHADER_EXTENTION, GEOM_SHADER_EXTENTION, ".<unknown>" };
-			unsigned int extension;
+	for ( pending_t &p : pending ){
+		p.program = link_program(p.shaders);
+	}
 
-			GLint type;
-			glGetShaderiv(shader[i], GL_SHADER_TYPE, &type);
-			switch ( type ){
-			case GL_VERTEX_SHADER:   extension = 0; break;
-			case GL_FRAGMENT_SHADER: extension = 1; break;
-			case GL_GEOMETRY_SHADER: extension = 2; break;
-			default:                 extension = 3; break;
+	/* Finish programs as they complete. Without the extension any status
+	 * query blocks, so they are just finished in order. */
+	while ( !pending.empty() ){
+		auto it = pending.begin();
+
+#ifdef GL_KHR_parallel_shader_compile
+		if ( GLEW_KHR_parallel_shader_compile ){
+			it = std::find_if(pending.begin(), pending.end(), [](const pending_t &p){
+				GLint complete = GL_FALSE;
+				glGetProgramiv(p.program, GL_COMPLETION_STATUS_KHR, &complete);
+				return complete == GL_TRUE;
+			});
+			if ( it == pending.end() ){
+				util_usleep(1000);
+				continue;
 			}
+		}
+#endif
 
-			std::string filename = p.first+extlut[extension];
-			if ( !Data::file_exists(filename) ) filename = "/shaders/default"+extlut[extension];
+		check_program(it->name, it->program, it->shaders, it->stages);
+		write_binary(it->name, it->program, it->key);
+		add_shader(it->name, it->program, it->stages, false, it->start);
+		if ( loaded ) loaded(it->name);
 
+		pending.erase(it);
+	}
+}
+
+void Shader::usage_report(FILE* dst){
+	fprintf(dst, "Shader usage\n"
+	             "============\n");
+
+	for ( ShaderPair p: shadercache ){
+		std::set<std::string> includes;
+		for ( const std::string &filename : p.second->files_ ){
+			fprintf(dst, "%s:%s\n", p.first.c_str(), filename.c_str());
+			source_dependencies(filename, includes);
+		}
+		for ( const std::string &filename : includes ){
 			fprintf(dst, "%s:%s\n", p.first.c_str(), filename.c_str());
 		}
 	}
+
+	fprintf(dst, "\nShader load time (program binary cache %s)\n"
+	             "================\n", binary_cache_available ? "enabled" : "not supported");
+
+	int num_warm = 0, num_cold = 0;
+	unsigned long warm_time = 0, cold_time = 0;
+	for ( ShaderPair p: shadercache ){
+		const Shader* shader = p.second;
+		fprintf(dst, "%-40s %s %8.2f ms\n", p.first.c_str(), shader->from_binary_ ? "warm" : "cold", shader->load_time_ / 1000.0);
+		if ( shader->from_binary_ ){
+			++num_warm;
+			warm_time += shader->load_time_;
+		} else {
+			++num_cold;
+			cold_time += shader->load_time_;
+		}
+	}
+
+	fprintf(dst, "%d warm (%.2f ms), %d cold (%.2f ms)\n", num_warm, warm_time / 1000.0, num_cold, cold_time / 1000.0);
 }
 
 void Shader::init_uniforms() {
@@ -355,11 +702,10 @@ void Shader::init_uniforms() {
 void Shader::bind() const {
 	if ( this == current ){
 		return; /* do nothing */
-	} else if ( current ){
-		unbind();
 	}
 
-	glUseProgram(program_);
+	/* No need to unbind the current shader first */
+	GLState::use_program(program_);
 	checkForGLErrors("Bind shader");
 	current = this;
 }
@@ -369,15 +715,72 @@ void Shader::unbind() {
 		Logging::fatal("Shader nesting problem, no shader is bound.\n");
 	}
 
-	glUseProgram(0);
+	GLState::use_program(0);
 	checkForGLErrors("Shader::unbind");
 	current = nullptr;
 }
 
+void Shader::upload_uniform(global_uniforms_t index, const void* data) {
+	const size_t size = ubo[index].size;
+
+	if ( ring_buffer_ != 0 ){
+		uniform_shadow_[index].resize(size);
+		memcpy(uniform_shadow_[index].data(), data, size);
+
+		const size_t offset = (ring_offset_ + ring_alignment_ - 1) / ring_alignment_ * ring_alignment_;
+		if ( offset + size <= UNIFORM_RING_REGION_SIZE ){
+			const size_t start = static_cast<size_t>(ring_region_) * UNIFORM_RING_REGION_SIZE + offset;
+			memcpy(ring_data_ + start, data, size);
+			GLState::bind_buffer_range(GL_UNIFORM_BUFFER, index, ring_buffer_, static_cast<GLintptr>(start), static_cast<GLsizeiptr>(size));
+			ring_offset_ = offset + size;
+			return;
+		}
+
+		if ( !ring_full_ ){
+			Logging::warning("Uniform ring full, using glBufferSubData for the rest of the frame\n");
+			ring_full_ = true;
+		}
+	}
+
+	GLState::bind_buffer(GL_UNIFORM_BUFFER, global_uniform_buffers_[index]);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+	GLState::bind_buffer(GL_UNIFORM_BUFFER, 0);
+
+	if ( ring_buffer_ != 0 ){
+		GLState::bind_buffer_range(GL_UNIFORM_BUFFER, index, global_uniform_buffers_[index], 0, size);
+	}
+}
+
+void Shader::end_frame() {
+	if ( ring_buffer_ == 0 ) return;
+
+	ring_fence_[ring_region_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	ring_region_ = (ring_region_ + 1) % UNIFORM_RING_FRAMES;
+	ring_offset_ = 0;
+	ring_full_ = false;
+
+	GLsync &fence = ring_fence_[ring_region_];
+	if ( fence ){
+		GLenum ret;
+		do {
+			ret = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		} while ( ret == GL_TIMEOUT_EXPIRED );
+		glDeleteSync(fence);
+		fence = nullptr;
+	}
+
+	/* Carry over the current data of every uniform to the new region */
+	for ( int i = 0; i < NUM_GLOBAL_UNIFORMS; ++i ){
+		if ( !uniform_shadow_[i].empty() ){
+			upload_uniform(static_cast<global_uniforms_t>(i), uniform_shadow_[i].data());
+		}
+	}
+
+	checkForGLErrors("Shader::end_frame");
+}
+
 void Shader::upload_lights(const Shader::lights_data_t &lights) {
-	glBindBuffer(GL_UNIFORM_BUFFER, global_uniform_buffers_[UNIFORM_LIGHTS]);
-	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(lights_data_t), &lights);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	upload_uniform(UNIFORM_LIGHTS, &lights);
 	checkForGLErrors("upload lights");
 }
 
@@ -389,35 +792,28 @@ void Shader::upload_projection_view_matrices(
 	const glm::mat4 &projection,
 	const glm::mat4 &view
 	) {
-	glm::mat4 projection_view = projection * view;
-
-	glBindBuffer(GL_UNIFORM_BUFFER, global_uniform_buffers_[UNIFORM_PROJECTION_VIEW_MATRICES]);
-
-	static const size_t s = sizeof(glm::mat4);
-	glBufferSubData(GL_UNIFORM_BUFFER, 0*s, s, glm::value_ptr(projection_view));
-	glBufferSubData(GL_UNIFORM_BUFFER, 1*s, s, glm::value_ptr(projection));
-	glBufferSubData(GL_UNIFORM_BUFFER, 2*s, s, glm::value_ptr(view));
+	const glm::mat4 matrices[3] = {
+		projection * view,
+		projection,
+		view,
+	};
 
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	upload_uniform(UNIFORM_PROJECTION_VIEW_MATRICES, matrices);
 	checkForGLErrors("upload projection view matrices");
 }
 
 void Shader::upload_model_matrix(const glm::mat4 &model) {
-	glBindBuffer(GL_UNIFORM_BUFFER, global_uniform_buffers_[UNIFORM_MODEL_MATRICES]);
-
-	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4), glm::value_ptr(model));
-	glBufferSubData(GL_UNIFORM_BUFFER, sizeof(glm::mat4), sizeof(glm::mat4), glm::value_ptr(glm::transpose(glm::inverse(model))));
+	const glm::mat4 matrices[2] = {
+		model,
+		glm::transpose(glm::inverse(model)),
+	};
 
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	upload_uniform(UNIFORM_MODEL_MATRICES, matrices);
 	checkForGLErrors("upload model matrices");
 }
 
 void Shader::upload_material(const Shader::material_t &material) {
-	glBindBuffer(GL_UNIFORM_BUFFER, global_uniform_buffers_[UNIFORM_MATERIAL]);
-
-	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(material_t), &material);
-
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	upload_uniform(UNIFORM_MATERIAL, &material);
 	checkForGLErrors("upload material");
 }
 
@@ -429,9 +825,7 @@ void Shader::upload_blank_material() {
 void Shader::upload_camera(const Camera &camera) {
 	const camera_t cam = {camera.position(),  camera.near(), camera.far(), };
 
-	glBindBuffer(GL_UNIFORM_BUFFER, global_uniform_buffers_[UNIFORM_CAMERA]);
-	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(camera_t), &cam);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	upload_uniform(UNIFORM_CAMERA, &cam);
 	checkForGLErrors("upload camera");
 	upload_projection_view_matrices(camera.projection_matrix(), camera.view_matrix());
 }
@@ -442,9 +836,7 @@ void Shader::upload_resolution(const glm::ivec2& size){
 		(float)size.y,
 	};
 
-	glBindBuffer(GL_UNIFORM_BUFFER, global_uniform_buffers_[UNIFORM_RESOLUTION]);
-	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(struct resolution_data), &data);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	upload_uniform(UNIFORM_RESOLUTION, &data);
 	checkForGLErrors("Shader::upload_resolution");
 }
 
@@ -453,22 +845,16 @@ void Shader::upload_frameinfo(float t){
 		t,
 	};
 
-	glBindBuffer(GL_UNIFORM_BUFFER, global_uniform_buffers_[UNIFORM_FRAMEINFO]);
-	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(struct frame_data), &data);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	upload_uniform(UNIFORM_FRAMEINFO, &data);
 	checkForGLErrors("Shader::upload_frameinfo");
 }
 
 void Shader::upload_fog(const Shader::fog_t &fog) {
-	glBindBuffer(GL_UNIFORM_BUFFER, global_uniform_buffers_[UNIFORM_FOG]);
-	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(fog_t), &fog);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	upload_uniform(UNIFORM_FOG, &fog);
 }
 
 void Shader::upload_sky(const Shader::sky_data_t  &sky) {
-	glBindBuffer(GL_UNIFORM_BUFFER, global_uniform_buffers_[UNIFORM_SKY]);
-	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(sky_data_t), &sky);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	upload_uniform(UNIFORM_SKY, &sky);
 }
 
 GLint Shader::num_attributes() const { return num_attributes_; }
@@ -523,13 +909,30 @@ void Shader::uniform_upload(GLint uniform, const Color &color) const {
 	uniform_upload(uniform, color.to_vec4());
 }
 
-void Shader::push_vertex_attribs(int offset) {
-	glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
-	for ( int i = offset; i < NUM_ATTR; ++i ) {
-		glDisableVertexAttribArray(i);
-	}
+static GLshort pack_snorm16(float v) {
+	return static_cast<GLshort>(roundf(glm::clamp(v, -1.f, 1.f) * 32767.f));
 }
 
-void Shader::pop_vertex_attribs() {
-	glPopClientAttrib();
+static GLbyte pack_snorm8(float v) {
+	return static_cast<GLbyte>(roundf(glm::clamp(v, -1.f, 1.f) * 127.f));
+}
+
+Shader::packed_vertex_t Shader::pack_vertex(const vertex_t &v) {
+	packed_vertex_t p;
+	p.pos = v.pos;
+	p.uv[0] = util_float_to_half(v.uv.x);
+	p.uv[1] = util_float_to_half(v.uv.y);
+
+	const glm::vec2 normal = util_octahedral_encode(v.normal);
+	p.normal[0] = pack_snorm16(normal.x);
+	p.normal[1] = pack_snorm16(normal.y);
+
+	const glm::vec2 tangent = util_octahedral_encode(v.tangent);
+	const bool flipped = glm::dot(glm::cross(v.normal, v.tangent), v.bitangent) < 0.f;
+	p.tangent[0] = pack_snorm8(tangent.x);
+	p.tangent[1] = pack_snorm8(tangent.y);
+	p.tangent[2] = flipped ? -127 : 127;
+	p.tangent[3] = 0;
+
+	return p;
 }
@@ -6,6 +6,8 @@
 
 #include <GL/glew.h>
 #include <glm/glm.hpp>
+#include <cstdint>
+#include <functional>
 #include <string>
 #include <vector>
 #include <set>
@@ -49,9 +51,19 @@ public:
 	 */
 	static void preload(const std::string& base_name);
 
+	/**
+	 * Preload several shaders. All compiles and links are issued before any
+	 * status is checked, so with GL_KHR_parallel_shader_compile the driver
+	 * compiles them in parallel.
+	 *
+	 * @param loaded Optional callback run as each shader is ready.
+	 */
+	static void preload(const std::vector<std::string>& base_names, std::function<void(const std::string&)> loaded = nullptr);
+
 	/**
 	 * Write a usage report to dst with details about which shaders has been
-	 * loaded and the files it depends.
+	 * loaded and the files it depends, and how long each program took to load
+	 * from the program binary cache (warm) or by compiling (cold).
 	 */
 	static void usage_report(FILE* dst = stderr);
 
@@ -141,6 +153,22 @@ public:
 	};
 	typedef struct vertex vertex_t;
 
+	/*
+	 * Compact vertex, 24 bytes instead of 72 (see Mesh::VERTEX_FORMAT_PACKED).
+	 * The normal and tangent are octahedral encoded and the bitangent is
+	 * rebuilt in the vertex shader as cross(normal, tangent) * tangent[2].
+	 * There is no color.
+	 */
+	struct packed_vertex {
+		glm::vec3 pos;
+		GLhalf uv[2];
+		GLshort normal[2];
+		GLbyte tangent[4]; /* octahedral x, y, bitangent sign, unused */
+	};
+	typedef struct packed_vertex packed_vertex_t;
+
+	static packed_vertex_t pack_vertex(const vertex_t &v);
+
 	struct material_t {
 		float shininess;
 		glm::vec4 __ALIGNED__(16) diffuse;
@@ -174,6 +202,13 @@ public:
 		float lerp_offset;
 	};
 
+	/* A source file with all includes expanded */
+	struct source_file_t {
+		std::string source;
+		uint64_t hash; /* util_hash of source */
+		std::vector<std::string> includes; /* Files included directly */
+	};
+
 	/**
 	 * Used *ONLY* for uncached shaders. Will delete the pointer. Shader is not
 	 * valid for any use after this call and user should pointer to nullptr.
@@ -191,11 +226,50 @@ public:
 	Shader(const std::string &name_, GLuint program);
 	~Shader();
 
-	static GLuint load_shader(GLenum eShaderType, const std::string &strFilename);
-	static GLuint create_program(const std::string &shader_name, const std::vector<GLuint> &shaderList);
+	/* A stage of a program, the file it was loaded from and the preprocessed source */
+	struct stage_t {
+		GLenum type;
+		std::string filename;
+		const source_file_t * source;
+	};
+
+	static std::vector<stage_t> program_stages(const std::string &base_name);
+
+	/*
+	 * Compile and link without waiting for the result, the check functions
+	 * block until it is ready and abort on errors.
+	 */
+	static GLuint compile_shader(GLenum eShaderType, const std::string &source);
+	static void check_shader(GLuint shader, const stage_t &stage);
+	static GLuint link_program(const std::vector<GLuint> &shaderList);
+	static void check_program(const std::string &shader_name, GLuint program, const std::vector<GLuint> &shaderList, const std::vector<stage_t> &stages);
+
+	/*
+	 * Upload the data of a global uniform, ubo[index].size bytes. Uses the
+	 * persistently mapped uniform ring if available.
+	 */
+	static void upload_uniform(global_uniforms_t index, const void* data);
+
+	/* Create a shader from a linked program and add it to the cache */
+	static Shader* add_shader(const std::string& base_name, GLuint program, const std::vector<stage_t> &stages, bool from_binary, unsigned long start);
+
+	/*
+	 * Linked programs are kept in the on-disk Cache with glGetProgramBinary,
+	 * keyed by a hash of the preprocessed sources and the GL implementation.
+	 * load_binary returns 0 if there is no entry or the driver rejects it.
+	 */
+	static uint64_t binary_key(const std::vector<stage_t> &stages);
+	static GLuint load_binary(const std::string &shader_name, uint64_t key);
+	static void write_binary(const std::string &shader_name, GLuint program, uint64_t key);
 
 	static void load_file(const std::string &filename, std::stringstream &shaderData, std::string included_from);
-	static std::string parse_shader(const std::string &filename, std::set<std::string> included_files=std::set<std::string>(), std::string included_from="");
+
+	/*
+	 * Preprocessed source file. Each file is read and parsed once, and the
+	 * result is reused by every program that includes it.
+	 */
+	static const source_file_t& parse_shader(const std::string &filename, std::set<std::string> included_files=std::set<std::string>(), std::string included_from="");
+	static void source_dependencies(const std::string &filename, std::set<std::string> &files);
 
 	GLint global_uniform_block_index_[NUM_GLOBAL_UNIFORMS];
 
@@ -205,6 +279,11 @@ public:
 
 	GLint num_attributes_;
 
+	/* For usage_report */
+	std::vector<std::string> files_;
+	bool from_binary_;
+	unsigned long load_time_; /* µs */
+
 	static const Shader* current; /* current bound shader or null */
 
 public:
@@ -299,15 +378,9 @@ public:
 	static void upload_blank_material();
 
 	/**
-	 * Push vertex attribs and disable all.
-	 *
-	 * @param Disable attrib from (inclusive) offset.
-	 */
-	static void push_vertex_attribs(int offset = 0);
-
-	/**
-	 * Restore all vertex attribs
+	 * Call after each buffer swap. Moves the uniform ring to the next frame's
+	 * region, waiting for the GPU if it still reads it.
 	 */
-	static void pop_vertex_attribs();
+	static void end_frame();
 };
 #endif
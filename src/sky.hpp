@@ -39,7 +39,7 @@ class Sky {
 
 	private:
 		Shader* shader;
-		GLuint vbo;
+		GLuint vao, vbo;
 		static const float vertices[2*6*18];
 
 		float time_of_day;
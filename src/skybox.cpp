@@ -4,6 +4,7 @@
 
 #include "skybox.hpp"
 #include "camera.hpp"
+#include "gl_state.hpp"
 #include "texture.hpp"
 #include "utils.hpp"
 
@@ -29,10 +30,17 @@ Skybox::Skybox(std::string skybox_path) {
 	static bool initialized = false;
 	if ( !initialized ){
 		shader = Shader::create_shader("/shaders/skybox");
+		glGenVertexArrays(1, &vao);
+		GLState::bind_vertex_array(vao);
 		glGenBuffers(1, &vbo);
-		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		GLState::bind_buffer(GL_ARRAY_BUFFER, vbo);
 		glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glEnableVertexAttribArray(0);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)(sizeof(float)*3*36) );
+		GLState::bind_vertex_array(0);
+		GLState::bind_buffer(GL_ARRAY_BUFFER, 0);
 		initialized = true;
 	}
 }
@@ -44,34 +52,30 @@ Skybox::~Skybox() {
 void Skybox::render(const Camera &camera) const{
 	shader->bind();
 
-	glPushAttrib(GL_ENABLE_BIT|GL_DEPTH_BUFFER_BIT);
-	glDisable(GL_DEPTH_TEST);
-	glDisable(GL_CULL_FACE);
+	const GLState::saved_t saved = GLState::save();
+	GLState::disable(GL_DEPTH_TEST);
+	GLState::disable(GL_CULL_FACE);
 
 	Shader::upload_projection_view_matrices(
 			camera.projection_matrix(),
 			glm::lookAt(glm::vec3(0.0), camera.look_at()-camera.position(), camera.up())
 	);
 
-	/* Disable most attribs from Shader::vertex_x */
-	Shader::push_vertex_attribs(2);
-
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)(sizeof(float)*3*36) );
 	texture->texture_bind(Shader::TEXTURE_CUBEMAP_0);
 
+	GLState::bind_vertex_array(vao);
 	glDrawArrays(GL_TRIANGLES, 0, 36);
+	GLState::bind_vertex_array(0);
 
 	checkForGLErrors("Skybox::render(): render");
 
-	Shader::pop_vertex_attribs();
-	glPopAttrib();
+	GLState::restore(saved);
 
 	checkForGLErrors("Skybox::render(): post");
 }
 
 Shader* Skybox::shader = nullptr;
+GLuint Skybox::vao = 0;
 GLuint Skybox::vbo = 0;
 
 const float Skybox::vertices[] = {
@@ -17,7 +17,7 @@ class Skybox {
 
 	private:
 		static Shader* shader;
-		static GLuint vbo;
+		static GLuint vao, vbo;
 		static const float vertices[2*3*36];
 		static const char * texture_names[];
 };
@@ -14,6 +14,9 @@
 #include "line2d.hpp"
 #include "intersect2d.hpp"
 #include "threading.hpp"
+#include "cache.hpp"
+#include "data.hpp"
+#include "engine.hpp"
 
 #include <SDL/SDL.h>
 #include <SDL/SDL_image.h>
@@ -21,6 +24,9 @@
 #include <string>
 #include <vector>
 #include <functional>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
 #include <glm/gtx/norm.hpp>
 
 
@@ -37,14 +43,54 @@ float Terrain::culling_near_padding = 1.f;
 float Terrain::lod_distance[TERRAIN_LOD_LEVELS];
 
 Terrain::~Terrain() {
+	delete cdlod_;
 	if(map_ != NULL)
 		delete map_;
 	delete normal_textures_;
 	delete diffuse_textures_;
 }
 
-Terrain::Terrain(const std::string &file) : Mesh(32.f), perlin("mario rulez") {
+/*
+ * Cache file layout:
+ *   cache_header_t
+ *   float height map[size.x * size.y]
+ *   Shader::vertex_t vertices[num_vertices]
+ *   num_submeshes * (cache_submesh_t, unsigned int indices[num_indices])
+ */
+struct cache_header_t {
+	char magic[4];
+	uint32_t version;
+	uint64_t key;
+	int32_t size[2];
+	uint32_t vertex_size;
+	uint32_t num_submeshes;
+	uint64_t num_vertices;
+	float root_min[2];
+	float root_max[2];
+	int32_t root_level;
+};
+
+struct cache_submesh_t {
+	int32_t level;
+	float middle[2];
+	uint64_t num_indices;
+};
+
+static const char cache_magic[4] = { 'T', 'R', 'N', 'C' };
+
+Terrain::Terrain(const std::string &file) : Mesh(32.f), perlin(TERRAIN_SEED) {
+	cull_stats_.visited = 0;
+	cull_stats_.drawn = 0;
+
+	set_vertex_format(VERTEX_FORMAT_PACKED);
+	cdlod_ = nullptr;
+
 	Config config = Config::parse(file);
+
+	Data * raw_config = Data::open(file);
+	cache_key_ = util_hash(raw_config->data(), raw_config->size(), util_hash(TERRAIN_SEED));
+	delete raw_config;
+
 	size_ = config["/size"]->as_vec2();
 	horizontal_scale_ = config["/horizontal_scale"]->as_float();
 	vertical_scale_ = config["/vertical_size"]->as_float();;
@@ -88,7 +134,10 @@ Terrain::Terrain(const std::string &file) : Mesh(32.f), perlin("mario rulez") {
 
 	cone_amplitude = config["cone_amplitude"]->as_float();
 
-	shader_ = Shader::create_shader("/shaders/terrain");
+	const ConfigEntry * cdlod = config.find("/cdlod");
+	use_cdlod_ = cdlod != nullptr && cdlod->as_int() != 0;
+
+	shader_ = Shader::create_shader(use_cdlod_ ? "/shaders/terrain_cdlod" : "/shaders/terrain");
 	u_texture_selection_[0] = shader_->uniform_location("texture_fade_start");
 	u_texture_selection_[1] = shader_->uniform_location("texture_fade_length");
 
@@ -123,80 +172,65 @@ unsigned int Terrain::extra_vertex(std::map<glm::vec2, unsigned int, bool(*)(con
 	}
 }
 
-unsigned int Terrain::generate_vertices(void * data) {
-	thread_data_t * d = (thread_data_t*) data;
-	Shader::vertex_t * tmp_vertices = d->tmp_vertices;
-	printf("%d: %d, %d\n", d->id, d->start, d->end);
-	for(int y=d->start; y<d->end; ++y) {
-		for(int x=0; x<size_.x; ++x) {
-			Shader::vertex_t v;
-			int vi = (y - d->start) * size_.x + x;
-			int i = y * size_.x + x;
+void Terrain::generate_vertices(int start, int end) {
+	// large realistic ridged mountain terrain
+	static const float density = 250.f;
+	static const PerlinNoise::ridged_params_t ridged = PerlinNoise::ridged_params(
+		1.5,  /* H */
+		2.0,  /* lacunarity */
+		20.0, /* octaves */
+		1.5,  /* offset */
+		2.0   /* gain */
+	);
 
-			float x_ = 0.f;
-			float y_ = 0.f;
-			float r_ = 0.f;
-			float h = 0.f;
+	// medium smooth ridges
+	static const float offsetX = 200.f,
+		offsetY = -280.f,
+		ridge_density = 100.f,
+		ridge_amplitude = 0.5f;
 
-			float half_size_x = size_.x / 2.f;
-			float half_size_y = size_.y / 2.f;
+	// low profile detail bumps
+	static const float bump_density = 16.f,
+		bump_amplitude = 0.01f;
 
-			// get inverse distance from center of world in range [0,1]
-			//float x_ = 1 - (float) abs(size_.x / 2 - x) / (size_.x / 2);
-			//float y_ = 1 - (float) abs(size_.y / 2 - y) / (size_.y / 2);
+	/* Noise is evaluated a full row at a time */
+	std::vector<float> ridged_row(size_.x), ridge_row(size_.x), bump_row(size_.x);
 
+	const float half_size_x = size_.x / 2.f;
+	const float half_size_y = size_.y / 2.f;
 
-			// previous huge pointy cone
-			//int c_x = 300;
-			//int c_y = 300;
-			// x_ = 0;
-			// y_ = 0;
-			// if(x > half_size_x-c_x && x < half_size_x+c_x &&
-			// y > half_size_y-c_y && y < half_size_y+c_y){
-			// x_ = 1 - (x + c_x - half_size_x) / c_x;
-			// y_ = 1 - (y + c_y - half_size_y) / c_y;
-			// }
+	for(int y=start; y<end; ++y) {
+		const float fy = static_cast<float>(y);
+		perlin.ridgedMultifractalNoise_row(ridged, 0.f, 1.f/density, fy/density, size_.x, ridged_row.data());
+		perlin.noise2_row(-offsetX/ridge_density, 1.f/ridge_density, (fy-offsetY)/ridge_density, size_.x, ridge_row.data());
+		perlin.noise2_row(0.f, 1.f/bump_density, fy/bump_density, size_.x, bump_row.data());
 
+		for(int x=0; x<size_.x; ++x) {
+			int i = y * size_.x + x;
+			float h = 0.f;
 
 			// huge pointy cone
-			x_ = (x - half_size_x) / half_size_x;
-			y_ = (y - half_size_y) / half_size_y;
-			r_ = std::max(0.f, 1.f - sqrtf(x_*x_ + y_*y_));
+			const float x_ = (x - half_size_x) / half_size_x;
+			const float y_ = (y - half_size_y) / half_size_y;
+			const float r_ = std::max(0.f, 1.f - sqrtf(x_*x_ + y_*y_));
 			h += cone_amplitude * r_;
 
+			h += ridged_row[x];
+			h += -ridge_amplitude * std::abs(ridge_row[x]);
+			h += bump_amplitude * std::abs(bump_row[x]);
 
-			// large realistic ridged mountain terrain
-			static const double density = 250.0,
-				H = 1.5,
-				lacunarity = 2.0,
-				octaves = 20.0,
-				offset = 1.5,
-				gain = 2.0;
-			h += perlin.ridgedMultifractalNoise(x/density, y/density, H, lacunarity, octaves, offset, gain);
-
-
-			// medium smooth ridges
-			static const double offsetX = 200.0,
-				offsetY = -280.0,
-				ridge_density = 100.0,
-				ridge_amplitude = 0.5;
-			x_ = 1.f - abs(half_size_x - x) / half_size_x;
-			y_ = 1.f - abs(half_size_y - y) / half_size_y;
-			h += -1.0 * ridge_amplitude * std::abs(perlin.noise((x-offsetX)/ridge_density, (y-offsetY)/ridge_density));
-
-
-			// low profile detail bumps
-			h += 0.01 * abs(perlin.noise(x/16.0, y/16.0));
+			map_[i] = h*vertical_scale_;
 
+			/* CDLOD only needs the height map */
+			if(use_cdlod_) continue;
 
+			Shader::vertex_t v;
 			v.pos = glm::vec3(horizontal_scale_*static_cast<float>(x), h*vertical_scale_, horizontal_scale_*static_cast<float>(y));
 			v.uv = CALC_UV(x,y);
 
-			tmp_vertices[vi] = v;
-			map_[i] = h*vertical_scale_;
+			vertices_[i] = v;
 		}
 	}
-	return 0;
 }
 
 void Terrain::generate_terrain() {
@@ -208,34 +242,32 @@ void Terrain::generate_terrain() {
 		"  - World size: %dx%d\n"
 		"  - scale: %fx%f\n", size_.x, size_.y, horizontal_scale_, vertical_scale_);
 
-	int num_threads = Threading::num_cores();
-
-
-	std::vector<Threading::thread_t*> threads;
-	thread_data_t * thread_data = new thread_data_t[num_threads];
-
-	int partition = size_.y / num_threads;
-	for(int i=0; i<(num_threads - 1) ; ++i) {
-		int num_local_vertices = size_.x * partition;
-		thread_data_t td = { new Shader::vertex_t[num_local_vertices], i * partition, (i + 1) * partition, num_local_vertices, i };
-		thread_data[i] = td;
-		threads.push_back(Threading::create(std::bind(&Terrain::generate_vertices, this, std::placeholders::_1), thread_data + i));
+	for(int i=0; i<TERRAIN_LOD_LEVELS; ++i) {
+		lod_distance[i] = glm::pow(lod_base_step * static_cast<float>(1 << i), 2.f); /* ^2 to avoid sqrt in distance check */
 	}
-	
-	int num_local_vertices = size_.x * (size_.y - (num_threads - 1) * partition);
-	thread_data_t td = { new Shader::vertex_t[num_local_vertices],(num_threads - 1) * partition, size_.y, num_local_vertices , num_threads };
-	thread_data[num_threads - 1] = td;
-	threads.push_back(Threading::create(std::bind(&Terrain::generate_vertices, this, std::placeholders::_1),thread_data + num_threads - 1));
-	
-	vertices_.clear();
 
-	for(int i = 0; i< num_threads; ++i) {
-		Threading::join(threads[i]);
-		vertices_.insert(vertices_.end(), thread_data[i].tmp_vertices,  thread_data[i].tmp_vertices + thread_data[i].num_vertices);
-		delete thread_data[i].tmp_vertices;
+	if(load_cache()) {
+		Logging::info("[Terrain] Loaded from cache.\n");
+		Logging::info("[Terrain] Create buffers.\n");
+		create_buffers();
+		Logging::info("[Terrain] Terrain loaded.\n");
+		return;
 	}
 
-	delete thread_data;
+	vertices_.clear();
+	if(!use_cdlod_) vertices_.resize(numVertices);
+
+	/* Each row is independent, so split the rows over the worker pool */
+	Threading::parallel_for(0, size_.y, std::bind(&Terrain::generate_vertices, this, std::placeholders::_1, std::placeholders::_2));
+
+	if(use_cdlod_) {
+		/* Only the height map was generated, the mesh is generated on the gpu */
+		Logging::info("[Terrain] Write cache.\n");
+		write_cache();
+		create_buffers();
+		Logging::info("[Terrain] Terrain loaded.\n");
+		return;
+	}
 
 	unsigned long indexCount[TERRAIN_LOD_LEVELS];
 	indexCount[0] = (size_.y - 1 ) * (size_.x -1) * 6;
@@ -293,7 +325,6 @@ void Terrain::generate_terrain() {
 
 	for(int i=0; i<TERRAIN_LOD_LEVELS; ++i) {
 		add_indices(indices[i], i);
-		lod_distance[i] = glm::pow(lod_base_step * static_cast<float>(scale_factor[i]), 2.f); /* ^2 to avoid sqrt in distance check */
 	}
 
 	Logging::info("[Terrain] Generate normals.\n");
@@ -303,9 +334,9 @@ void Terrain::generate_terrain() {
 
 	Logging::info("[Terrain] Generate skirts.\n");
 	//Generate skirts
-	submesh_tree->traverse([&](QuadTree * qt) -> bool {
-		if(qt->data != nullptr) {
-			SubMesh * m = static_cast<SubMesh*>(qt->data);
+	submesh_tree->traverse([&](submesh_tree_t::node_t * node) -> bool {
+		if(node->data != nullptr) {
+			SubMesh * m = node->data;
 
 			// find bounds
 			AABB_2D bounds;
@@ -378,14 +409,183 @@ void Terrain::generate_terrain() {
 
 	Logging::info("[Terrain] Ortonormalize tangent space.\n");
 	ortonormalize_tangent_space();
+	Logging::info("[Terrain] Write cache.\n");
+	write_cache();
 	Logging::info("[Terrain] Create buffers.\n");
-	generate_vbos();
+	create_buffers();
 	Logging::info("[Terrain] Generating LOD.\n");
 
 	Logging::info("[Terrain] Terrain loaded.\n");
 }
 
 
+void Terrain::create_buffers() {
+	if(use_cdlod_) {
+		calculate_grid_normals();
+		cdlod_ = new TerrainCDLOD(map_, size_, horizontal_scale_, uv_scale_, shader_);
+		raw_aabb_ = cdlod_->aabb();
+		aabb_dirty_ = true;
+		return;
+	}
+
+	const size_t grid_size = static_cast<size_t>(size_.x * size_.y);
+	normals_.resize(grid_size);
+	for(size_t i=0; i<grid_size; ++i) {
+		normals_[i] = vertices_[i].normal;
+	}
+
+	generate_vbos();
+}
+
+void Terrain::calculate_grid_normals() {
+	normals_.resize(static_cast<size_t>(size_.x * size_.y));
+	for(int y=0; y<size_.y; ++y) {
+		const int y0 = std::max(y - 1, 0), y1 = std::min(y + 1, size_.y - 1);
+		for(int x=0; x<size_.x; ++x) {
+			const int x0 = std::max(x - 1, 0), x1 = std::min(x + 1, size_.x - 1);
+			const float dx = (map_[y * size_.x + x1] - map_[y * size_.x + x0]) / (static_cast<float>(x1 - x0) * horizontal_scale_);
+			const float dz = (map_[y1 * size_.x + x] - map_[y0 * size_.x + x]) / (static_cast<float>(y1 - y0) * horizontal_scale_);
+			normals_[y * size_.x + x] = glm::normalize(glm::vec3(-dx, 1.f, -dz));
+		}
+	}
+}
+
+std::string Terrain::cache_name() const {
+	char name[64];
+	snprintf(name, sizeof(name), "terrain-%016llx.bin", static_cast<unsigned long long>(cache_key_));
+	return std::string(name);
+}
+
+bool Terrain::load_cache() {
+	const std::string name = cache_name();
+	Cache::mapping_t * mapping = Cache::map(name);
+	if(mapping == nullptr) return false;
+
+	const char * ptr = static_cast<const char*>(mapping->data);
+	const char * end = ptr + mapping->size;
+
+	cache_header_t header;
+	if(mapping->size < sizeof(header)) {
+		Logging::warning("[Terrain] Cache %s is truncated, regenerating.\n", name.c_str());
+		Cache::unmap(mapping);
+		return false;
+	}
+	memcpy(&header, ptr, sizeof(header));
+	ptr += sizeof(header);
+
+	if(memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0
+		|| header.version != TERRAIN_CACHE_VERSION
+		|| header.key != cache_key_
+		|| header.size[0] != size_.x || header.size[1] != size_.y
+		|| header.vertex_size != sizeof(Shader::vertex_t)
+		|| header.root_level < 0 || header.root_level > LINEAR_QUADTREE_MAX_LEVEL) {
+		Logging::verbose("[Terrain] Cache %s is stale, regenerating.\n", name.c_str());
+		Cache::unmap(mapping);
+		return false;
+	}
+
+	const size_t map_bytes = sizeof(float) * static_cast<size_t>(size_.x * size_.y);
+	const size_t vertex_bytes = sizeof(Shader::vertex_t) * static_cast<size_t>(header.num_vertices);
+
+	bool valid = static_cast<size_t>(end - ptr) >= map_bytes + vertex_bytes;
+	if(valid) {
+		memcpy(map_, ptr, map_bytes);
+		ptr += map_bytes;
+
+		vertices_.resize(static_cast<size_t>(header.num_vertices));
+		memcpy(vertices_.data(), ptr, vertex_bytes);
+		ptr += vertex_bytes;
+
+		free_submesh_tree();
+		submesh_tree = new submesh_tree_t(AABB_2D(
+			glm::vec2(header.root_min[0], header.root_min[1]),
+			glm::vec2(header.root_max[0], header.root_max[1])
+			), header.root_level);
+	}
+
+	for(uint32_t i=0; valid && i < header.num_submeshes; ++i) {
+		cache_submesh_t sm;
+		if(static_cast<size_t>(end - ptr) < sizeof(sm)) {
+			valid = false;
+			break;
+		}
+		memcpy(&sm, ptr, sizeof(sm));
+		ptr += sizeof(sm);
+
+		const size_t index_bytes = sizeof(unsigned int) * static_cast<size_t>(sm.num_indices);
+		submesh_tree_t::node_t * node = submesh_tree->child(glm::vec2(sm.middle[0], sm.middle[1]), sm.level);
+		if(node == nullptr || node->data != nullptr || static_cast<size_t>(end - ptr) < index_bytes) {
+			valid = false;
+			break;
+		}
+
+		SubMesh * m = new SubMesh(*this);
+		m->indices.resize(static_cast<size_t>(sm.num_indices));
+		memcpy(m->indices.data(), ptr, index_bytes);
+		ptr += index_bytes;
+		node->data = m;
+	}
+
+	Cache::unmap(mapping);
+
+	if(!valid) {
+		Logging::warning("[Terrain] Cache %s is corrupt, regenerating.\n", name.c_str());
+		vertices_.clear();
+		set_partition_size(partition_size_);
+		return false;
+	}
+
+	has_normals_ = true;
+	has_tangents_ = true;
+	return true;
+}
+
+void Terrain::write_cache() {
+	const std::string name = cache_name();
+	FILE * file = Cache::begin_write(name);
+	if(file == nullptr) return;
+
+	cache_header_t header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, cache_magic, sizeof(cache_magic));
+	header.version = TERRAIN_CACHE_VERSION;
+	header.key = cache_key_;
+	header.size[0] = size_.x;
+	header.size[1] = size_.y;
+	header.vertex_size = sizeof(Shader::vertex_t);
+	header.num_vertices = vertices_.size();
+	const AABB_2D root = submesh_tree->aabb();
+	header.root_min[0] = root.min.x;
+	header.root_min[1] = root.min.y;
+	header.root_max[0] = root.max.x;
+	header.root_max[1] = root.max.y;
+	header.root_level = submesh_tree->level();
+
+	submesh_tree->traverse([&header](submesh_tree_t::node_t * node) -> bool {
+		if(node->data != nullptr) ++header.num_submeshes;
+		return true;
+	});
+
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(map_, sizeof(float), static_cast<size_t>(size_.x * size_.y), file);
+	fwrite(vertices_.data(), sizeof(Shader::vertex_t), vertices_.size(), file);
+
+	submesh_tree->traverse([file](submesh_tree_t::node_t * node) -> bool {
+		if(node->data != nullptr) {
+			const SubMesh * m = node->data;
+			const glm::vec2 middle = node->middle();
+			cache_submesh_t sm = { node->level, { middle.x, middle.y }, m->indices.size() };
+			fwrite(&sm, sizeof(sm), 1, file);
+			fwrite(m->indices.data(), sizeof(unsigned int), m->indices.size(), file);
+		}
+		return true;
+	});
+
+	if(Cache::end_write(name, file)) {
+		Logging::verbose("[Terrain] Wrote cache %s\n", name.c_str());
+	}
+}
+
 float Terrain::height_from_color(const glm::vec4 &color) const {
 	return color.r + color.g;
 }
@@ -414,7 +614,7 @@ float Terrain::height_at(float x_, float y_) const {
 }
 
 const glm::vec3 &Terrain::normal_at(int x, int y) const {
-	return vertices_[y*size_.x + x].normal;
+	return normals_[y*size_.x + x];
 }
 
 glm::vec3 Terrain::normal_at(float x_, float y_) const {
@@ -435,6 +635,12 @@ glm::vec3 Terrain::normal_at(float x_, float y_) const {
 void Terrain::render(const glm::mat4& m) {
 	prepare_shader();
 
+	if(cdlod_ != nullptr) {
+		Shader::upload_model_matrix(m * matrix());
+		cdlod_->render_all();
+		return;
+	}
+
 	Mesh::render();
 
 #if RENDER_DEBUG
@@ -461,27 +667,18 @@ void Terrain::render_cull(const Camera &cam, const glm::mat4& m) {
 
 	prepare_shader();
 
-	prepare_submesh_rendering(m);
-	//We assume no roll (we could widen the frustrum a bit to take some roll into account)
-
-	AABB_2D near_aabb;
-
-	Triangle2D cam_tri = calculate_camera_tri(cam, near_aabb);
-
-	AABB_2D aabb2d;
-	aabb2d.add_point(cam_tri.p1);
-	aabb2d.add_point(cam_tri.p2);
-	aabb2d.add_point(cam_tri.p3);
+	if(cdlod_ != nullptr) {
+		render_cdlod(cam, nullptr, m);
+		return;
+	}
 
-	aabb2d += near_aabb;
+	prepare_submesh_rendering(m);
 
 #if RENDER_DEBUG
 	glLineWidth(2.f);
 	debug_shader->bind();
 #endif
-	//glDisable(GL_CULL_FACE);
-	submesh_tree->traverse(std::bind(&Terrain::cull_or_render, cam_tri, near_aabb, aabb2d, std::placeholders::_1));
-	//glEnable(GL_CULL_FACE);
+	render_culled(cam, nullptr, m);
 }
 
 void Terrain::render_geometry_cull( const Camera &cam, const glm::mat4& m) {
@@ -489,15 +686,108 @@ void Terrain::render_geometry_cull( const Camera &cam, const glm::mat4& m) {
 }
 
 void Terrain::render_geometry_cull( const Camera &cam, const AABB &aabb, const glm::mat4& m) {
+	AABB_2D aabb2d(glm::vec2(aabb.min.x, aabb.min.z), glm::vec2(aabb.max.x, aabb.max.z));
+
+	/* With CDLOD the bound shader must use terrain_cdlod.vert */
+	if(cdlod_ != nullptr) {
+		render_cdlod(cam, &aabb2d, m);
+		return;
+	}
+
 	prepare_submesh_rendering(m);
+	render_culled(cam, &aabb2d, m);
+}
 
-	AABB_2D near_aabb;
+void Terrain::render_cdlod(const Camera &cam, const AABB_2D * limiting_box, const glm::mat4& m) {
+	const glm::mat4 model = m * matrix();
+	Shader::upload_model_matrix(model);
 
-	Triangle2D cam_tri = calculate_camera_tri(cam, near_aabb);
+	/* Select in terrain space */
+	const Frustum frustum(cam.projection_matrix() * cam.view_matrix() * model);
+	const glm::vec3 camera(glm::inverse(model) * glm::vec4(cam.position(), 1.f));
+	const float lod_scale = static_cast<float>(resolution.y) / (2.f * tanf(glm::radians(cam.fov()) * 0.5f));
 
-	AABB_2D aabb2d(glm::vec2(aabb.min.x, aabb.min.z), glm::vec2(aabb.max.x, aabb.max.z));
+	cdlod_->render(frustum, camera, lod_scale, limiting_box);
+
+	cull_stats_.visited = cdlod_->visited();
+	cull_stats_.drawn = cdlod_->drawn();
+}
+
+void Terrain::render_culled(const Camera &cam, const AABB_2D * limiting_box, const glm::mat4& m) {
+	cull_stats_.visited = 0;
+	cull_stats_.drawn = 0;
+
+	/* Cull in mesh space, submesh bounds are not transformed */
+	const Frustum frustum(cam.projection_matrix() * cam.view_matrix() * m * matrix());
+
+	/* Lod is measured from a point slightly behind the camera */
+	glm::vec2 lod_point(cam.position().x, cam.position().z);
+	const glm::vec2 lz(cam.local_z().x, cam.local_z().z);
+	if(glm::length(lz) > 0.f) lod_point -= glm::normalize(lz) * culling_near_padding;
+
+	const cull_context_t ctx = { frustum, limiting_box, lod_point };
+
+	submesh_tree_t::node_t * root = submesh_tree->root();
+	if((limiting_box == nullptr || intersect2d::aabb_aabb(root->aabb(), *limiting_box))
+		&& frustum.intersects(node_bounds(root))) {
+		cull_node(root, ctx);
+	}
+
+	/* All visible submeshes are drawn in one call */
+	finish_submesh_rendering();
+}
+
+const AABB &Terrain::node_bounds(const submesh_tree_t::node_t * node) const {
+	return submesh_bounds_[submesh_tree->index(node)];
+}
+
+void Terrain::cull_node(submesh_tree_t::node_t * node, const cull_context_t &ctx) {
+	++cull_stats_.visited;
+
+	float d = glm::distance2(node->middle(), ctx.lod_point);
+	int lod = TERRAIN_LOD_LEVELS - 1;
+	for(int i=0; i< TERRAIN_LOD_LEVELS; ++i) {
+		if(d < lod_distance[i]) {
+			lod = i;
+			break;
+		}
+	}
+
+	if(node->level <= lod) {
+		if(node->data != nullptr) {
+			queue_submesh(node->data);
+			++cull_stats_.drawn;
+		}
+		return;
+	}
+
+	submesh_tree_t::node_t * children[4];
+	Frustum::box4_t boxes;
+	int num_children = 0;
+
+	for(int i=0; i<4; ++i) {
+		submesh_tree_t::node_t * child = submesh_tree->existing_child(node, i);
+		if(child == nullptr) continue;
+		if(ctx.limiting_box != nullptr && !intersect2d::aabb_aabb(child->aabb(), *ctx.limiting_box)) continue;
+
+		boxes.set(num_children, node_bounds(child));
+		children[num_children++] = child;
+	}
+
+	if(num_children == 0) return;
+
+	/* Unused lanes are masked out below */
+	for(int i=num_children; i<4; ++i) boxes.set(i, node_bounds(children[0]));
 
-	submesh_tree->traverse(std::bind(&Terrain::cull_or_render, cam_tri, near_aabb, aabb2d, std::placeholders::_1));
+	const unsigned int visible = ctx.frustum.intersects4(boxes) & ((1u << num_children) - 1);
+
+	for(int i=0; i<num_children; ++i) {
+		if(visible & (1u << i)) cull_node(children[i], ctx);
+	}
+}
+
+const Terrain::cull_stats_t &Terrain::cull_stats() const {
+	return cull_stats_;
 }
 
 Triangle2D Terrain::calculate_camera_tri(const Camera& cam, AABB_2D &near_aabb) {
@@ -528,32 +818,14 @@ Triangle2D Terrain::calculate_camera_tri(const Camera& cam, AABB_2D &near_aabb)
 
 }
 
-bool Terrain::cull_or_render(const Triangle2D &cam_tri, const AABB_2D & near_aabb, const AABB_2D &limiting_box, QuadTree * node) {
-	if(intersect2d::aabb_aabb(node->aabb, limiting_box) 
-		&& (
-		intersect2d::aabb_aabb(node->aabb, near_aabb)
-		||	intersect2d::aabb_triangle(node->aabb, cam_tri)
-		)
-		) {
-			float d = glm::distance2(node->aabb.middle(), cam_tri.p1);
-			int lod = TERRAIN_LOD_LEVELS - 1;
-			for(int i=0; i< TERRAIN_LOD_LEVELS; ++i) {
-				if(d < lod_distance[i]) {
-					lod = i;
-					break;
-				}
-			}
+float Terrain::horizontal_size() const {
+	return static_cast<float>(size_.x) * horizontal_scale_;
+}
 
-			if(node->level() <= lod) {
-				if(node->data != nullptr) ( (SubMesh*) node->data )->render_geometry();
-				return false;
-			}
-			return true;
-	} else {
-		return false;
-	}
+const float * Terrain::height_map() const {
+	return map_;
 }
 
-float Terrain::horizontal_size() const {
-	return static_cast<float>(size_.x) * horizontal_scale_;
+float Terrain::horizontal_scale() const {
+	return horizontal_scale_;
 }
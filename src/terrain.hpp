@@ -3,18 +3,25 @@
 
 #include <string>
 #include <vector>
+#include <cstdint>
 #include <glm/glm.hpp>
 
 #include "shader.hpp"
 #include "mesh.hpp"
 #include "material.hpp"
 #include "texture.hpp"
+#include "frustum.hpp"
+#include "terrain_cdlod.hpp"
 
 #include "PerlinNoise.hpp"
 
 
 
 #define TERRAIN_LOD_LEVELS 4
+#define TERRAIN_SEED "mario rulez"
+
+/* Bump when the generator or the cache layout changes to invalidate old caches */
+#define TERRAIN_CACHE_VERSION 2
 
 
 
@@ -45,6 +52,16 @@ private:
 
 	void generate_terrain();
 
+	/*
+	 * Terrain cache, see Cache.
+	 * The key is a hash of the config file and seed, so any change to
+	 * terrain.cfg generates a new terrain.
+	 */
+	uint64_t cache_key_;
+	std::string cache_name() const;
+	bool load_cache();
+	void write_cache();
+
 	float height_from_color(const glm::vec4 &color) const ;
 
 	TextureArray * diffuse_textures_, *normal_textures_;
@@ -52,9 +69,50 @@ private:
 	float height_at(int x, int y) const;
 	const glm::vec3 &normal_at(int x, int y) const;
 
-	const glm::ivec2& heightmap_size() const;
+	/*
+	 * Normals of the height map grid. The terrain uses the packed vertex
+	 * format, so vertices_ is released when the buffers are created.
+	 */
+	std::vector<glm::vec3> normals_;
+
+	/*
+	 * Copy the grid normals from vertices_ and create the buffers,
+	 * or set up cdlod_ if it is enabled
+	 */
+	void create_buffers();
+
+	/*
+	 * Normals of the height map from central differences, used with CDLOD
+	 * (matches the normals calculated in terrain_cdlod.vert)
+	 */
+	void calculate_grid_normals();
+
+	/*
+	 * CDLOD rendering, replaces the submeshes when enabled in the config
+	 * (cdlod = 1). The terrain then has no vertices or submeshes of its own.
+	 */
+	bool use_cdlod_;
+	TerrainCDLOD * cdlod_;
+	void render_cdlod(const Camera &cam, const AABB_2D * limiting_box, const glm::mat4& m);
+
+	struct cull_context_t {
+		const Frustum &frustum;
+		const AABB_2D * limiting_box; /* Optional, nodes outside it (in xz) are culled too */
+		glm::vec2 lod_point; /* Point (xz) to measure lod distance from */
+	};
+
+	/*
+	 * Queue the submeshes below node that are inside the frustum, using
+	 * the lod given by the distance to the camera. Node is assumed to be visible.
+	 * The children of each node are tested against the frustum four at a time.
+	 */
+	void cull_node(submesh_tree_t::node_t * node, const cull_context_t &ctx);
+	void render_culled(const Camera &cam, const AABB_2D * limiting_box, const glm::mat4& m);
 
-	static bool cull_or_render(const Triangle2D &cam_tri, const AABB_2D &near_aabb, const AABB_2D &limiting_box, QuadTree * node);
+	/*
+	 * Bounds used for culling, everything in the subtree of node
+	 */
+	const AABB &node_bounds(const submesh_tree_t::node_t * node) const;
 
 	/**
 	 * Calculates camera 2d triangle approximation, and fills near_aabb aabb for near
@@ -67,15 +125,12 @@ private:
 
 	float lod_base_step;
 
-	struct thread_data_t {
-		Shader::vertex_t * tmp_vertices;
-		int start;
-		int end;
-		int num_vertices;
-		int id;
-	};
-
-	unsigned int generate_vertices(void * data);
+	/*
+	 * Generate vertices and height map for rows [start, end).
+	 * vertices_ must already be sized to hold the full grid.
+	 * With CDLOD only the height map is generated and vertices_ is untouched.
+	 */
+	void generate_vertices(int start, int end);
 
 	public:
 
@@ -90,6 +145,9 @@ private:
 		 *              - red is height
 		 *              - green is forced mix in of second texture
 		 *              - blue is reserved for future use
+		 *
+		 * Set cdlod = 1; in the config to render with TerrainCDLOD instead of
+		 * the precalculated lod levels, see TerrainCDLOD.
 		 */
 		Terrain(const std::string &file);
 		virtual ~Terrain();
@@ -105,6 +163,24 @@ private:
 
 		float horizontal_size() const;
 
+		/*
+		 * The height map, heightmap_size().x * heightmap_size().y heights in
+		 * rows along z. Sample (x, y) is at (x, z) = (x, y) * horizontal_scale().
+		 */
+		const float * height_map() const;
+		const glm::ivec2& heightmap_size() const;
+		float horizontal_scale() const;
+
+		/*
+		 * Culling statistics from the last render_cull or render_geometry_cull call
+		 */
+		struct cull_stats_t {
+			unsigned int visited; /* Quad tree nodes that were inside the frustum */
+			unsigned int drawn;   /* Submeshes rendered */
+		};
+
+		const cull_stats_t &cull_stats() const;
+
 		void prepare_shader();
 
 
@@ -113,8 +189,11 @@ private:
 		 * the default values will probably do
 		 */
 		static float culling_fov_factor; /* How much fov is taken into account when culling (multiplied with fov)*/
-		static float culling_near_padding; /* How far back camera point (near plan single point in triangle) 
+		static float culling_near_padding; /* How far back the point lod distance is measured from
 																					is moved from camera position */
+
+	private:
+		cull_stats_t cull_stats_;
 };
 
 #endif
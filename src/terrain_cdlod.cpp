@@ -0,0 +1,306 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "terrain_cdlod.hpp"
+#include "gl_state.hpp"
+#include "logging.hpp"
+#include "utils.hpp"
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+
+/* How far into its range a level starts morphing into the next (0-1) */
+#define CDLOD_MORPH_START 0.7f
+
+/* Attribute locations in terrain_cdlod.vert */
+enum {
+	ATTR_GRID = 0,
+	ATTR_NODE = 1,
+};
+
+float TerrainCDLOD::pixel_error = 2.f;
+
+TerrainCDLOD::TerrainCDLOD(const float * heights, const glm::ivec2 &size, float horizontal_scale, float uv_scale, const Shader * shader)
+	: tree_(nullptr)
+	, horizontal_scale_(horizontal_scale)
+	, visited_(0)
+{
+	build_tree(heights, size);
+	upload_heightmap(heights, size);
+	create_patch();
+	calculate_ranges(1.f);
+
+	u_morph_ = shader->uniform_location("cdlod_morph");
+	u_camera_ = shader->uniform_location("cdlod_camera");
+
+	shader->uniform_upload(shader->uniform_location("cdlod_grid_size"), static_cast<float>(CDLOD_PATCH_SIZE));
+	shader->uniform_upload(shader->uniform_location("cdlod_map_size"), glm::vec2(static_cast<float>(size.x), static_cast<float>(size.y)));
+	shader->uniform_upload(shader->uniform_location("cdlod_horizontal_scale"), horizontal_scale);
+	shader->uniform_upload(shader->uniform_location("cdlod_uv_scale"), uv_scale);
+
+	Logging::verbose("[TerrainCDLOD] %d levels, %d nodes\n", levels_, static_cast<int>(tree_->nodes().size()));
+}
+
+TerrainCDLOD::~TerrainCDLOD() {
+	GLState::delete_vertex_arrays(1, &vao_);
+	GLState::delete_buffers(3, buffers_);
+	GLState::delete_textures(1, &heightmap_);
+	delete tree_;
+}
+
+void TerrainCDLOD::build_tree(const float * heights, const glm::ivec2 &size) {
+	const int quads = std::max(size.x, size.y) - 1;
+	int level = 0;
+	while((CDLOD_PATCH_SIZE << level) < quads) ++level;
+
+	if(level > LINEAR_QUADTREE_MAX_LEVEL) {
+		Logging::fatal("[TerrainCDLOD] Height map %dx%d is too large\n", size.x, size.y);
+	}
+
+	const float root_size = horizontal_scale_ * static_cast<float>(CDLOD_PATCH_SIZE << level);
+	tree_ = new tree_t(AABB_2D(glm::vec2(0.f), glm::vec2(root_size)), level);
+	levels_ = level + 1;
+
+	std::vector<tree_t::node_t> &nodes = tree_->nodes();
+
+	/* Leaves from the height map, the samples on the edges are shared with the neighbours */
+	for(size_t i = tree_t::offset(level); i < nodes.size(); ++i) {
+		tree_t::node_t &node = nodes[i];
+		const int x0 = static_cast<int>(node.min.x / horizontal_scale_ + 0.5f);
+		const int y0 = static_cast<int>(node.min.y / horizontal_scale_ + 0.5f);
+		const int x1 = std::min(x0 + CDLOD_PATCH_SIZE, size.x - 1);
+		const int y1 = std::min(y0 + CDLOD_PATCH_SIZE, size.y - 1);
+
+		glm::vec2 range(FLT_MAX, -FLT_MAX);
+		for(int y=y0; y<=y1; ++y) {
+			for(int x=x0; x<=x1; ++x) {
+				const float h = heights[y * size.x + x];
+				range.x = std::min(range.x, h);
+				range.y = std::max(range.y, h);
+			}
+		}
+		node.data = range;
+		node.used = true;
+	}
+
+	/* Parents from their children, bottom up */
+	for(int depth = level - 1; depth >= 0; --depth) {
+		for(size_t i = tree_t::offset(depth); i < tree_t::offset(depth + 1); ++i) {
+			tree_t::node_t &node = nodes[i];
+			glm::vec2 range(FLT_MAX, -FLT_MAX);
+			for(int q=0; q<4; ++q) {
+				const tree_t::node_t &child = nodes[tree_->child_index(i, node.level, q)];
+				range.x = std::min(range.x, child.data.x);
+				range.y = std::max(range.y, child.data.y);
+			}
+			node.data = range;
+			node.used = true;
+		}
+	}
+
+	aabb_ = AABB(
+		glm::vec3(0.f, nodes[0].data.x, 0.f),
+		glm::vec3(static_cast<float>(size.x - 1) * horizontal_scale_, nodes[0].data.y, static_cast<float>(size.y - 1) * horizontal_scale_)
+	);
+}
+
+void TerrainCDLOD::upload_heightmap(const float * heights, const glm::ivec2 &size) {
+	glGenTextures(1, &heightmap_);
+	GLState::bind_texture(GL_TEXTURE_2D, heightmap_);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, size.x, size.y, 0, GL_RED, GL_FLOAT, heights);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	GLState::bind_texture(GL_TEXTURE_2D, 0);
+	checkForGLErrors("TerrainCDLOD::upload_heightmap()");
+}
+
+void TerrainCDLOD::create_patch() {
+	const int side = CDLOD_PATCH_SIZE + 1;
+
+	std::vector<glm::vec2> grid;
+	grid.reserve(static_cast<size_t>(side * side));
+	for(int y=0; y<side; ++y) {
+		for(int x=0; x<side; ++x) {
+			grid.push_back(glm::vec2(static_cast<float>(x), static_cast<float>(y)) / static_cast<float>(CDLOD_PATCH_SIZE));
+		}
+	}
+
+	/* Same winding as the full terrain mesh */
+	std::vector<GLushort> indices;
+	indices.reserve(CDLOD_PATCH_SIZE * CDLOD_PATCH_SIZE * 6);
+	for(int y=0; y<CDLOD_PATCH_SIZE; ++y) {
+		for(int x=0; x<CDLOD_PATCH_SIZE; ++x) {
+			const GLushort i = static_cast<GLushort>(y * side + x);
+			const GLushort below = static_cast<GLushort>(i + side);
+			indices.push_back(i);
+			indices.push_back(below);
+			indices.push_back(static_cast<GLushort>(i + 1));
+
+			indices.push_back(below);
+			indices.push_back(static_cast<GLushort>(below + 1));
+			indices.push_back(static_cast<GLushort>(i + 1));
+		}
+	}
+	num_indices_ = static_cast<GLsizei>(indices.size());
+
+	glGenBuffers(3, buffers_);
+	glGenVertexArrays(1, &vao_);
+	GLState::bind_vertex_array(vao_);
+
+	GLState::bind_buffer(GL_ARRAY_BUFFER, buffers_[0]);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec2) * grid.size(), grid.data(), GL_STATIC_DRAW);
+	glEnableVertexAttribArray(ATTR_GRID);
+	glVertexAttribPointer(ATTR_GRID, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), nullptr);
+
+	GLState::bind_buffer(GL_ELEMENT_ARRAY_BUFFER, buffers_[1]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * indices.size(), indices.data(), GL_STATIC_DRAW);
+
+	/* One node per instance, filled when rendering */
+	GLState::bind_buffer(GL_ARRAY_BUFFER, buffers_[2]);
+	glEnableVertexAttribArray(ATTR_NODE);
+	glVertexAttribPointer(ATTR_NODE, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), nullptr);
+	glVertexAttribDivisor(ATTR_NODE, 1);
+
+	GLState::bind_vertex_array(0);
+	GLState::bind_buffer(GL_ARRAY_BUFFER, 0);
+	GLState::bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	checkForGLErrors("TerrainCDLOD::create_patch()");
+}
+
+void TerrainCDLOD::calculate_ranges(float lod_scale) {
+	for(int level=0; level<levels_; ++level) {
+		const float start = (level == 0) ? 0.f : range_[level - 1];
+
+		if(level == levels_ - 1) {
+			/* The root is used at any distance and never morphs */
+			range_[level] = FLT_MAX;
+			morph_[level] = glm::vec2(FLT_MAX * 0.5f, FLT_MAX);
+			continue;
+		}
+
+		/*
+		 * The projected error of a level is its vertex spacing divided by the
+		 * distance, a level is used until the next (coarser) level is good enough.
+		 */
+		const float next_spacing = horizontal_scale_ * static_cast<float>(2 << level);
+		range_[level] = std::max(next_spacing * lod_scale / pixel_error, start * 2.f);
+		morph_[level] = glm::vec2(start + (range_[level] - start) * CDLOD_MORPH_START, range_[level]);
+	}
+}
+
+static bool sphere_intersects(const glm::vec3 &center, float radius, const AABB &box) {
+	if(radius >= FLT_MAX) return true;
+	const glm::vec3 closest = glm::clamp(center, box.min, box.max);
+	const glm::vec3 d = closest - center;
+	return glm::dot(d, d) <= radius * radius;
+}
+
+AABB TerrainCDLOD::node_box(const tree_t::node_t &node) const {
+	/* Nodes on the edge are clamped to the height map, like the vertices in the shader */
+	return AABB(
+		glm::vec3(node.min.x, node.data.x, node.min.y),
+		glm::vec3(std::min(node.max.x, aabb_.max.x), node.data.y, std::min(node.max.y, aabb_.max.z))
+	);
+}
+
+bool TerrainCDLOD::visible(const tree_t::node_t &node, const AABB &box, const select_context_t &ctx) const {
+	if(ctx.limiting_box != nullptr) {
+		const AABB_2D &limit = *ctx.limiting_box;
+		if(node.max.x < limit.min.x || node.min.x > limit.max.x || node.max.y < limit.min.y || node.min.y > limit.max.y) return false;
+	}
+	return ctx.frustum.intersects(box);
+}
+
+bool TerrainCDLOD::select(size_t index, const select_context_t &ctx) {
+	const tree_t::node_t &node = tree_->nodes()[index];
+	++visited_;
+
+	/* Completely outside the height map, nothing to draw */
+	if(node.data.x > node.data.y) return true;
+
+	const AABB box = node_box(node);
+	if(!sphere_intersects(ctx.camera, range_[node.level], box)) return false;
+	if(!visible(node, box, ctx)) return true;
+
+	if(node.level == 0 || !sphere_intersects(ctx.camera, range_[node.level - 1], box)) {
+		add_node(node);
+		return true;
+	}
+
+	for(int q=0; q<4; ++q) {
+		const size_t index_child = tree_->child_index(index, node.level, q);
+		if(!select(index_child, ctx)) {
+			/*
+			 * The child is beyond its own range, so it is drawn fully morphed
+			 * which gives the same vertices as this level.
+			 */
+			const tree_t::node_t &child = tree_->nodes()[index_child];
+			if(visible(child, node_box(child), ctx)) add_node(child);
+		}
+	}
+	return true;
+}
+
+void TerrainCDLOD::add_node(const tree_t::node_t &node) {
+	instances_.push_back(glm::vec4(node.min.x, node.min.y, node.max.x - node.min.x, static_cast<float>(node.level)));
+}
+
+void TerrainCDLOD::render(const Frustum &frustum, const glm::vec3 &camera, float lod_scale, const AABB_2D * limiting_box) {
+	calculate_ranges(lod_scale);
+
+	instances_.clear();
+	visited_ = 0;
+
+	const select_context_t ctx = { frustum, limiting_box, camera };
+	select(0, ctx);
+
+	draw(camera);
+}
+
+void TerrainCDLOD::render_all() {
+	instances_.clear();
+	visited_ = 1;
+	add_node(*tree_->root());
+
+	draw(glm::vec3(0.f));
+}
+
+void TerrainCDLOD::draw(const glm::vec3 &camera) {
+	if(instances_.empty()) return;
+
+	glUniform2fv(u_morph_, levels_, &morph_[0].x);
+	glUniform3fv(u_camera_, 1, &camera.x);
+
+	GLState::active_texture(Shader::TEXTURE_2D_5);
+	GLState::bind_texture(GL_TEXTURE_2D, heightmap_);
+
+	/* Orphan the old instance data instead of waiting for the previous draw */
+	GLState::bind_buffer(GL_ARRAY_BUFFER, buffers_[2]);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec4) * instances_.size(), nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(glm::vec4) * instances_.size(), instances_.data());
+	GLState::bind_buffer(GL_ARRAY_BUFFER, 0);
+
+	GLState::bind_vertex_array(vao_);
+	glDrawElementsInstanced(GL_TRIANGLES, num_indices_, GL_UNSIGNED_SHORT, nullptr, static_cast<GLsizei>(instances_.size()));
+	GLState::bind_vertex_array(0);
+
+	checkForGLErrors("TerrainCDLOD::draw()");
+}
+
+const AABB &TerrainCDLOD::aabb() const {
+	return aabb_;
+}
+
+unsigned int TerrainCDLOD::visited() const {
+	return visited_;
+}
+
+unsigned int TerrainCDLOD::drawn() const {
+	return static_cast<unsigned int>(instances_.size());
+}
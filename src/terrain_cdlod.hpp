@@ -0,0 +1,116 @@
+#ifndef TERRAIN_CDLOD_HPP
+#define TERRAIN_CDLOD_HPP
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "aabb.hpp"
+#include "aabb2d.hpp"
+#include "frustum.hpp"
+#include "linear_quadtree.hpp"
+#include "shader.hpp"
+
+/* Quads per side in the shared grid patch, a leaf node covers this many height samples */
+#define CDLOD_PATCH_SIZE 32
+
+/* Must match CDLOD_MAX_LEVELS in terrain_cdlod.vert */
+#define CDLOD_MAX_LEVELS (LINEAR_QUADTREE_MAX_LEVEL + 1)
+
+/*
+ * Continuous distance dependent level of detail for a height map
+ * (Strugar, "Continuous Distance-Dependent Level of Detail for Rendering Heightmaps").
+ *
+ * Every quad tree node is drawn with the same grid patch (instanced), with
+ * the heights read from a texture in the vertex shader. The lod level of a
+ * node is chosen so the projected vertex spacing stays below pixel_error,
+ * and vertices are morphed to the next coarser level before the switch
+ * (see shaders/terrain_cdlod.vert), so there is no popping and no skirts.
+ *
+ * Positions are in terrain space: sample (x, y) is at (x * horizontal_scale, height, y * horizontal_scale).
+ */
+class TerrainCDLOD {
+	public:
+		/*
+		 * The heights (size.x * size.y) are copied to a texture.
+		 * shader is the terrain shader, used for the uniform locations.
+		 */
+		TerrainCDLOD(const float * heights, const glm::ivec2 &size, float horizontal_scale, float uv_scale, const Shader * shader);
+		~TerrainCDLOD();
+
+		/*
+		 * Select and draw the nodes inside the frustum. The terrain shader must be bound.
+		 *
+		 * @param frustum In terrain space.
+		 * @param camera Camera position in terrain space.
+		 * @param lod_scale Screen height / (2 * tan(fov / 2)), pixels per unit at distance 1.
+		 * @param limiting_box Optional, nodes outside it (in xz) are not drawn.
+		 */
+		void render(const Frustum &frustum, const glm::vec3 &camera, float lod_scale, const AABB_2D * limiting_box = nullptr);
+
+		/*
+		 * Draw the whole terrain at the coarsest level
+		 */
+		void render_all();
+
+		/*
+		 * Bounds of the terrain, in terrain space
+		 */
+		const AABB &aabb() const;
+
+		/* Nodes visited and drawn by the last render call */
+		unsigned int visited() const;
+		unsigned int drawn() const;
+
+		/* Largest allowed projected vertex spacing, in pixels */
+		static float pixel_error;
+
+	private:
+		/* Min and max height of each node, empty (min > max) if outside the map */
+		typedef LinearQuadTree<glm::vec2> tree_t;
+
+		struct select_context_t {
+			const Frustum &frustum;
+			const AABB_2D * limiting_box;
+			glm::vec3 camera;
+		};
+
+		tree_t * tree_;
+		AABB aabb_;
+		int levels_;
+		float horizontal_scale_;
+
+		/* Distance where each level ends, and where it starts morphing into the next */
+		float range_[CDLOD_MAX_LEVELS];
+		glm::vec2 morph_[CDLOD_MAX_LEVELS];
+
+		std::vector<glm::vec4> instances_; /* min x, min z, size, level of each selected node */
+		unsigned int visited_;
+
+		GLuint heightmap_;
+		GLuint vao_;
+		GLuint buffers_[3]; /* grid vertices, grid indices, instances */
+		GLsizei num_indices_;
+
+		GLint u_morph_;
+		GLint u_camera_;
+
+		void build_tree(const float * heights, const glm::ivec2 &size);
+		void upload_heightmap(const float * heights, const glm::ivec2 &size);
+		void create_patch();
+		void calculate_ranges(float lod_scale);
+
+		AABB node_box(const tree_t::node_t &node) const;
+		bool visible(const tree_t::node_t &node, const AABB &box, const select_context_t &ctx) const;
+
+		/*
+		 * Add the node, or parts of it, to instances_ if it is visible.
+		 * Returns false if the node is too far away for its level, then
+		 * the parent should draw it instead.
+		 */
+		bool select(size_t index, const select_context_t &ctx);
+		void add_node(const tree_t::node_t &node);
+		void draw(const glm::vec3 &camera);
+};
+
+#endif
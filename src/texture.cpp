@@ -4,6 +4,7 @@
 
 #include "texture.hpp"
 #include "data.hpp"
+#include "gl_state.hpp"
 #include "globals.hpp"
 #include "logging.hpp"
 #include "utils.hpp"
@@ -176,7 +177,7 @@ Texture2D::Texture2D(const std::string& filename, bool mipmap)
 	SDL_Surface* image = load_image(filename, &size);
 
 	glGenTextures(1, &_texture);
-	glBindTexture(GL_TEXTURE_2D, _texture);
+	GLState::bind_texture(GL_TEXTURE_2D, _texture);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 
@@ -191,7 +192,7 @@ Texture2D::Texture2D(const std::string& filename, bool mipmap)
 	}
 
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size.x, size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, image->pixels);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	GLState::bind_texture(GL_TEXTURE_2D, 0);
 
 	SDL_FreeSurface(image);
 }
@@ -202,16 +203,16 @@ Texture2D::~Texture2D(){
 	if ( it != texture_cache.end() ){
 		texture_cache.erase(it);
 	}
-	glDeleteTextures(1, &_texture);
+	GLState::delete_textures(1, &_texture);
 }
 
 void Texture2D::texture_bind(Shader::TextureUnit unit) const {
-	glActiveTexture(unit);
-	glBindTexture(GL_TEXTURE_2D, _texture);
+	GLState::active_texture(unit);
+	GLState::bind_texture(GL_TEXTURE_2D, _texture);
 }
 
 void Texture2D::texture_unbind() const {
-	glBindTexture(GL_TEXTURE_2D, 0);
+	GLState::bind_texture(GL_TEXTURE_2D, 0);
 }
 
 GLuint Texture2D::gl_texture() const {
@@ -249,7 +250,7 @@ TextureCubemap::TextureCubemap(std::vector<std::string> path)
 	}
 
 	glGenTextures(1, &_texture);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, _texture);
+	GLState::bind_texture(GL_TEXTURE_CUBE_MAP, _texture);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
@@ -262,20 +263,20 @@ TextureCubemap::TextureCubemap(std::vector<std::string> path)
 		SDL_FreeSurface(surface);
 	}
 
-	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	GLState::bind_texture(GL_TEXTURE_CUBE_MAP, 0);
 }
 
 TextureCubemap::~TextureCubemap(){
-	glDeleteTextures(1, &_texture);
+	GLState::delete_textures(1, &_texture);
 }
 
 void TextureCubemap::texture_bind(Shader::TextureUnit unit) const {
-	glActiveTexture(unit);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, _texture);
+	GLState::active_texture(unit);
+	GLState::bind_texture(GL_TEXTURE_CUBE_MAP, _texture);
 }
 
 void TextureCubemap::texture_unbind() const {
-	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	GLState::bind_texture(GL_TEXTURE_CUBE_MAP, 0);
 }
 
 TextureArray* TextureArray::from_filename(const char* filename, ...){
@@ -315,7 +316,7 @@ TextureArray::TextureArray(std::vector<std::string> path, bool mipmap)
 	Logging::verbose("Creating TextureArray with %zd images at %dx%d\n", path.size(), size.x, size.y);
 
 	glGenTextures(1, &_texture);
-	glBindTexture(GL_TEXTURE_2D_ARRAY, _texture);
+	GLState::bind_texture(GL_TEXTURE_2D_ARRAY, _texture);
 	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
@@ -340,11 +341,11 @@ TextureArray::TextureArray(std::vector<std::string> path, bool mipmap)
 		SDL_FreeSurface(surface);
 	}
 
-	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	GLState::bind_texture(GL_TEXTURE_2D_ARRAY, 0);
 }
 
 TextureArray::~TextureArray(){
-	glDeleteTextures(1, &_texture);
+	GLState::delete_textures(1, &_texture);
 }
 
 size_t TextureArray::num_textures() const {
@@ -352,12 +353,12 @@ size_t TextureArray::num_textures() const {
 }
 
 void TextureArray::texture_bind(Shader::TextureUnit unit) const {
-	glActiveTexture(unit);
-	glBindTexture(GL_TEXTURE_2D_ARRAY, _texture);
+	GLState::active_texture(unit);
+	GLState::bind_texture(GL_TEXTURE_2D_ARRAY, _texture);
 }
 
 void TextureArray::texture_unbind() const {
-	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	GLState::bind_texture(GL_TEXTURE_2D_ARRAY, 0);
 }
 
 /*
@@ -401,7 +402,7 @@ Texture3D::Texture3D(std::vector<std::string> path, bool mipmap)
 	Logging::verbose("Creating Texture3D with %zd images at %dx%d\n", path.size(), size.x, size.y);
 
 	glGenTextures(1, &_texture);
-	glBindTexture(GL_TEXTURE_3D, _texture);
+	GLState::bind_texture(GL_TEXTURE_3D, _texture);
 	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
@@ -425,11 +426,11 @@ Texture3D::Texture3D(std::vector<std::string> path, bool mipmap)
 		SDL_FreeSurface(surface);
 	}
 
-	glBindTexture(GL_TEXTURE_3D, 0);
+	GLState::bind_texture(GL_TEXTURE_3D, 0);
 }
 
 Texture3D::~Texture3D(){
-	glDeleteTextures(1, &_texture);
+	GLState::delete_textures(1, &_texture);
 }
 
 size_t Texture3D::depth() const {
@@ -437,12 +438,12 @@ size_t Texture3D::depth() const {
 }
 
 void Texture3D::texture_bind(Shader::TextureUnit unit) const {
-	glActiveTexture(unit);
-	glBindTexture(GL_TEXTURE_3D, _texture);
+	GLState::active_texture(unit);
+	GLState::bind_texture(GL_TEXTURE_3D, _texture);
 }
 
 void Texture3D::texture_unbind() const {
-	glBindTexture(GL_TEXTURE_3D, 0);
+	GLState::bind_texture(GL_TEXTURE_3D, 0);
 }
 
 GLuint Texture3D::gl_texture() const {
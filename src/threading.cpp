@@ -5,6 +5,13 @@
 #include "threading.hpp"
 
 #include <functional>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
 
 #ifdef WIN32
 
@@ -82,6 +89,244 @@
 		return sysinfo.dwNumberOfProcessors;
 	}
 #else
-#error "Threading is not implemented for linux yet, fix it!"
-	//sysconf( _SC_NPROCESSORS_ONLN );
-#endif
\ No newline at end of file
+
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <cerrno>
+
+	struct Threading::thread_t {
+		pthread_t hndl;
+		std::function<unsigned int(void *)> start_routine;
+		void * user_data;
+	};
+
+	struct Threading::mutex_t {
+		pthread_mutex_t hndl;
+	};
+
+	static void * call_helper(void * data) {
+		Threading::thread_t * t = (Threading::thread_t*) data;
+		return (void*)(uintptr_t) t->start_routine(t->user_data);
+	}
+
+	/*
+	 * Absolute CLOCK_REALTIME time timeout ms from now, as wanted by the timed pthread functions
+	 */
+	static struct timespec abs_timeout(unsigned long timeout) {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += static_cast<time_t>(timeout / 1000);
+		ts.tv_nsec += static_cast<long>((timeout % 1000) * 1000000);
+		if(ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec += 1;
+			ts.tv_nsec -= 1000000000L;
+		}
+		return ts;
+	}
+
+	Threading::thread_t * Threading::create(std::function<unsigned int(void *)> start_routine, void * args) {
+		Threading::thread_t * t = new Threading::thread_t();
+		t->start_routine = start_routine;
+		t->user_data = args;
+
+		if(pthread_create(&t->hndl, nullptr, &call_helper, t) != 0) {
+			delete t;
+			return nullptr;
+		}
+		return t;
+	}
+
+	unsigned int Threading::join(Threading::thread_t * thread, unsigned long timeout) {
+		void * ret;
+		int err;
+		if(timeout == THREADING_INF) {
+			err = pthread_join(thread->hndl, &ret);
+		} else {
+			const struct timespec ts = abs_timeout(timeout);
+			err = pthread_timedjoin_np(thread->hndl, &ret, &ts);
+		}
+		if(err != 0) return static_cast<unsigned int>(-1);
+		return static_cast<unsigned int>((uintptr_t)ret);
+	}
+
+	void Threading::exit(unsigned int retval) {
+		pthread_exit((void*)(uintptr_t) retval);
+	}
+
+	void Threading::free(Threading::thread_t * thread) {
+		delete thread;
+	}
+
+	Threading::mutex_t * Threading::mutex_create() {
+		mutex_t * m = new mutex_t();
+		pthread_mutex_init(&m->hndl, nullptr);
+		return m;
+	}
+
+	bool Threading::mutex_lock(Threading::mutex_t * mutex, unsigned long timeout) {
+		if(timeout == THREADING_INF) {
+			return pthread_mutex_lock(&mutex->hndl) == 0;
+		} else {
+			const struct timespec ts = abs_timeout(timeout);
+			return pthread_mutex_timedlock(&mutex->hndl, &ts) == 0;
+		}
+	}
+
+	void Threading::mutex_unlock(Threading::mutex_t * mutex) {
+		pthread_mutex_unlock(&mutex->hndl);
+	}
+
+	void Threading::mutex_free(Threading::mutex_t * mutex) {
+		pthread_mutex_destroy(&mutex->hndl);
+		delete mutex;
+	}
+
+	unsigned int Threading::num_cores() {
+		const long n = sysconf( _SC_NPROCESSORS_ONLN );
+		return n > 0 ? static_cast<unsigned int>(n) : 1;
+	}
+#endif
+
+/*
+ * Worker pool
+ */
+
+struct Threading::task_t {
+	std::function<void()> func;
+	bool done;
+};
+
+namespace Threading {
+	static std::mutex pool_mutex;
+	static std::condition_variable work_cond, done_cond;
+	static std::deque<task_t*> queue;
+	static std::vector<std::thread> workers;
+	static bool stopping = false;
+
+	/*
+	 * Run a task that has been popped from the queue.
+	 * Must be called without pool_mutex held.
+	 */
+	static void run_task(task_t * task) {
+		task->func();
+
+		std::lock_guard<std::mutex> lock(pool_mutex);
+		task->done = true;
+		done_cond.notify_all();
+	}
+
+	static void worker_main() {
+		std::unique_lock<std::mutex> lock(pool_mutex);
+		for(;;) {
+			while(!stopping && queue.empty()) work_cond.wait(lock);
+			if(queue.empty()) return; /* stopping and nothing left to do */
+
+			task_t * task = queue.front();
+			queue.pop_front();
+
+			lock.unlock();
+			run_task(task);
+			lock.lock();
+		}
+	}
+
+	/*
+	 * Start the workers if they are not running.
+	 * Must be called with pool_mutex held.
+	 */
+	static void start_workers() {
+		if(!workers.empty()) return;
+
+		const unsigned int cores = num_cores();
+		const unsigned int num_workers = cores > 1 ? cores - 1 : 1;
+
+		stopping = false;
+		for(unsigned int i = 0; i < num_workers; ++i) {
+			workers.push_back(std::thread(&worker_main));
+		}
+	}
+
+	task_t * submit(std::function<void()> func) {
+		task_t * task = new task_t();
+		task->func = func;
+		task->done = false;
+
+		std::lock_guard<std::mutex> lock(pool_mutex);
+		start_workers();
+		queue.push_back(task);
+		work_cond.notify_one();
+
+		return task;
+	}
+
+	void wait(task_t * task) {
+		std::unique_lock<std::mutex> lock(pool_mutex);
+		while(!task->done) {
+			if(!queue.empty()) {
+				/* Help out instead of blocking, this also makes nested waits safe */
+				task_t * other = queue.front();
+				queue.pop_front();
+
+				lock.unlock();
+				run_task(other);
+				lock.lock();
+			} else {
+				done_cond.wait(lock);
+			}
+		}
+		lock.unlock();
+
+		delete task;
+	}
+
+	unsigned int pool_size() {
+		std::lock_guard<std::mutex> lock(pool_mutex);
+		start_workers();
+		return static_cast<unsigned int>(workers.size()) + 1;
+	}
+
+	void parallel_for(int begin, int end, const std::function<void(int, int)> &func, int grain) {
+		if(end <= begin) return;
+
+		const int count = end - begin;
+		int num_ranges = static_cast<int>(pool_size());
+
+		if(grain > 0) num_ranges = std::min(num_ranges, (count + grain - 1) / grain);
+		num_ranges = std::max(1, std::min(num_ranges, count));
+
+		const int partition = count / num_ranges;
+		const int remainder = count % num_ranges;
+
+		std::vector<task_t*> tasks;
+		tasks.reserve(num_ranges - 1);
+
+		/* The first range is run on this thread once the others are queued */
+		int start = begin + partition + (remainder > 0 ? 1 : 0);
+		for(int i = 1; i < num_ranges; ++i) {
+			const int stop = start + partition + (i < remainder ? 1 : 0);
+			tasks.push_back(submit(std::bind(func, start, stop)));
+			start = stop;
+		}
+
+		func(begin, begin + partition + (remainder > 0 ? 1 : 0));
+
+		for(task_t * task : tasks) {
+			wait(task);
+		}
+	}
+
+	void cleanup() {
+		std::vector<std::thread> joining;
+		{
+			std::lock_guard<std::mutex> lock(pool_mutex);
+			stopping = true;
+			work_cond.notify_all();
+			joining.swap(workers);
+		}
+
+		for(std::thread &t : joining) {
+			t.join();
+		}
+	}
+}
\ No newline at end of file
@@ -6,7 +6,8 @@
 #ifdef WIN32
 	#define THREADING_INF INFINITE
 #else
-	#error "FIX ME"
+	#include <climits>
+	#define THREADING_INF ULONG_MAX
 #endif
 
 namespace Threading {
@@ -24,6 +25,50 @@ namespace Threading {
 	void mutex_free(mutex_t * mutex);
 
 	unsigned int num_cores();
+
+	/*
+	 * Worker pool
+	 *
+	 * A single pool of num_cores() - 1 (at least one) worker threads is started
+	 * on first use and lives until cleanup(). Use it instead of creating threads
+	 * for each job.
+	 */
+
+	struct task_t; //Opaque task handle
+
+	/*
+	 * Queue func for execution on the pool.
+	 * The returned task must be passed to wait(), which also frees it.
+	 */
+	task_t * submit(std::function<void()> func);
+
+	/*
+	 * Block until the task has finished, then free it.
+	 * The calling thread executes queued tasks while waiting, so it is safe
+	 * to call from within a task.
+	 */
+	void wait(task_t * task);
+
+	/*
+	 * Run func over [begin, end) split in contiguous ranges, func(start, end)
+	 * is called once for each range. The calling thread takes part in the work
+	 * and the call returns when all ranges are done.
+	 *
+	 * @param grain Minimum number of elements per range. 0 splits the range evenly
+	 *              over all threads.
+	 */
+	void parallel_for(int begin, int end, const std::function<void(int, int)> &func, int grain = 0);
+
+	/*
+	 * Number of threads parallel_for splits work over (workers + caller)
+	 */
+	unsigned int pool_size();
+
+	/*
+	 * Stop and join the pool workers. Tasks still in the queue are run first.
+	 * The pool is restarted if used again.
+	 */
+	void cleanup();
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -81,6 +81,114 @@ int checkForGLErrors(const char *s) {
 	}
 }
 
+uint64_t util_hash(const void * data, size_t size, uint64_t seed) {
+	const unsigned char * bytes = static_cast<const unsigned char*>(data);
+	uint64_t hash = seed;
+	for(size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+uint16_t util_float_to_half(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	const uint32_t sign = (bits >> 16) & 0x8000;
+	const uint32_t raw_exponent = (bits >> 23) & 0xff;
+	const int exponent = static_cast<int>(raw_exponent) - 127 + 15;
+	uint32_t mantissa = bits & 0x7fffff;
+
+	if(raw_exponent == 0xff) {
+		/* inf or nan */
+		return static_cast<uint16_t>(sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0));
+	}
+	if(exponent >= 0x1f) {
+		/* too large, becomes inf */
+		return static_cast<uint16_t>(sign | 0x7c00);
+	}
+	if(exponent <= 0) {
+		/* denormal, or too small and becomes zero */
+		if(exponent < -10) return static_cast<uint16_t>(sign);
+		mantissa |= 0x800000;
+		const uint32_t shift = static_cast<uint32_t>(14 - exponent);
+		uint32_t half = mantissa >> shift;
+		if((mantissa >> (shift - 1)) & 1) ++half;
+		return static_cast<uint16_t>(sign | half);
+	}
+
+	uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+	/* Round, a carry into the exponent is still correct */
+	if(mantissa & 0x1000) ++half;
+	return static_cast<uint16_t>(half);
+}
+
+float util_half_to_float(uint16_t value) {
+	const uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+	const uint32_t exponent = (value >> 10) & 0x1f;
+	const uint32_t mantissa = value & 0x3ff;
+
+	if(exponent == 0) {
+		const float f = ldexpf(static_cast<float>(mantissa), -24);
+		return sign ? -f : f;
+	}
+
+	const uint32_t bits = (exponent == 0x1f)
+		? (sign | 0x7f800000 | (mantissa << 13))
+		: (sign | ((exponent + 127 - 15) << 23) | (mantissa << 13));
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+static float sign_not_zero(float v) {
+	return v >= 0.f ? 1.f : -1.f;
+}
+
+glm::vec2 util_octahedral_encode(const glm::vec3 &v) {
+	const float sum = fabsf(v.x) + fabsf(v.y) + fabsf(v.z);
+	if(sum <= 0.f) return glm::vec2(0.f); /* zero vector, decodes as +z */
+	const glm::vec3 p = v / sum;
+	if(p.z >= 0.f) return glm::vec2(p.x, p.y);
+	/* Fold the lower hemisphere over the diagonals */
+	return glm::vec2(
+		(1.f - fabsf(p.y)) * sign_not_zero(p.x),
+		(1.f - fabsf(p.x)) * sign_not_zero(p.y)
+	);
+}
+
+glm::vec3 util_octahedral_decode(const glm::vec2 &e) {
+	glm::vec3 v(e.x, e.y, 1.f - fabsf(e.x) - fabsf(e.y));
+	if(v.z < 0.f) {
+		v.x = (1.f - fabsf(e.y)) * sign_not_zero(e.x);
+		v.y = (1.f - fabsf(e.x)) * sign_not_zero(e.y);
+	}
+	return glm::normalize(v);
+}
+
+void util_philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]) {
+	uint32_t c[4] = { counter[0], counter[1], counter[2], counter[3] };
+	uint32_t k[2] = { key[0], key[1] };
+
+	for(int round = 0; round < 10; ++round) {
+		const uint64_t p0 = static_cast<uint64_t>(0xD2511F53u) * c[0];
+		const uint64_t p1 = static_cast<uint64_t>(0xCD9E8D57u) * c[2];
+		const uint32_t hi0 = static_cast<uint32_t>(p0 >> 32), lo0 = static_cast<uint32_t>(p0);
+		const uint32_t hi1 = static_cast<uint32_t>(p1 >> 32), lo1 = static_cast<uint32_t>(p1);
+
+		c[0] = hi1 ^ c[1] ^ k[0];
+		c[1] = lo1;
+		c[2] = hi0 ^ c[3] ^ k[1];
+		c[3] = lo0;
+
+		k[0] += 0x9E3779B9u;
+		k[1] += 0xBB67AE85u;
+	}
+
+	for(int i = 0; i < 4; ++i) out[i] = c[i];
+}
+
 float radians_to_degrees(double rad) {
    return (float) (rad * (180/M_PI));
 }
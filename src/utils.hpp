@@ -4,8 +4,11 @@
 #include <glm/glm.hpp>
 #include <string>
 #include <functional>
+#include <cstdint>
 #include <glm/glm.hpp>
 
+#define UTIL_HASH_SEED 14695981039346656037ULL
+
 /**
  * Get the current in-engine time.
  */
@@ -23,6 +26,37 @@ void util_usleep(useconds_t wait);
 
 int checkForGLErrors( const char *s );
 
+/**
+ * 64 bit FNV-1a hash. Pass a previous result as seed to hash several buffers
+ * as one. Stable between runs and platforms, suitable for cache keys.
+ */
+uint64_t util_hash(const void * data, size_t size, uint64_t seed = UTIL_HASH_SEED);
+
+inline uint64_t util_hash(const std::string &str, uint64_t seed = UTIL_HASH_SEED) {
+	return util_hash(str.data(), str.size(), seed);
+}
+
+/**
+ * Convert to/from IEEE 754 half precision (GLhalf), rounding to nearest.
+ */
+uint16_t util_float_to_half(float value);
+float util_half_to_float(uint16_t value);
+
+/**
+ * Octahedral encoding of a unit vector into two values in [-1, 1].
+ * The decoded vector is normalized.
+ */
+glm::vec2 util_octahedral_encode(const glm::vec3 &v);
+glm::vec3 util_octahedral_decode(const glm::vec2 &e);
+
+/*
+ * Philox4x32-10 counter based random number generator (Salmon et al.,
+ * "Parallel random numbers: as easy as 1, 2, 3"). The four outputs only
+ * depend on counter and key, so independent streams need no state.
+ * Must match philox4x32 in cl_programs/particles_random.cl.
+ */
+void util_philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]);
+
 float radians_to_degrees(double rad);
 
 void print_mat4(const glm::mat4 &m);
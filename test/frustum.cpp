@@ -0,0 +1,103 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "frustum.hpp"
+#include "aabb.hpp"
+#include "test/asserts.hpp"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <cstdlib>
+#include <cppunit/CompilerOutputter.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+class Test: public CppUnit::TestFixture {
+  CPPUNIT_TEST_SUITE(Test);
+	CPPUNIT_TEST(test_ortho_planes);
+	CPPUNIT_TEST(test_intersects);
+	CPPUNIT_TEST(test_intersects4_matches_scalar);
+  CPPUNIT_TEST_SUITE_END();
+
+public:
+
+	/* Looking down -z, near 1, far 100 */
+	glm::mat4 perspective() {
+		return glm::frustum(-1.f, 1.f, -1.f, 1.f, 1.f, 100.f);
+	}
+
+	void test_ortho_planes() {
+		Frustum f(glm::ortho(-2.f, 2.f, -1.f, 1.f, 0.f, 10.f));
+
+		CPPUNIT_ASSERT_VEC3_EQUAL(glm::vec3(1.f, 0.f, 0.f), glm::vec3(f.planes[Frustum::PLANE_LEFT]), 0.001f);
+		CPPUNIT_ASSERT_DOUBLES_EQUAL(2.0, f.planes[Frustum::PLANE_LEFT].w, 0.001);
+		CPPUNIT_ASSERT_VEC3_EQUAL(glm::vec3(-1.f, 0.f, 0.f), glm::vec3(f.planes[Frustum::PLANE_RIGHT]), 0.001f);
+		CPPUNIT_ASSERT_VEC3_EQUAL(glm::vec3(0.f, 1.f, 0.f), glm::vec3(f.planes[Frustum::PLANE_BOTTOM]), 0.001f);
+		CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0, f.planes[Frustum::PLANE_TOP].w, 0.001);
+		CPPUNIT_ASSERT_VEC3_EQUAL(glm::vec3(0.f, 0.f, -1.f), glm::vec3(f.planes[Frustum::PLANE_NEAR]), 0.001f);
+		CPPUNIT_ASSERT_DOUBLES_EQUAL(10.0, f.planes[Frustum::PLANE_FAR].w, 0.001);
+	}
+
+	void test_intersects() {
+		Frustum f(perspective());
+
+		/* In front of the camera */
+		CPPUNIT_ASSERT(f.intersects(AABB(glm::vec3(-1.f, -1.f, -10.f), glm::vec3(1.f, 1.f, -5.f))));
+		/* Crossing the near plane */
+		CPPUNIT_ASSERT(f.intersects(AABB(glm::vec3(-0.1f, -0.1f, -5.f), glm::vec3(0.1f, 0.1f, 5.f))));
+		/* Behind the camera */
+		CPPUNIT_ASSERT(!f.intersects(AABB(glm::vec3(-1.f, -1.f, 1.f), glm::vec3(1.f, 1.f, 5.f))));
+		/* Beyond the far plane */
+		CPPUNIT_ASSERT(!f.intersects(AABB(glm::vec3(-1.f, -1.f, -200.f), glm::vec3(1.f, 1.f, -150.f))));
+		/* Above the view, as seen by a pitched down camera */
+		CPPUNIT_ASSERT(!f.intersects(AABB(glm::vec3(-1.f, 20.f, -10.f), glm::vec3(1.f, 30.f, -5.f))));
+		/* Left of the view */
+		CPPUNIT_ASSERT(!f.intersects(AABB(glm::vec3(-30.f, -1.f, -10.f), glm::vec3(-20.f, 1.f, -5.f))));
+	}
+
+	void test_intersects4_matches_scalar() {
+		Frustum f(perspective() * glm::translate(glm::mat4(), glm::vec3(0.f, -5.f, 0.f)));
+
+		srand(1);
+		for(int n=0; n<1000; ++n) {
+			Frustum::box4_t boxes;
+			AABB aabb[4];
+			for(int i=0; i<4; ++i) {
+				glm::vec3 min(
+					static_cast<float>(rand() % 200 - 100),
+					static_cast<float>(rand() % 200 - 100),
+					static_cast<float>(rand() % 200 - 150)
+				);
+				glm::vec3 size(
+					static_cast<float>(rand() % 20),
+					static_cast<float>(rand() % 20),
+					static_cast<float>(rand() % 20)
+				);
+				aabb[i] = AABB(min, min + size);
+				boxes.set(i, aabb[i]);
+			}
+
+			unsigned int expected = 0;
+			for(int i=0; i<4; ++i) {
+				if(f.intersects(aabb[i])) expected |= 1u << i;
+			}
+			CPPUNIT_ASSERT_EQUAL(expected, f.intersects4(boxes));
+		}
+	}
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(Test);
+
+int main(int argc, const char* argv[]){
+  CppUnit::Test *suite = CppUnit::TestFactoryRegistry::getRegistry().makeTest();
+
+  CppUnit::TextUi::TestRunner runner;
+
+  runner.addTest( suite );
+  runner.setOutputter(new CppUnit::CompilerOutputter(&runner.result(), std::cerr ));
+
+  return runner.run() ? 0 : 1;
+}
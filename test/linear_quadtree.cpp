@@ -0,0 +1,200 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "test/asserts.hpp"
+
+#include "linear_quadtree.hpp"
+#include "quadtree.hpp"
+#include "aabb2d.hpp"
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <cppunit/CompilerOutputter.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+typedef LinearQuadTree<int> Tree;
+
+static int sum;
+
+class Test: public CppUnit::TestFixture {
+  CPPUNIT_TEST_SUITE(Test);
+	CPPUNIT_TEST(test_morton);
+	CPPUNIT_TEST(test_create);
+	CPPUNIT_TEST(test_traverse);
+	CPPUNIT_TEST(test_create_inverse);
+	CPPUNIT_TEST(test_same_as_quadtree);
+	CPPUNIT_TEST(test_visit);
+	CPPUNIT_TEST(test_existing_child);
+  CPPUNIT_TEST_SUITE_END();
+
+public:
+
+	Tree * create_top_down_tree(int size) {
+		int side = static_cast<int>(glm::exp2(static_cast<float>(size)));
+		Tree * tree = new Tree(AABB_2D(glm::vec2(0.f), glm::vec2(static_cast<float>(side))), size);
+
+		sum = 0;
+
+		for(int y=0; y<side; ++y) {
+			for(int x=0; x<side; ++x) {
+				Tree::node_t * node = tree->child(glm::vec2(static_cast<float>(x), static_cast<float>(y)));
+				node->data = (y * side + x);
+				sum += node->data;
+			}
+		}
+		return tree;
+	}
+
+	Tree * create_bottom_up_tree(int size) {
+		int side = static_cast<int>(glm::exp2(static_cast<float>(size)));
+		Tree * tree = new Tree(AABB_2D(glm::vec2(0.f), glm::vec2(1.f)), 0);
+
+		sum = 0;
+
+		for(int y=0; y<side; ++y) {
+			for(int x=0; x<side; ++x) {
+				Tree::node_t * node = nullptr;
+				while(node == nullptr) {
+					node = tree->child(glm::vec2(static_cast<float>(x), static_cast<float>(y)));
+					if(node == nullptr) tree = tree->grow();
+				}
+				node->data = (y * side + x);
+				sum += node->data;
+			}
+		}
+		return tree;
+	}
+
+	void test_morton() {
+		for(uint32_t y=0; y<64; ++y) {
+			for(uint32_t x=0; x<64; ++x) {
+				uint32_t dx, dy;
+				Tree::morton_decode(Tree::morton_encode(x, y), dx, dy);
+				CPPUNIT_ASSERT_EQUAL(x, dx);
+				CPPUNIT_ASSERT_EQUAL(y, dy);
+			}
+		}
+		CPPUNIT_ASSERT_EQUAL(3u, Tree::morton_encode(1, 1));
+		CPPUNIT_ASSERT_EQUAL(2u, Tree::morton_encode(0, 1));
+	}
+
+	void test_create() {
+		static const int size = 5;
+		Tree * tree = create_top_down_tree(size);
+		CPPUNIT_ASSERT_EQUAL(size, tree->level());
+		Tree::node_t * node = tree->child(glm::vec2(0.f));
+		CPPUNIT_ASSERT(node != nullptr);
+		CPPUNIT_ASSERT_EQUAL(0, node->level);
+		CPPUNIT_ASSERT(tree->child(glm::vec2(-1.f)) == nullptr);
+		delete tree;
+	}
+
+	void test_traverse() {
+		static const int size = 5;
+		Tree * tree = create_top_down_tree(size);
+		int accum = 0;
+		tree->traverse([&accum](Tree::node_t * node) -> bool {
+			if(node->level == 0) accum += node->data;
+			return true;
+		});
+
+		CPPUNIT_ASSERT_EQUAL(sum, accum);
+		delete tree;
+	}
+
+	void test_create_inverse() {
+		static const int size = 3;
+		Tree * tree = create_bottom_up_tree(size);
+		CPPUNIT_ASSERT_EQUAL(size, tree->level());
+		Tree::node_t * node = tree->child(glm::vec2(0.f));
+		CPPUNIT_ASSERT(node != nullptr);
+		CPPUNIT_ASSERT_EQUAL(0, node->level);
+		CPPUNIT_ASSERT_DOUBLES_EQUAL(8.0, tree->aabb().max.x, 0.0001);
+		CPPUNIT_ASSERT_DOUBLES_EQUAL(8.0, tree->aabb().max.y, 0.0001);
+		delete tree;
+	}
+
+	/*
+	 * Both trees must visit the same nodes in the same order
+	 */
+	void test_same_as_quadtree() {
+		static const int size = 4;
+		const float side = glm::exp2(static_cast<float>(size));
+		const AABB_2D bounds(glm::vec2(0.f), glm::vec2(side));
+		Tree tree(bounds, size);
+		QuadTree * qt = new QuadTree(bounds, size);
+
+		/* Sparse tree with nodes at different levels */
+		for(int i=0; i<40; ++i) {
+			glm::vec2 pos(static_cast<float>((i * 7) % 16), static_cast<float>((i * 11) % 16));
+			int level = i % 3;
+			tree.child(pos, level);
+			qt->child(pos, level);
+		}
+
+		std::vector<glm::vec3> expected, actual;
+		qt->traverse([&expected](QuadTree * node) -> bool {
+			expected.push_back(glm::vec3(node->aabb.min, static_cast<float>(node->level())));
+			return true;
+		});
+		tree.traverse([&actual](Tree::node_t * node) -> bool {
+			actual.push_back(glm::vec3(node->min, static_cast<float>(node->level)));
+			return true;
+		});
+
+		CPPUNIT_ASSERT_EQUAL(expected.size(), actual.size());
+		for(size_t i=0; i<expected.size(); ++i) {
+			CPPUNIT_ASSERT_VEC3_EQUAL(expected[i], actual[i], 0.0001f);
+		}
+		delete qt;
+	}
+
+	void test_visit() {
+		static const int size = 4;
+		Tree * tree = create_top_down_tree(size);
+		/* Make some branches stop early */
+		auto filter = [](Tree::node_t * node) -> bool { return node->level != 2 || node->min.x < 4.f; };
+
+		std::vector<Tree::node_t*> expected, recursive, iterative;
+		tree->traverse([&](Tree::node_t * node) -> bool { expected.push_back(node); return filter(node); });
+		tree->visit([&](Tree::node_t * node) -> bool { recursive.push_back(node); return filter(node); });
+		tree->visit_iterative([&](Tree::node_t * node) -> bool { iterative.push_back(node); return filter(node); });
+
+		CPPUNIT_ASSERT(expected.size() > 1);
+		CPPUNIT_ASSERT(expected == recursive);
+		CPPUNIT_ASSERT(expected == iterative);
+		delete tree;
+	}
+
+	void test_existing_child() {
+		Tree tree(AABB_2D(glm::vec2(0.f), glm::vec2(4.f)), 2);
+		Tree::node_t * leaf = tree.child(glm::vec2(2.5f, 1.5f));
+		Tree::node_t * root = tree.root();
+
+		CPPUNIT_ASSERT(tree.existing_child(root, 0) == nullptr);
+		CPPUNIT_ASSERT(tree.existing_child(root, 2) == nullptr);
+		CPPUNIT_ASSERT(tree.existing_child(root, 3) == nullptr);
+
+		Tree::node_t * node = tree.existing_child(root, 1);
+		CPPUNIT_ASSERT(node != nullptr);
+		CPPUNIT_ASSERT(tree.existing_child(node, 2) == leaf);
+		CPPUNIT_ASSERT(tree.existing_child(leaf, 0) == nullptr);
+	}
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(Test);
+
+int main(int argc, const char* argv[]){
+  CppUnit::Test *suite = CppUnit::TestFactoryRegistry::getRegistry().makeTest();
+
+  CppUnit::TextUi::TestRunner runner;
+
+  runner.addTest( suite );
+  runner.setOutputter(new CppUnit::CompilerOutputter(&runner.result(), std::cerr ));
+
+  return runner.run() ? 0 : 1;
+}
@@ -0,0 +1,250 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "particle_cpu.hpp"
+#include "threading.hpp"
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <cppunit/CompilerOutputter.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+class Test: public CppUnit::TestFixture {
+  CPPUNIT_TEST_SUITE(Test);
+	CPPUNIT_TEST(test_spawn_count);
+	CPPUNIT_TEST(test_spawn_distribution);
+	CPPUNIT_TEST(test_run_motion);
+	CPPUNIT_TEST(test_death);
+	CPPUNIT_TEST(test_compaction);
+	CPPUNIT_TEST(test_height_map);
+	CPPUNIT_TEST(test_emitters);
+  CPPUNIT_TEST_SUITE_END();
+
+public:
+
+	void tearDown() {
+		Threading::cleanup();
+	}
+
+	/* Same defaults as ParticleSystem, without any randomness */
+	particle_config_t config() {
+		particle_config_t c = particle_config_defaults();
+		c.spawn_area = glm::vec4(0.f);
+		c.spawn_velocity_var = glm::vec4(0.f);
+		c.gravity = glm::vec4(0.f);
+		c.bounds_min = glm::vec4(-100.f, -100.f, -100.f, 0.f);
+		c.bounds_max = glm::vec4(100.f, 100.f, 100.f, 0.f);
+		c.avg_ttl = 1.f;
+		c.ttl_var = 0.f;
+		c.avg_scale = 0.5f;
+		c.scale_var = 0.f;
+		c.avg_scale_change = 0.5f;
+		c.avg_wind_influence = 0.f;
+		c.avg_gravity_influence = 0.f;
+		return c;
+	}
+
+	void test_spawn_count() {
+		ParticleCPU particles(64);
+		CPPUNIT_ASSERT_EQUAL(10, particles.spawn(config(), 10, 1, 1));
+		CPPUNIT_ASSERT_EQUAL(10, particles.num_alive());
+		CPPUNIT_ASSERT_EQUAL(54, particles.spawn(config(), 100, 1, 2));
+		CPPUNIT_ASSERT_EQUAL(0, particles.spawn(config(), 1, 1, 3));
+		CPPUNIT_ASSERT_EQUAL(64, particles.num_alive());
+	}
+
+	void test_spawn_distribution() {
+		const int n = 20000;
+		particle_config_t c = config();
+		c.spawn_position = glm::vec4(1.f, 2.f, 3.f, 1.f);
+		c.spawn_area = glm::vec4(2.f, 4.f, 6.f, 0.f);
+		c.avg_scale = 1.f;
+		c.scale_var = 0.5f;
+		c.avg_ttl = 2.f;
+		c.ttl_var = 1.f;
+		c.start_texture = 2;
+		c.num_textures = 3;
+
+		ParticleCPU particles(n);
+		particles.spawn(c, n, 1, 1234);
+
+		std::vector<particle_vertex_t> vertices(n);
+		CPPUNIT_ASSERT_EQUAL(n, particles.run(&c, 0.f, 1, 1, &vertices[0]));
+		CPPUNIT_ASSERT_EQUAL(n, particles.num_alive());
+
+		glm::vec4 sum(0.f);
+		double scale_sum = 0.0;
+		int texture_count[3] = { 0, 0, 0 };
+		for(const particle_vertex_t &v : vertices) {
+			for(int i = 0; i < 3; ++i) {
+				CPPUNIT_ASSERT(v.position[i] >= c.spawn_position[i]);
+				CPPUNIT_ASSERT(v.position[i] <= c.spawn_position[i] + c.spawn_area[i]);
+			}
+			CPPUNIT_ASSERT(v.scale >= 0.5f && v.scale <= 1.5f);
+			CPPUNIT_ASSERT(v.texture_index >= 2 && v.texture_index < 5);
+			CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0, v.color.w, 0.0001);
+
+			sum = sum + v.position;
+			scale_sum += v.scale;
+			++texture_count[v.texture_index - 2];
+		}
+
+		/* Uniform over the spawn area */
+		for(int i = 0; i < 3; ++i) {
+			CPPUNIT_ASSERT_DOUBLES_EQUAL(c.spawn_position[i] + c.spawn_area[i] * 0.5f, sum[i] / n, c.spawn_area[i] * 0.02);
+		}
+		CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0, scale_sum / n, 0.02);
+		for(int count : texture_count) {
+			CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0 / 3.0, static_cast<double>(count) / n, 0.03);
+		}
+	}
+
+	void test_run_motion() {
+		/* Not a multiple of four, so both the vector and scalar path is used */
+		const int n = 7;
+		particle_config_t c = config();
+		c.gravity = glm::vec4(0.f, -2.f, 0.f, 0.f);
+		c.avg_gravity_influence = 1.f;
+
+		ParticleCPU particles(n);
+		CPPUNIT_ASSERT_EQUAL(n, particles.spawn(c, n, 1, 1));
+
+		std::vector<particle_vertex_t> vertices(n);
+		CPPUNIT_ASSERT_EQUAL(n, particles.run(&c, 0.5f, 1, 1, &vertices[0]));
+
+		for(const particle_vertex_t &v : vertices) {
+			/* v += g * dt, p += v * dt */
+			CPPUNIT_ASSERT_DOUBLES_EQUAL(0.5, v.position.x, 0.0001);
+			CPPUNIT_ASSERT_DOUBLES_EQUAL(-0.5, v.position.y, 0.0001);
+			CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, v.position.z, 0.0001);
+
+			/* Half way through life */
+			CPPUNIT_ASSERT_DOUBLES_EQUAL(0.5, v.color.x, 0.0001);
+			CPPUNIT_ASSERT_DOUBLES_EQUAL(0.5, v.color.y, 0.0001);
+			CPPUNIT_ASSERT_DOUBLES_EQUAL(0.75, v.scale, 0.0001);
+		}
+	}
+
+	void test_death() {
+		const int n = 9;
+		particle_config_t c = config();
+
+		ParticleCPU particles(n);
+		particles.spawn(c, n, 1, 1);
+
+		std::vector<particle_vertex_t> vertices(n);
+		CPPUNIT_ASSERT_EQUAL(0, particles.run(&c, 2.f, 1, 1, &vertices[0]));
+		CPPUNIT_ASSERT_EQUAL(0, particles.num_alive());
+
+		/* Leaving the bounds kills the particle on the next update */
+		c.avg_ttl = 10.f;
+		c.bounds_max = glm::vec4(0.5f, 100.f, 100.f, 0.f);
+		particles.spawn(c, n, 1, 2);
+		CPPUNIT_ASSERT_EQUAL(n, particles.run(&c, 1.f, 1, 1, &vertices[0]));
+		CPPUNIT_ASSERT_EQUAL(n, particles.num_alive());
+		CPPUNIT_ASSERT_EQUAL(0, particles.run(&c, 1.f, 1, 1, &vertices[0]));
+		CPPUNIT_ASSERT_EQUAL(0, particles.num_alive());
+	}
+
+	void test_compaction() {
+		/* Spread over several ranges, with live and dead particles mixed in each */
+		const int n = 20000;
+		particle_config_t c = config();
+		c.avg_ttl = 1.f;
+		c.ttl_var = 0.5f;
+
+		ParticleCPU particles(n);
+		CPPUNIT_ASSERT_EQUAL(n, particles.spawn(c, n, 1, 1));
+
+		std::vector<particle_vertex_t> vertices(n);
+		const int count = particles.run(&c, 1.f, 1, 1, &vertices[0]);
+		CPPUNIT_ASSERT_EQUAL(particles.num_alive(), count);
+		CPPUNIT_ASSERT(count > n / 3 && count < 2 * n / 3);
+
+		for(int i = 0; i < count; ++i) {
+			CPPUNIT_ASSERT(vertices[i].color.w > 0.f);
+			CPPUNIT_ASSERT(vertices[i].scale > 0.f);
+		}
+	}
+
+	void test_height_map() {
+		const int n = 100;
+		const float flat[16] = {
+			5.f, 5.f, 5.f, 5.f,
+			5.f, 5.f, 5.f, 5.f,
+			5.f, 5.f, 5.f, 5.f,
+			5.f, 5.f, 5.f, 5.f,
+		};
+		particle_config_t c = config();
+		c.spawn_position = glm::vec4(1.f, 0.f, 1.f, 1.f);
+		c.spawn_area = glm::vec4(1.f, 10.f, 1.f, 0.f);
+		c.avg_spawn_velocity = glm::vec4(0.f, -1.f, 0.f, 0.f);
+		c.avg_ttl = 100.f;
+
+		ParticleCPU particles(n);
+		particles.set_height_map(flat, 4, 4, 2.f);
+
+		/* Spawned above ground */
+		CPPUNIT_ASSERT_EQUAL(n, particles.spawn(c, n, 1, 1));
+		std::vector<particle_vertex_t> vertices(n);
+		CPPUNIT_ASSERT_EQUAL(n, particles.run(&c, 0.f, 1, 1, &vertices[0]));
+		for(const particle_vertex_t &v : vertices) {
+			CPPUNIT_ASSERT(v.position.y > 5.f && v.position.y < 10.f);
+		}
+
+		/* Falling through it */
+		CPPUNIT_ASSERT_EQUAL(n, particles.run(&c, 6.f, 1, 2, &vertices[0]));
+		CPPUNIT_ASSERT_EQUAL(0, particles.run(&c, 0.f, 1, 3, &vertices[0]));
+
+		/* No room above ground */
+		c.spawn_area = glm::vec4(1.f, 4.f, 1.f, 0.f);
+		CPPUNIT_ASSERT_EQUAL(n, particles.spawn(c, n, 1, 4));
+		CPPUNIT_ASSERT_EQUAL(0, particles.run(&c, 0.f, 1, 4, &vertices[0]));
+		CPPUNIT_ASSERT_EQUAL(0, particles.num_alive());
+	}
+
+	void test_emitters() {
+		/* Interleaved, so most blocks of four have both emitters */
+		const int n = 101;
+		particle_config_t c[2] = { config(), config() };
+		c[1].emitter = 1;
+		c[1].avg_spawn_velocity = glm::vec4(0.f, 0.f, 1.f, 0.f);
+		c[1].birth_color = glm::vec4(1.f, 1.f, 1.f, 1.f);
+		c[1].death_color = glm::vec4(1.f, 1.f, 1.f, 1.f);
+
+		ParticleCPU particles(n);
+		for(int i = 0; i < n; ++i) {
+			CPPUNIT_ASSERT_EQUAL(1, particles.spawn(c[i % 3 == 0 ? 1 : 0], 1, 1, 1));
+		}
+
+		std::vector<particle_vertex_t> vertices(n);
+		CPPUNIT_ASSERT_EQUAL(n, particles.run(c, 0.5f, 1, 1, &vertices[0]));
+
+		int count[2] = { 0, 0 };
+		for(const particle_vertex_t &v : vertices) {
+			const int e = v.color.z == 1.f && v.color.x == 1.f ? 1 : 0;
+			++count[e];
+			CPPUNIT_ASSERT_DOUBLES_EQUAL(e == 0 ? 0.5 : 0.0, v.position.x, 0.0001);
+			CPPUNIT_ASSERT_DOUBLES_EQUAL(e == 1 ? 0.5 : 0.0, v.position.z, 0.0001);
+		}
+		CPPUNIT_ASSERT_EQUAL(34, count[1]);
+		CPPUNIT_ASSERT_EQUAL(67, count[0]);
+	}
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(Test);
+
+int main(int argc, const char* argv[]){
+  CppUnit::Test *suite = CppUnit::TestFactoryRegistry::getRegistry().makeTest();
+
+  CppUnit::TextUi::TestRunner runner;
+
+  runner.addTest( suite );
+  runner.setOutputter(new CppUnit::CompilerOutputter(&runner.result(), std::cerr ));
+
+  return runner.run() ? 0 : 1;
+}
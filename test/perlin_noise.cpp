@@ -0,0 +1,140 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "PerlinNoise.hpp"
+#include "test/asserts.hpp"
+
+#include <cppunit/CompilerOutputter.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <cstdio>
+#include <vector>
+
+/*
+ * The row functions run in single precision, the scalar functions in double
+ * precision. Both get the same float x, so the difference is only the
+ * precision of the noise itself.
+ */
+static const double noise_tolerance = 1e-5;
+static const double ridged_tolerance = 1e-4;
+
+/* Includes lengths below and between the SSE (4) and AVX2 (8) widths */
+static const int row_lengths[] = { 1, 3, 7, 37, 64 };
+static const float rows[] = { -3.3f, 0.f, 0.45f, 7.9f, 130.2f };
+static const float offsets[] = { -5.25f, 0.f, 0.6f, 250.1f };
+static const float dx = 0.173f;
+
+class Test: public CppUnit::TestFixture {
+  CPPUNIT_TEST_SUITE(Test);
+	CPPUNIT_TEST(test_noise2_row_scalar);
+	CPPUNIT_TEST(test_noise2_row_sse41);
+	CPPUNIT_TEST(test_noise2_row_avx2);
+	CPPUNIT_TEST(test_ridged_row_scalar);
+	CPPUNIT_TEST(test_ridged_row_sse41);
+	CPPUNIT_TEST(test_ridged_row_avx2);
+  CPPUNIT_TEST_SUITE_END();
+
+	PerlinNoise::simd_t default_simd;
+
+public:
+
+	void setUp() {
+		default_simd = PerlinNoise::simd();
+	}
+
+	void tearDown() {
+		PerlinNoise::set_simd(default_simd);
+	}
+
+	/* Returns false if the cpu does not support the level */
+	bool select(PerlinNoise::simd_t level, const char * name) {
+		if(PerlinNoise::simd_support() < level) {
+			fprintf(stderr, "%s not supported by this cpu, skipped\n", name);
+			return false;
+		}
+		PerlinNoise::set_simd(level);
+		CPPUNIT_ASSERT_EQUAL(level, PerlinNoise::simd());
+		return true;
+	}
+
+	void check_noise2_row() {
+		PerlinNoise perlin("noise2_row");
+		std::vector<float> out;
+
+		for(int n : row_lengths) {
+			out.assign(n, 0.f);
+			for(float y : rows) {
+				for(float x0 : offsets) {
+					perlin.noise2_row(x0, dx, y, n, out.data());
+					for(int i=0; i<n; ++i) {
+						const float x = x0 + static_cast<float>(i)*dx;
+						CPPUNIT_ASSERT_DOUBLES_EQUAL(perlin.noise(x, y), out[i], noise_tolerance);
+					}
+				}
+			}
+		}
+	}
+
+	void check_ridged_row() {
+		/* Same as the terrain, with fewer octaves */
+		const double H = 1.5, lacunarity = 2.0, octaves = 8.0, offset = 1.5, gain = 2.0;
+		const PerlinNoise::ridged_params_t params = PerlinNoise::ridged_params(H, lacunarity, octaves, offset, gain);
+		PerlinNoise perlin("ridged_row");
+		std::vector<float> out;
+
+		for(int n : row_lengths) {
+			out.assign(n, 0.f);
+			for(float y : rows) {
+				for(float x0 : offsets) {
+					perlin.ridgedMultifractalNoise_row(params, x0, dx, y, n, out.data());
+					for(int i=0; i<n; ++i) {
+						const float x = x0 + static_cast<float>(i)*dx;
+						const double expected = perlin.ridgedMultifractalNoise(x, y, H, lacunarity, octaves, offset, gain);
+						CPPUNIT_ASSERT_DOUBLES_EQUAL(expected, out[i], ridged_tolerance);
+					}
+				}
+			}
+		}
+	}
+
+	void test_noise2_row_scalar() {
+		if(select(PerlinNoise::SIMD_NONE, "scalar")) check_noise2_row();
+	}
+
+	void test_noise2_row_sse41() {
+		if(select(PerlinNoise::SIMD_SSE41, "SSE4.1")) check_noise2_row();
+	}
+
+	void test_noise2_row_avx2() {
+		if(select(PerlinNoise::SIMD_AVX2, "AVX2")) check_noise2_row();
+	}
+
+	void test_ridged_row_scalar() {
+		if(select(PerlinNoise::SIMD_NONE, "scalar")) check_ridged_row();
+	}
+
+	void test_ridged_row_sse41() {
+		if(select(PerlinNoise::SIMD_SSE41, "SSE4.1")) check_ridged_row();
+	}
+
+	void test_ridged_row_avx2() {
+		if(select(PerlinNoise::SIMD_AVX2, "AVX2")) check_ridged_row();
+	}
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(Test);
+
+int main(int argc, const char* argv[]){
+  CppUnit::Test *suite = CppUnit::TestFactoryRegistry::getRegistry().makeTest();
+
+  CppUnit::TextUi::TestRunner runner;
+
+  runner.addTest( suite );
+  runner.setOutputter(new CppUnit::CompilerOutputter(&runner.result(), std::cerr ));
+
+  return runner.run() ? 0 : 1;
+}
@@ -8,6 +8,7 @@
 #include "aabb2d.hpp"
 
 #include <glm/glm.hpp>
+#include <vector>
 #include <cppunit/CompilerOutputter.h>
 #include <cppunit/extensions/TestFactoryRegistry.h>
 #include <cppunit/ui/text/TestRunner.h>
@@ -20,6 +21,7 @@ class Test: public CppUnit::TestFixture {
 	CPPUNIT_TEST(test_create);
 	CPPUNIT_TEST(test_traverse);
 	CPPUNIT_TEST(test_create_inverse);
+	CPPUNIT_TEST(test_visit);
 	//CPPUNIT_TEST(test_traverse_inverse);
   CPPUNIT_TEST_SUITE_END();
 
@@ -123,6 +125,23 @@ public:
 		free_tree(tree);
 	}
 
+	void test_visit() {
+		static const int size = 4;
+		QuadTree * tree = create_top_down_tree(size);
+		/* Make some branches stop early */
+		auto filter = [](QuadTree * node) -> bool { return node->level() != 2 || node->aabb.min.x < 4.f; };
+
+		std::vector<QuadTree*> expected, recursive, iterative;
+		tree->traverse([&](QuadTree * node) -> bool { expected.push_back(node); return filter(node); });
+		tree->visit([&](QuadTree * node) -> bool { recursive.push_back(node); return filter(node); });
+		tree->visit_iterative([&](QuadTree * node) -> bool { iterative.push_back(node); return filter(node); });
+
+		CPPUNIT_ASSERT(expected.size() > 1);
+		CPPUNIT_ASSERT(expected == recursive);
+		CPPUNIT_ASSERT(expected == iterative);
+		free_tree(tree);
+	}
+
 	void test_traverse_inverse() {
 		static const int size = 5;
 		QuadTree * tree = create_bottom_up_tree(size);
@@ -0,0 +1,106 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "threading.hpp"
+
+#include <vector>
+#include <mutex>
+#include <cppunit/CompilerOutputter.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+class Test: public CppUnit::TestFixture {
+  CPPUNIT_TEST_SUITE(Test);
+	CPPUNIT_TEST(test_parallel_for_covers_range);
+	CPPUNIT_TEST(test_parallel_for_grain);
+	CPPUNIT_TEST(test_parallel_for_empty);
+	CPPUNIT_TEST(test_submit_wait);
+	CPPUNIT_TEST(test_nested_wait);
+	CPPUNIT_TEST(test_thread_join);
+  CPPUNIT_TEST_SUITE_END();
+
+public:
+
+	void tearDown() {
+		Threading::cleanup();
+	}
+
+	void test_parallel_for_covers_range() {
+		std::vector<int> hits(1000, 0);
+		Threading::parallel_for(0, 1000, [&hits](int start, int end) {
+			for(int i=start; i<end; ++i) ++hits[i];
+		});
+
+		for(int i=0; i<1000; ++i) {
+			CPPUNIT_ASSERT_EQUAL(1, hits[i]);
+		}
+	}
+
+	void test_parallel_for_grain() {
+		std::vector<int> sizes;
+		Threading::parallel_for(0, 10, [&sizes](int start, int end) {
+			static std::mutex m;
+			std::lock_guard<std::mutex> lock(m);
+			sizes.push_back(end - start);
+		}, 5);
+
+		CPPUNIT_ASSERT(sizes.size() <= 2);
+		for(int size : sizes) {
+			CPPUNIT_ASSERT(size >= 5);
+		}
+	}
+
+	void test_parallel_for_empty() {
+		bool called = false;
+		Threading::parallel_for(5, 5, [&called](int, int) { called = true; });
+		CPPUNIT_ASSERT(!called);
+	}
+
+	void test_submit_wait() {
+		int value = 0;
+		Threading::task_t * task = Threading::submit([&value]() { value = 42; });
+		Threading::wait(task);
+		CPPUNIT_ASSERT_EQUAL(42, value);
+	}
+
+	void test_nested_wait() {
+		std::vector<int> hits(64, 0);
+		Threading::parallel_for(0, 8, [&hits](int start, int end) {
+			for(int i=start; i<end; ++i) {
+				Threading::parallel_for(i * 8, (i + 1) * 8, [&hits](int s, int e) {
+					for(int j=s; j<e; ++j) ++hits[j];
+				});
+			}
+		});
+
+		for(int i=0; i<64; ++i) {
+			CPPUNIT_ASSERT_EQUAL(1, hits[i]);
+		}
+	}
+
+	void test_thread_join() {
+		unsigned int value = 7;
+		Threading::thread_t * thread = Threading::create([](void * data) -> unsigned int {
+			return *static_cast<unsigned int*>(data);
+		}, &value);
+		CPPUNIT_ASSERT(thread != nullptr);
+		CPPUNIT_ASSERT_EQUAL(7u, Threading::join(thread));
+		Threading::free(thread);
+	}
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(Test);
+
+int main(int argc, const char* argv[]){
+  CppUnit::Test *suite = CppUnit::TestFactoryRegistry::getRegistry().makeTest();
+
+  CppUnit::TextUi::TestRunner runner;
+
+  runner.addTest( suite );
+  runner.setOutputter(new CppUnit::CompilerOutputter(&runner.result(), std::cerr ));
+
+  return runner.run() ? 0 : 1;
+}
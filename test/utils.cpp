@@ -3,6 +3,7 @@
 #endif
 
 #include "utils.hpp"
+#include <cmath>
 #include <cppunit/CompilerOutputter.h>
 #include <cppunit/extensions/TestFactoryRegistry.h>
 #include <cppunit/ui/text/TestRunner.h>
@@ -14,6 +15,9 @@ class Test: public CppUnit::TestFixture {
 	CPPUNIT_TEST(test_screen_pos_upper);
 	CPPUNIT_TEST(test_screen_pos_center);
 	CPPUNIT_TEST(test_screen_pos_box);
+	CPPUNIT_TEST(test_half_float);
+	CPPUNIT_TEST(test_octahedral);
+	CPPUNIT_TEST(test_philox);
   CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -42,6 +46,61 @@ public:
 	  CPPUNIT_ASSERT_EQUAL((int)tmp.y, 75);
   }
 
+	void test_half_float(){
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0x0000, util_float_to_half(0.f));
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0x3c00, util_float_to_half(1.f));
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0xc000, util_float_to_half(-2.f));
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0x7bff, util_float_to_half(65504.f));
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0x7c00, util_float_to_half(1e6f));
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0x0001, util_float_to_half(ldexpf(1.f, -24)));
+
+		for(float f = -100.f; f < 100.f; f += 0.37f) {
+			CPPUNIT_ASSERT_DOUBLES_EQUAL(f, util_half_to_float(util_float_to_half(f)), fabsf(f) / 1024.f + 1e-6f);
+		}
+	}
+
+	/* Known answers from the Random123 distribution */
+	void test_philox(){
+		const uint32_t counters[3][4] = {
+			{ 0x00000000, 0x00000000, 0x00000000, 0x00000000 },
+			{ 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff },
+			{ 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344 },
+		};
+		const uint32_t keys[3][2] = {
+			{ 0x00000000, 0x00000000 },
+			{ 0xffffffff, 0xffffffff },
+			{ 0xa4093822, 0x299f31d0 },
+		};
+		const uint32_t expected[3][4] = {
+			{ 0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8 },
+			{ 0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd },
+			{ 0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1 },
+		};
+
+		for(int i = 0; i < 3; ++i) {
+			uint32_t out[4];
+			util_philox4x32(counters[i], keys[i], out);
+			for(int j = 0; j < 4; ++j) {
+				CPPUNIT_ASSERT_EQUAL(expected[i][j], out[j]);
+			}
+		}
+	}
+
+	void test_octahedral(){
+		for(float theta = 0.f; theta < 3.14f; theta += 0.1f) {
+			for(float phi = 0.f; phi < 6.28f; phi += 0.1f) {
+				const glm::vec3 v(sinf(theta) * cosf(phi), sinf(theta) * sinf(phi), cosf(theta));
+				const glm::vec2 e = util_octahedral_encode(v);
+				CPPUNIT_ASSERT(fabsf(e.x) <= 1.f && fabsf(e.y) <= 1.f);
+
+				const glm::vec3 d = util_octahedral_decode(e);
+				CPPUNIT_ASSERT_DOUBLES_EQUAL(v.x, d.x, 1e-5);
+				CPPUNIT_ASSERT_DOUBLES_EQUAL(v.y, d.y, 1e-5);
+				CPPUNIT_ASSERT_DOUBLES_EQUAL(v.z, d.z, 1e-5);
+			}
+		}
+	}
+
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(Test);